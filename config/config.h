@@ -17,17 +17,77 @@ static const char *WWW_ROOT_DIR = "www";
 static const int BLOCK_QUEUE_SIZE = 1000;
 static const int LOG_BUFF_SIZE = 8192;
 static const int LOG_SPLIT_LINES = 5000000;
-static const int LOG_MAX_QUEUE_SIZE = 0;   // 默认为0，即同步日志模式
+// 每个线程把日志写入自己的环形缓冲区，由后台刷写线程成批写入文件
+static const long LOG_RING_SIZE = 256 * 1024;     // 每个线程环形缓冲区的大小，必须是 2 的幂
+// 写出策略，"immediate"、"interval"、"size" 或 "error"，可由 -f 参数覆盖
+static const char *LOG_FLUSH_POLICY_NAME = "interval";
+static const long LOG_FLUSH_SIZE = 64 * 1024;     // size 策略：某个线程的缓冲区积累到这个大小时写出
+static const long LOG_FLUSH_INTERVAL_MS = 100;    // interval 策略：每隔这么久写出一次
+// 缓冲区满时的处理，"block"（等待刷写线程腾出空间）或 "drop"（丢弃并计数），可由 -o 参数覆盖
+static const char *LOG_FULL_POLICY_NAME = "block";
+// 日志模式，"text"、"deferred" 或 "binary"，可由 -l 参数覆盖，后两种写日志的线程不格式化
+static const char *LOG_MODE_NAME = "text";
+static const int LOG_FORMAT_NUMBER = 4096;        // 登记的格式串（日志调用处）个数上限
+// 运行时的日志等级，"debug"、"info"、"warn" 或 "error"，可由 -v 参数覆盖，运行中用 SIGUSR1/SIGUSR2 调低/调高一级
+static const char *LOG_LEVEL_NAME = "info";
+
+// 编译期的日志等级下限，低于它的 LOG_* 调用连同参数求值一起被编译器去掉，发布构建（定义了 NDEBUG）去掉 DEBUG 日志
+#ifndef LOG_LEVEL_FLOOR
+#ifdef NDEBUG
+#define LOG_LEVEL_FLOOR 1
+#else
+#define LOG_LEVEL_FLOOR 0
+#endif
+#endif
 
 #define MAX_FD 65536           //最大文件描述符
 #define MAX_EVENT_NUMBER 10000 //最大事件数
-#define TIMESLOT 5             //最小超时单位
+#define TIMER_TICK_MS 500      // 定时器 tick 间隔（毫秒），由每个事件循环的 timerfd 驱动
+#define CONN_TIMEOUT_MS 15000  // 非活动连接的超时时间（毫秒）
+
+// 连接的读写缓冲区从缓冲区池中申请，只在有数据收发时持有
+#define BUFFER_CHUNK_SIZE 4096      // 缓冲区池最小一级的大小，每一级翻倍
+#define READ_BUFFER_MAX 65536       // 单个连接读缓冲区的上限，即请求头（包括 POST 请求体）的最大长度
+#define BUFFER_POOL_CACHE 1024      // 缓冲区池每一级最多缓存的空闲缓冲区个数
+
+// 不小于这个大小的文件用 sendfile 发送，更小的文件继续 mmap 后与响应头一起 writev
+#define SENDFILE_THRESHOLD 16384
+
+// 打开文件缓存，命中时不需要 stat、open 与 mmap，文件变化由 inotify 通知失效
+#define FILE_CACHE_NUMBER 1024      // 缓存的文件个数上限
+#define FILE_CACHE_SHARDS 16        // 分片数，每个分片一把锁
+
+// 小文件的完整响应缓存，命中时直接发送序列化好的状态行、响应头与文件内容
+#define RESPONSE_CACHE_FILE_MAX 65536           // 小于这个大小的文件才缓存响应
+#define RESPONSE_CACHE_MEMORY (64L * 1024 * 1024)   // 缓存响应占用的内存上限
+#define RESPONSE_CACHE_SHARDS 16                // 分片数，每个分片一把锁
+
+// 内容编码：没有预先压缩的 .br/.gz 文件时，可压缩类型的文件由后台线程压缩一次
+#define COMPRESS_FILE_MIN 256                   // 小于这个大小的文件不压缩
+#define COMPRESS_FILE_MAX (8L * 1024 * 1024)    // 大于这个大小的文件不压缩
+#define COMPRESS_MEMORY (128L * 1024 * 1024)    // 压缩结果占用的内存上限
+#define COMPRESS_QUEUE_SIZE 1024                // 等待压缩的文件个数上限
+#define COMPRESS_GZIP_LEVEL 6
+#define COMPRESS_BROTLI_QUALITY 9
+
+// 冷文件读取：要发送的文件内容不在页缓存中时交给 I/O 线程读入，读完之后再发送，事件循环不等待磁盘
+#define IO_THREAD_NUMBER 4              // I/O 线程的数量
+#define IO_QUEUE_SIZE 1024              // 等待读取的请求个数上限
+#define IO_WINDOW (1024L * 1024)        // sendfile 每次检查是否在页缓存中的长度，也是 I/O 线程一次读入的长度
+
+#define REACTOR_NUMBER 1    // 事件循环（reactor）的数量，可由 -r 参数覆盖，0 表示每个 CPU 核心一个
+#define MAX_REACTOR_NUMBER 64   // 事件循环数量上限
+
+// 事件后端，"epoll" 或 "uring"，可由 -b 参数覆盖，io_uring 不可用时回退到 epoll
+static const char *EVENT_BACKEND = "epoll";
+#define URING_QUEUE_DEPTH 4096      // io_uring 提交队列长度
+#define URING_BUFFER_NUMBER 1024    // 提供给内核的接收缓冲区个数，必须是 2 的幂
+#define URING_BUFFER_SIZE 2048      // 每个接收缓冲区的大小
 
 #define THREAD_NUMBER 8     // 线程池的大小
 #define MAX_REQUEST 10000   // 线程池中的请求队列的长度
-
-#define SYNC_LOG  //同步写日志
-//#define ASYNC_LOG //异步写日志
+// 线程池调度方式，"fifo" 共享队列或 "steal" 工作窃取，可由 -s 参数覆盖
+static const char *POOL_SCHEDULE = "fifo";
 
 #define conn_fdET //边缘触发非阻塞
 //#define conn_fdLT //水平触发阻塞
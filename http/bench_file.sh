@@ -0,0 +1,52 @@
+#!/bin/bash
+#*******************************************************************************
+# @author: Cuyu Tang
+# @email: me@expoli.tech
+# @website: www.expoli.tech
+# @date: 2023/4/30 10:40
+# @version: 1.0
+# @description: 
+#*******************************************************************************
+
+# 静态文件发送的吞吐量测试：4 KB、1 MB、1 GB 三种文件，epoll 与 uring 两种事件循环
+# 在临时目录中生成文件并启动服务器，用 bench_load 以长连接反复请求同一个文件，每种组合测量 RUNS 次
+# 用法：http/bench_file.sh 构建目录 [服务器程序]
+#   构建目录中需要有 bench_load；服务器程序默认是构建目录中的 MyTinyWebServer，
+#   可以换成其他版本构建出的服务器，用同一个客户端比较修改前后的结果
+# 环境变量：RUNS（默认 3）、SECONDS_PER_RUN（默认 4，1 GB 文件加倍）、BACKENDS（默认 "epoll uring"）
+
+BUILD=$(cd "${1:?usage: $0 build_dir [server]}" && pwd)
+SERVER=$(realpath "${2:-$BUILD/MyTinyWebServer}")
+LOAD=$BUILD/bench_load
+RUNS=${RUNS:-3}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-4}
+BACKENDS=${BACKENDS:-epoll uring}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+mkdir -p "$DIR/www"
+head -c 4096 /dev/urandom > "$DIR/www/4k.bin"
+head -c $((1 << 20)) /dev/urandom > "$DIR/www/1m.bin"
+head -c $((1 << 30)) /dev/urandom > "$DIR/www/1g.bin"
+cd "$DIR" || exit 1
+
+# 文件 连接数 秒数
+CASES="4k.bin 16 $SECONDS_PER_RUN
+1m.bin 8 $SECONDS_PER_RUN
+1g.bin 2 $((SECONDS_PER_RUN * 2))"
+
+for backend in $BACKENDS; do
+    while read -r file connections seconds; do
+        for ((run = 0; run < RUNS; ++run)); do
+            port=$((20000 + RANDOM % 20000))
+            "$SERVER" 127.0.0.1 $port -b "$backend" > /dev/null 2>&1 &
+            pid=$!
+            sleep 0.5
+            printf '%-6s ' "$backend"
+            "$LOAD" $port "/$file" "$connections" "$seconds"
+            kill -TERM $pid
+            wait $pid 2> /dev/null
+            rm -f ./*ServerLog*
+        done
+    done <<< "$CASES"
+done
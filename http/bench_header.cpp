@@ -0,0 +1,197 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/29 18:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "http_conn.h"
+#include "http_format.h"
+#include "file_cache.h"
+#include "mime.h"
+#include "compressor.h"
+#include "../timer/coarse_clock.h"
+
+/**
+ * 响应头生成的性能测试
+ * 比较原来每一行都经过 vsnprintf 的生成方式（格式串与原来的 add_response 相同，不含每行的日志与刷新）
+ * 与现在的 add_status_line + add_headers（memcpy 与 format_decimal），两种方式生成的字节先校验一致；
+ * 另外单独比较 format_decimal 与 snprintf("%lu")
+ * 用法：bench_header [次数]
+ */
+
+/**
+ * 直接访问 http_conn 的响应头生成函数
+ */
+struct HeaderBench {
+    static void prepare(http_conn &conn, CachedFile *file, int encoding) {
+        conn.reserve_write();
+        conn.m_file = file;
+        conn.m_mime = file ? file->mime : nullptr;
+        conn.m_encoding = encoding;
+        conn.m_keepalive = true;
+        conn.m_range_count = 0;
+    }
+
+    static int build(http_conn &conn, int status, size_t content_length) {
+        conn.m_write_idx = 0;
+        conn.add_status_line(status);
+        conn.add_headers(content_length);
+        return conn.m_write_idx;
+    }
+
+    static const char *buffer(const http_conn &conn) { return conn.m_write_buff; }
+
+    static void finish(http_conn &conn) {
+        conn.m_file = nullptr;
+        conn.release();
+    }
+};
+
+/**
+ * 原来的生成方式：每一行都用 vsnprintf 格式化
+ */
+class PrintfHeaders {
+public:
+    int build(int status, const char *title, size_t content_length, const CachedFile *file, int encoding) {
+        m_idx = 0;
+        add("%s %d %s\r\n", "HTTP/1.1", status, title);
+        CoarseClock::DateCache date{};
+        CoarseClock::get_instance()->read(date);
+        add("Date:%s\r\n", date.http_date);
+        add("Content-Length:%zu\r\n", content_length);
+        add("Connection:%s\r\n", "keep-alive");
+        if (file) {
+            add("Content-Type:%s\r\n", file->mime->type);
+            if (encoding != ENCODING_IDENTITY)
+                add("Content-Encoding:%s\r\n", encoding_name(encoding));
+            else
+                add("Accept-Ranges:%s\r\n", "bytes");
+            if (file->mime->compressible)
+                add("Vary:%s\r\n", "Accept-Encoding");
+            if (encoding != ENCODING_IDENTITY)
+                add("ETag:\"%s-%s\"\r\n", file->etag, encoding_name(encoding));
+            else
+                add("ETag:\"%s\"\r\n", file->etag);
+            add("Last-Modified:%s\r\n", file->last_modified);
+        }
+        add("%s", "\r\n");
+        return m_idx;
+    }
+
+    const char *buffer() const { return m_buffer; }
+
+private:
+    char m_buffer[1024];
+    int m_idx = 0;
+
+    __attribute__((format(printf, 2, 3)))
+    void add(const char *format, ...) {
+        va_list args;
+        va_start(args, format);
+        m_idx += vsnprintf(m_buffer + m_idx, sizeof m_buffer - 1 - m_idx, format, args);
+        va_end(args);
+    }
+};
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * 一种响应：先校验两种方式生成的字节相同，再分别测量生成一个响应头的纳秒数
+ */
+static void compare(const char *name, int status, const char *title, size_t content_length, CachedFile *file,
+                    int encoding, long rounds) {
+    http_conn *conn = new http_conn();
+    HeaderBench::prepare(*conn, file, encoding);
+    PrintfHeaders printf_headers;
+    int length = HeaderBench::build(*conn, status, content_length);
+    int expected = printf_headers.build(status, title, content_length, file, encoding);
+    if (length != expected || memcmp(HeaderBench::buffer(*conn), printf_headers.buffer(), length) != 0) {
+        fprintf(stderr, "%s: header bytes differ\n--- printf\n%.*s--- add_headers\n%.*s", name, expected,
+                printf_headers.buffer(), length, HeaderBench::buffer(*conn));
+        exit(1);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        expected = printf_headers.build(status, title, content_length, file, encoding);
+        __asm__ __volatile__("" : : "r"(expected) : "memory");
+    }
+    double printf_ns = elapsed_ns(start) / (double) rounds;
+
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        length = HeaderBench::build(*conn, status, content_length);
+        __asm__ __volatile__("" : : "r"(length) : "memory");
+    }
+    double append_ns = elapsed_ns(start) / (double) rounds;
+
+    int lines = 0;
+    for (int i = 0; i < length; ++i)
+        lines += HeaderBench::buffer(*conn)[i] == '\n';
+    printf("%-12s %2d lines %4d B   printf %8.1f ns   add_headers %8.1f ns   x%.1f\n", name, lines, length,
+           printf_ns, append_ns, printf_ns / append_ns);
+    HeaderBench::finish(*conn);
+    delete conn;
+}
+
+/**
+ * 长度从 1 位到 12 位的整数，覆盖 Content-Length 常见的范围
+ */
+static void compare_decimal(long rounds) {
+    unsigned long values[12];
+    unsigned long value = 7;
+    for (unsigned long &v : values) {
+        v = value;
+        value = value * 10 + 3;
+    }
+    char buffer[32];
+    int length = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        length = snprintf(buffer, sizeof buffer, "%lu", values[i % 12]);
+        __asm__ __volatile__("" : : "r"(length) : "memory");
+    }
+    double printf_ns = elapsed_ns(start) / (double) rounds;
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        length = format_decimal(buffer, values[i % 12]);
+        __asm__ __volatile__("" : : "r"(length) : "memory");
+    }
+    double decimal_ns = elapsed_ns(start) / (double) rounds;
+    printf("%-12s 1-12 digits        snprintf %8.1f ns   format_decimal %5.1f ns   x%.1f\n", "integer",
+           printf_ns, decimal_ns, printf_ns / decimal_ns);
+}
+
+int main(int argc, char *argv[]) {
+    long rounds = argc >= 2 ? atol(argv[1]) : 2000000;
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+    // 81 KB 的 JS 文件，实体标签与修改时间的格式与 FileCache 生成的相同
+    auto *file = new CachedFile();
+    file->path = "static/js/app.js";
+    file->mime = mime_of(file->path.c_str());
+    file->file_stat.st_size = 81 * 1024;
+    snprintf(file->etag, sizeof file->etag, "%lx-%lx-%lx", 0x1a2b3cUL, (unsigned long) file->file_stat.st_size,
+             0x6442d1f0UL);
+    CoarseClock::format_http_date(1681800000, file->last_modified);
+
+    compare("js identity", 200, "OK", file->file_stat.st_size, file, ENCODING_IDENTITY, rounds);
+    compare("js gzip", 200, "OK", 23456, file, ENCODING_GZIP, rounds);
+    compare("404 page", 404, "Not Found", 49, nullptr, ENCODING_IDENTITY, rounds);
+    compare_decimal(rounds);
+    delete file;
+    return 0;
+}
@@ -0,0 +1,141 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/30 10:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * 长连接压测客户端，测量服务器的每秒请求数与吞吐量
+ * 每个连接同时只有一个请求，请求显式带上 Connection: keep-alive 以便也能测量旧版本，收到完整的响应（按 Content-Length）后立即发送下一个请求，
+ * 所有连接由一个 epoll 线程驱动，结束时输出每秒完成的请求数与每秒收到的字节数
+ * 用法：bench_load port path [连接数] [秒数] [ip]，默认 16 个连接、3 秒、127.0.0.1
+ * 文件发送的吞吐量见 http/bench_file.sh，日志刷新策略的每秒请求数见 log/bench_flush.sh
+ */
+
+static const int READ_SIZE = 1 << 20;
+
+struct Client {
+    int fd;
+    std::string head;   // 还没有收完的响应头
+    long remain;        // 响应体还需要接收的字节数，-1 表示正在接收响应头
+};
+
+static int connect_to(const char *ip, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &address.sin_addr);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof address) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+/**
+ * 解析收到的响应头，得到响应体的长度
+ * @return 响应头还不完整返回 false；状态码不是 200 或没有 Content-Length 时退出
+ */
+static bool parse_head(Client &client, const char *data, long length, long &body) {
+    client.head.append(data, length);
+    size_t end = client.head.find("\r\n\r\n");
+    if (end == std::string::npos)
+        return false;
+    const char *head = client.head.c_str();
+    const char *content_length = strcasestr(head, "\r\nContent-Length:");
+    if (strncmp(head, "HTTP/1.1 200 ", 13) != 0 || !content_length || content_length > head + end) {
+        fprintf(stderr, "unexpected response:\n%.*s\n", (int) end, head);
+        exit(1);
+    }
+    // 响应头之后已经收到的部分属于响应体
+    body = (long) (client.head.size() - end - 4);
+    client.remain = atol(content_length + 17);
+    client.head.clear();
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s port path [connections] [seconds] [ip]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    const char *path = argv[2];
+    int connections = argc >= 4 ? atoi(argv[3]) : 16;
+    double seconds = argc >= 5 ? atof(argv[4]) : 3;
+    const char *ip = argc >= 6 ? argv[5] : "127.0.0.1";
+    if (port <= 0 || connections <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s port path [connections] [seconds] [ip]\n", argv[0]);
+        return 1;
+    }
+
+    char request[1024];
+    int request_length = snprintf(request, sizeof request, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", path, ip);
+    int epoll_fd = epoll_create1(0);
+    std::vector<Client> clients(connections);
+    for (int i = 0; i < connections; ++i) {
+        clients[i].fd = connect_to(ip, port);
+        clients[i].remain = -1;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &event);
+        write(clients[i].fd, request, request_length);
+    }
+
+    auto *buffer = new char[READ_SIZE];
+    epoll_event events[256];
+    long requests = 0, bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < seconds) {
+        int number = epoll_wait(epoll_fd, events, 256, 100);
+        for (int i = 0; i < number; ++i) {
+            Client &client = clients[events[i].data.u32];
+            long length;
+            while ((length = read(client.fd, buffer, READ_SIZE)) > 0) {
+                bytes += length;
+                long body = length;
+                if (client.remain < 0 && !parse_head(client, buffer, length, body))
+                    continue;
+                client.remain -= body;
+                if (client.remain == 0) {
+                    ++requests;
+                    client.remain = -1;
+                    write(client.fd, request, request_length);
+                }
+            }
+            if (length == 0) {
+                fprintf(stderr, "connection closed by server\n");
+                return 1;
+            }
+        }
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    printf("%s connections=%d requests/s=%.0f MB/s=%.1f\n", path, connections, (double) requests / elapsed,
+           (double) bytes / elapsed / 1e6);
+    for (Client &client : clients)
+        close(client.fd);
+    close(epoll_fd);
+    delete[] buffer;
+    return 0;
+}
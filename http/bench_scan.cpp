@@ -0,0 +1,181 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/29 16:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "http_scan.h"
+
+/**
+ * 请求报文扫描的校验与性能测试
+ * 先用随机数据校验 CPU 支持的每个实现与逐字节查找的结果一致，数据紧贴不可访问的内存页，越界读取会直接崩溃；
+ * 再用浏览器与 curl 的请求头，按 parse_line 的方式逐行扫描，比较每个实现解析一个请求的开销
+ * 用法：bench_scan [check]，带 check 时只做校验，校验失败返回 1
+ */
+
+static const char *const IMPLEMENTATIONS[] = {"avx2", "sse4.2", "scalar"};
+
+static const char BROWSER_REQUEST[] =
+        "GET /static/js/app.3f9c2a1b.js HTTP/1.1\r\n"
+        "Host: www.expoli.tech\r\n"
+        "Connection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"112\", \"Google Chrome\";v=\"112\", \"Not:A-Brand\";v=\"99\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) "
+        "Chrome/112.0.0.0 Safari/537.36\r\n"
+        "sec-ch-ua-platform: \"Windows\"\r\n"
+        "Accept: */*\r\n"
+        "Sec-Fetch-Site: same-origin\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Dest: script\r\n"
+        "Referer: https://www.expoli.tech/index.html\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+        "If-None-Match: \"6442d1f0-1a2b3\"\r\n"
+        "If-Modified-Since: Fri, 21 Apr 2023 18:20:00 GMT\r\n"
+        "\r\n";
+
+static const char CURL_REQUEST[] =
+        "GET /index.html HTTP/1.1\r\n"
+        "Host: localhost:9006\r\n"
+        "User-Agent: curl/7.88.1\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
+
+/**
+ * 作为对照的逐字节查找
+ */
+static const char *reference(const char *begin, const char *end, char delim1, char delim2) {
+    while (begin < end && *begin != '\r' && *begin != '\n' && *begin != delim1 && *begin != delim2)
+        ++begin;
+    return begin;
+}
+
+/**
+ * 随机长度与起始位置，数据末尾对齐到不可访问的内存页，分隔符稀疏分布，同时包含大于 0x7f 的字节
+ * @return 不一致的次数
+ */
+static long check(HttpScanner::FIND_FUNC find, long rounds) {
+    static const char DELIMS[][2] = {{' ', '\t'}, {':', ':'}, {'\r', '\r'}};
+    long page = sysconf(_SC_PAGESIZE);
+    auto *area = (char *) mmap(nullptr, page * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (area == MAP_FAILED || mprotect(area + page, page, PROT_NONE) != 0) {
+        perror("mmap");
+        exit(1);
+    }
+    char *limit = area + page;
+    long errors = 0;
+    srand(1);
+    for (long i = 0; i < rounds; ++i) {
+        int length = rand() % 300;
+        char *begin = limit - length;
+        for (int j = 0; j < length; ++j) {
+            int r = rand();
+            if (r % 64 == 0)
+                begin[j] = "\r\n \t:"[r / 64 % 5];
+            else
+                begin[j] = (char) (r / 64 % 256);
+        }
+        const char *delims = DELIMS[i % 3];
+        // 从中间开始扫描，覆盖不同的对齐
+        const char *start = begin + (length ? rand() % (length + 1) : 0);
+        if (find(start, limit, delims[0], delims[1]) != reference(start, limit, delims[0], delims[1]))
+            ++errors;
+    }
+    munmap(area, page * 2);
+    return errors;
+}
+
+/**
+ * 与 parse_line 相同的扫描方式：请求行先找空格或 \t，请求头先找冒号，找到字段分隔符之后只找行尾
+ * @return 扫描到的行数，空行结束
+ */
+static int scan_request(HttpScanner::FIND_FUNC find, const char *begin, const char *end) {
+    int lines = 0;
+    char delim1 = ' ', delim2 = '\t';
+    const char *line = begin;
+    while (begin < end) {
+        const char *hit = find(begin, end, delim1, delim2);
+        if (hit == end)
+            break;
+        if (*hit == '\r' || *hit == '\n') {
+            bool empty = hit == line;
+            ++lines;
+            begin = line = hit + 2;
+            delim1 = delim2 = ':';
+            if (empty)
+                break;
+            continue;
+        }
+        delim1 = delim2 = '\r';
+        begin = hit + 1;
+    }
+    return lines;
+}
+
+/**
+ * @return 解析一个请求的纳秒数
+ */
+static double bench(HttpScanner::FIND_FUNC find, const char *request, size_t length, int expected) {
+    const long rounds = 500000;
+    int lines = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < rounds; ++i) {
+        lines = scan_request(find, request, request + length);
+        // 防止编译器把循环优化掉
+        __asm__ __volatile__("" : : "r"(lines) : "memory");
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (lines != expected) {
+        fprintf(stderr, "scanned %d lines, expected %d\n", lines, expected);
+        exit(1);
+    }
+    return seconds * 1e9 / (double) rounds;
+}
+
+static int count_lines(const char *request) {
+    int lines = 0;
+    for (; *request; ++request)
+        lines += *request == '\n';
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    bool check_only = argc >= 2 && strcmp(argv[1], "check") == 0;
+    printf("dispatch: %s\n", HttpScanner::name());
+    int failed = 0;
+    for (const char *name : IMPLEMENTATIONS) {
+        HttpScanner::FIND_FUNC find = HttpScanner::get(name);
+        if (!find) {
+            printf("%-7s not supported\n", name);
+            continue;
+        }
+        long errors = check(find, 1000000);
+        if (errors)
+            ++failed;
+        printf("%-7s check %s (%ld mismatches)\n", name, errors ? "FAILED" : "ok", errors);
+    }
+    if (failed || check_only)
+        return failed ? 1 : 0;
+
+    for (const char *name : IMPLEMENTATIONS) {
+        HttpScanner::FIND_FUNC find = HttpScanner::get(name);
+        if (!find)
+            continue;
+        double browser = bench(find, BROWSER_REQUEST, sizeof(BROWSER_REQUEST) - 1, count_lines(BROWSER_REQUEST));
+        double curl = bench(find, CURL_REQUEST, sizeof(CURL_REQUEST) - 1, count_lines(CURL_REQUEST));
+        printf("%-7s browser %zu B %8.1f ns/req   curl %zu B %8.1f ns/req\n", name, sizeof(BROWSER_REQUEST) - 1,
+               browser, sizeof(CURL_REQUEST) - 1, curl);
+    }
+    return 0;
+}
@@ -0,0 +1,77 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/21 10:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstdlib>
+#include "buffer_pool.h"
+
+BufferPool::BufferPool() = default;
+
+/**
+ * 释放所有缓存的空闲缓冲区
+ */
+BufferPool::~BufferPool() {
+    for (FreeList &list : m_classes) {
+        while (list.head) {
+            FreeNode *node = list.head;
+            list.head = node->next;
+            free(node);
+        }
+    }
+}
+
+/**
+ * 找到能放下 size 字节的最小级别
+ * @return 级别下标，超过最大一级时返回 -1
+ */
+int BufferPool::class_of(int size) {
+    int capacity = BUFFER_CHUNK_SIZE;
+    for (int i = 0; i < CLASS_NUMBER; ++i, capacity <<= 1) {
+        if (size <= capacity)
+            return i;
+    }
+    return -1;
+}
+
+char *BufferPool::acquire(int size, int &capacity) {
+    int index = class_of(size);
+    if (index < 0)
+        return nullptr;
+    capacity = BUFFER_CHUNK_SIZE << index;
+
+    FreeList &list = m_classes[index];
+    list.locker.lock();
+    FreeNode *node = list.head;
+    if (node) {
+        list.head = node->next;
+        --list.count;
+    }
+    list.locker.unlock();
+    if (node)
+        return (char *) node;
+    return (char *) malloc(capacity);
+}
+
+void BufferPool::release(char *buffer, int capacity) {
+    if (!buffer)
+        return;
+    int index = class_of(capacity);
+    FreeList &list = m_classes[index];
+    auto *node = (FreeNode *) buffer;
+    list.locker.lock();
+    if (list.count < BUFFER_POOL_CACHE) {
+        node->next = list.head;
+        list.head = node;
+        ++list.count;
+        node = nullptr;
+    }
+    list.locker.unlock();
+    // 这一级缓存已满，还给系统
+    free(node);
+}
@@ -0,0 +1,71 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/21 10:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_BUFFER_POOL_H
+#define MYTINYWEBSERVER_BUFFER_POOL_H
+
+#include "../lock/Locker.h"
+#include "../config/config.h"
+
+/**
+ * 按大小分级的缓冲区池，进程内共享
+ * 最小一级为 BUFFER_CHUNK_SIZE，每一级大小翻倍，最大一级不小于 READ_BUFFER_MAX。
+ * 连接只在有数据收发时才持有缓冲区，空闲的长连接不占用内存；
+ * 归还的缓冲区挂在对应级别的空闲链表上，每级最多缓存 BUFFER_POOL_CACHE 个，多余的直接释放。
+ *
+ * 事件循环与工作线程都会申请与归还，每一级一把锁，临界区只有一次链表操作。
+ */
+class BufferPool {
+public:
+    static const int CLASS_NUMBER = 8;
+
+public:
+    static BufferPool *get_instance() {
+        static BufferPool instance;
+        return &instance;
+    }
+
+    /**
+     * 申请不小于 size 的缓冲区
+     * @param size 需要的大小
+     * @param capacity 实际得到的大小
+     * @return 缓冲区，size 超过最大一级时返回 nullptr
+     */
+    char *acquire(int size, int &capacity);
+
+    // 归还缓冲区，capacity 为申请时得到的大小
+    void release(char *buffer, int capacity);
+
+private:
+    BufferPool();
+
+    ~BufferPool();
+
+    static int class_of(int size);
+
+private:
+    // 空闲链表的节点就放在空闲缓冲区的开头
+    struct FreeNode {
+        FreeNode *next;
+    };
+
+    struct FreeList {
+        Locker locker;
+        FreeNode *head = nullptr;
+        int count = 0;
+    };
+
+    FreeList m_classes[CLASS_NUMBER];
+};
+
+static_assert((BUFFER_CHUNK_SIZE << (BufferPool::CLASS_NUMBER - 1)) >= READ_BUFFER_MAX,
+              "READ_BUFFER_MAX exceeds the largest buffer class");
+
+#endif //MYTINYWEBSERVER_BUFFER_POOL_H
@@ -0,0 +1,230 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/25 10:15
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <pthread.h>
+#include <cstring>
+#include <strings.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#include "compressor.h"
+#include "file_cache.h"
+#include "../config/config.h"
+#include "../log/log.h"
+
+const char *encoding_name(int encoding) {
+    switch (encoding) {
+        case ENCODING_GZIP:
+            return "gzip";
+        case ENCODING_BR:
+            return "br";
+        default:
+            return "identity";
+    }
+}
+
+const char *encoding_suffix(int encoding) {
+    switch (encoding) {
+        case ENCODING_GZIP:
+            return ".gz";
+        case ENCODING_BR:
+            return ".br";
+        default:
+            return "";
+    }
+}
+
+/**
+ * 解析 q 值，返回千分之几，"0.5" 为 500
+ */
+static int parse_quality(const char *p) {
+    int q = (*p == '1') ? 1000 : 0;
+    if (*p == '0' || *p == '1')
+        ++p;
+    if (*p != '.')
+        return q;
+    ++p;
+    for (int scale = 100; scale > 0 && *p >= '0' && *p <= '9'; scale /= 10, ++p)
+        q += (*p - '0') * scale;
+    return q > 1000 ? 1000 : q;
+}
+
+int parse_accept_encoding(const char *value, int order[ENCODING_NUMBER]) {
+    if (!value)
+        return 0;
+    // -1 表示没有出现
+    int quality[ENCODING_NUMBER] = {-1, -1, -1};
+    int wildcard = -1;
+    const char *p = value;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            ++p;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            ++p;
+        size_t len = p - name;
+        // 参数中只关心 q
+        int q = 1000;
+        while (*p && *p != ',') {
+            if (*p++ != ';')
+                continue;
+            while (*p == ' ' || *p == '\t')
+                ++p;
+            if ((*p == 'q' || *p == 'Q') && p[1] == '=')
+                q = parse_quality(p + 2);
+        }
+        if ((len == 4 && strncasecmp(name, "gzip", 4) == 0) || (len == 6 && strncasecmp(name, "x-gzip", 6) == 0))
+            quality[ENCODING_GZIP] = q;
+        else if (len == 2 && strncasecmp(name, "br", 2) == 0)
+            quality[ENCODING_BR] = q;
+        else if (len == 1 && *name == '*')
+            wildcard = q;
+    }
+
+    int count = 0;
+#ifdef HAVE_BROTLI
+    const int supported[] = {ENCODING_BR, ENCODING_GZIP};
+#else
+    const int supported[] = {ENCODING_GZIP};
+#endif
+    int order_quality[ENCODING_NUMBER];
+    for (int encoding : supported) {
+        int q = quality[encoding] >= 0 ? quality[encoding] : (wildcard >= 0 ? wildcard : 0);
+        if (q <= 0)
+            continue;
+        // 插入排序，q 值相同时保持 supported 中的顺序
+        int i = count++;
+        while (i > 0 && order_quality[i - 1] < q) {
+            order[i] = order[i - 1];
+            order_quality[i] = order_quality[i - 1];
+            --i;
+        }
+        order[i] = encoding;
+        order_quality[i] = q;
+    }
+    return count;
+}
+
+Compressor::Compressor() : m_queue(nullptr), m_memory(0) {
+}
+
+bool Compressor::init() {
+    m_queue = new BlockQueue<Job>(COMPRESS_QUEUE_SIZE);
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, worker, this) != 0) {
+        delete m_queue;
+        m_queue = nullptr;
+        return false;
+    }
+    pthread_detach(tid);
+    return true;
+}
+
+void Compressor::schedule(CachedFile *file, int encoding) {
+    if (!m_queue)
+        return;
+    int expected = ENCODE_NONE;
+    if (!file->encode_state[encoding].compare_exchange_strong(expected, ENCODE_PENDING))
+        return;
+    // 后台线程持有一个引用，压缩完成之前条目不会被销毁
+    FileCache::retain(file);
+    if (!m_queue->push({file, encoding})) {
+        file->encode_state[encoding].store(ENCODE_NONE, std::memory_order_relaxed);
+        FileCache::get_instance()->release(file);
+    }
+}
+
+void Compressor::forget(long size) {
+    m_memory.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void *Compressor::worker(void *arg) {
+    ((Compressor *) arg)->run();
+    return nullptr;
+}
+
+void Compressor::run() {
+    Job job{};
+    while (m_queue->pop(job)) {
+        CachedFile *file = job.file;
+        long size = file->file_stat.st_size;
+        int state = ENCODE_SKIP;
+
+        /**
+         * 文件内容用 pread 读入临时缓冲区再压缩，不直接压缩映射：文件被同时截断时读取失败，而不是 SIGBUS
+         */
+        char *data = new char[size];
+        char *out = nullptr;
+        long length = FileCache::read_content(file, data, size) ? compress(job.encoding, data, size, out) : -1;
+        delete[] data;
+        // 至少变小十分之一才值得压缩，并且不超出内存上限
+        if (length > 0 && length < size - size / 10) {
+            if (m_memory.fetch_add(length, std::memory_order_relaxed) + length <= COMPRESS_MEMORY) {
+                file->encoded[job.encoding].data = out;
+                file->encoded[job.encoding].length = length;
+                out = nullptr;
+                state = ENCODE_READY;
+            } else {
+                m_memory.fetch_sub(length, std::memory_order_relaxed);
+            }
+        }
+        delete[] out;
+        LOG_DEBUG("compress %s %s: %ld -> %ld", file->path.c_str(), encoding_name(job.encoding), size, length);
+        // 发布压缩结果，读取者看到 ENCODE_READY 时一定能看到上面写入的内容
+        file->encode_state[job.encoding].store(state, std::memory_order_release);
+        FileCache::get_instance()->release(file);
+    }
+}
+
+/**
+ * 压缩一段内容
+ * @param out 压缩结果，调用者负责 delete[]
+ * @return 压缩后的长度，失败返回 -1
+ */
+long Compressor::compress(int encoding, const char *data, long size, char *&out) {
+    char *buffer = nullptr;
+    long length = -1;
+    if (encoding == ENCODING_GZIP) {
+        z_stream stream{};
+        // windowBits 加 16 输出 gzip 格式
+        if (deflateInit2(&stream, COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return -1;
+        uLong bound = deflateBound(&stream, size);
+        buffer = new char[bound];
+        stream.next_in = (Bytef *) data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef *) buffer;
+        stream.avail_out = bound;
+        if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+            length = (long) stream.total_out;
+        deflateEnd(&stream);
+    }
+#ifdef HAVE_BROTLI
+    else if (encoding == ENCODING_BR) {
+        size_t bound = BrotliEncoderMaxCompressedSize(size);
+        if (bound == 0)
+            return -1;
+        buffer = new char[bound];
+        if (BrotliEncoderCompress(COMPRESS_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, size,
+                                  (const uint8_t *) data, &bound, (uint8_t *) buffer))
+            length = (long) bound;
+    }
+#endif
+    if (length < 0) {
+        delete[] buffer;
+        return -1;
+    }
+    // 按上界申请的缓冲区通常大得多，拷贝到刚好大小的内存中长期保存
+    out = new char[length];
+    memcpy(out, buffer, length);
+    delete[] buffer;
+    return length;
+}
@@ -0,0 +1,100 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/25 10:15
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_COMPRESSOR_H
+#define MYTINYWEBSERVER_COMPRESSOR_H
+
+#include <atomic>
+#include "../log/block_queue.h"
+
+struct CachedFile;
+
+/**
+ * 内容编码，IDENTITY 表示不压缩
+ */
+enum CONTENT_ENCODING {
+    ENCODING_IDENTITY = 0,
+    ENCODING_GZIP,
+    ENCODING_BR,
+    ENCODING_NUMBER
+};
+
+/**
+ * 文件某种编码版本的状态，保存在打开文件缓存的条目中
+ */
+enum ENCODE_STATE {
+    ENCODE_NONE = 0,        // 还没有压缩
+    ENCODE_PENDING,         // 已经交给后台线程
+    ENCODE_READY,           // 压缩完成，内容可以读取
+    ENCODE_SKIP             // 压缩失败、压缩后没有明显变小或者超出内存上限，不再尝试
+};
+
+// 编码在 Content-Encoding 中的名字与 sidecar 文件的后缀
+const char *encoding_name(int encoding);
+
+const char *encoding_suffix(int encoding);
+
+/**
+ * 解析 Accept-Encoding，得到客户端接受并且支持的编码
+ * @param value 请求头的值，为 nullptr 时表示没有这个请求头
+ * @param order 按客户端的偏好（q 值）从高到低排列的编码，q 值相同时 br 优先
+ * @return 编码个数
+ */
+int parse_accept_encoding(const char *value, int order[ENCODING_NUMBER]);
+
+/**
+ * 后台压缩线程
+ * 没有预先压缩的 sidecar 文件（.br/.gz）时，可压缩类型的文件第一次被接受压缩的客户端请求后
+ * 交给后台线程压缩一次，结果保存在打开文件缓存的条目中。条目是文件在某个时刻的快照，
+ * 文件变化后 inotify 使其失效，新条目重新压缩，所以压缩结果总是对应文件当前的内容。
+ * 压缩完成之前的请求继续用不压缩的零拷贝路径发送。
+ */
+class Compressor {
+public:
+    static Compressor *get_instance() {
+        static Compressor instance;
+        return &instance;
+    }
+
+    // 创建后台压缩线程
+    bool init();
+
+    /**
+     * 把文件交给后台线程压缩，同一个文件的同一种编码只会压缩一次
+     * @param file 打开文件缓存中的文件，不在缓存中的文件没有必要压缩
+     * @param encoding 编码
+     */
+    void schedule(CachedFile *file, int encoding);
+
+    // 释放压缩结果占用的内存，由打开文件缓存在销毁条目时调用
+    void forget(long size);
+
+private:
+    Compressor();
+
+    ~Compressor() = default;
+
+    static void *worker(void *arg);
+
+    void run();
+
+    static long compress(int encoding, const char *data, long size, char *&out);
+
+private:
+    struct Job {
+        CachedFile *file;
+        int encoding;
+    };
+
+    BlockQueue<Job> *m_queue;
+    std::atomic<long> m_memory;     // 压缩结果占用的内存
+};
+
+#endif //MYTINYWEBSERVER_COMPRESSOR_H
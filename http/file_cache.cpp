@@ -0,0 +1,452 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/23 16:10
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "file_cache.h"
+#include "response_cache.h"
+#include "../log/log.h"
+
+FileCache::FileCache() : m_enabled(false), m_inotify_fd(-1) {
+    // 失效时会通知响应缓存，先构造它，保证它在本对象之后析构
+    ResponseCache::get_instance();
+    for (Shard &shard : m_shards)
+        shard.buckets = new CachedFile *[BUCKET_NUMBER]();
+}
+
+FileCache::~FileCache() {
+    invalidate_all();
+    for (Shard &shard : m_shards)
+        delete[] shard.buckets;
+}
+
+bool FileCache::init(const char *root) {
+    m_inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (m_inotify_fd == -1)
+        return false;
+    add_watch(root);
+    if (m_watches.empty())
+        return false;
+
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, watch_thread, this) != 0)
+        return false;
+    pthread_detach(tid);
+    m_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+/**
+ * 监视目录及其所有子目录，inotify 本身不递归
+ * @param dir 目录路径
+ */
+void FileCache::add_watch(const std::string &dir) {
+    int wd = inotify_add_watch(m_inotify_fd, dir.c_str(),
+                               IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                               IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+    if (wd == -1) {
+        LOG_WARN("inotify watch %s failed, errno is:%d", dir.c_str(), errno);
+        return;
+    }
+    m_watches[wd] = dir;
+
+    DIR *handle = opendir(dir.c_str());
+    if (!handle)
+        return;
+    while (dirent *entry = readdir(handle)) {
+        if (entry->d_type != DT_DIR || strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        add_watch(dir + "/" + entry->d_name);
+    }
+    closedir(handle);
+}
+
+void *FileCache::watch_thread(void *arg) {
+    ((FileCache *) arg)->watch();
+    return nullptr;
+}
+
+/**
+ * 后台线程，阻塞读取 inotify 事件并使对应的条目失效
+ */
+void FileCache::watch() {
+    alignas(inotify_event) char buffer[4096];
+    while (true) {
+        long len = read(m_inotify_fd, buffer, sizeof buffer);
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR)
+                continue;
+            LOG_ERROR("inotify read failed, errno is:%d", errno);
+            // 不能再得到文件变化的通知，停止缓存
+            m_enabled.store(false, std::memory_order_release);
+            invalidate_all();
+            return;
+        }
+        for (char *p = buffer; p < buffer + len;) {
+            auto *event = (inotify_event *) p;
+            p += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                invalidate_all();
+                continue;
+            }
+            auto it = m_watches.find(event->wd);
+            if (it == m_watches.end())
+                continue;
+            if (event->mask & IN_IGNORED) {
+                m_watches.erase(it);
+                continue;
+            }
+            /**
+             * 目录本身或者其中的子目录被删除、移动，影响的路径太多，全部失效
+             */
+            if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) ||
+                ((event->mask & IN_ISDIR) && (event->mask & (IN_DELETE | IN_MOVED_FROM)))) {
+                invalidate_all();
+                continue;
+            }
+            if (event->len == 0)
+                continue;
+            std::string path = it->second + "/" + event->name;
+            /**
+             * 新建或者移入的子目录也需要监视，子目录中的路径之前可能被缓存为不存在，全部失效
+             */
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                add_watch(path);
+                invalidate_all();
+                continue;
+            }
+            invalidate(path.c_str());
+        }
+    }
+}
+
+/**
+ * FNV-1a 哈希
+ */
+unsigned FileCache::hash_of(const char *path) {
+    unsigned hash = 2166136261u;
+    for (const char *p = path; *p; ++p) {
+        hash ^= (unsigned char) *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * 只缓存规范的路径：没有 // 也没有以 . 开头的路径段
+ * 否则同一个文件会有多个键，inotify 给出的路径只能使其中一个失效
+ */
+bool FileCache::canonical(const char *path) {
+    for (const char *p = strchr(path, '/'); p; p = strchr(p + 1, '/')) {
+        if (p[1] == '/' || p[1] == '.' || p[1] == '\0')
+            return false;
+    }
+    return true;
+}
+
+CachedFile *FileCache::new_file(const char *path) {
+    auto *file = new CachedFile();
+    file->path = path;
+    file->error = 0;
+    file->mime = mime_of(path);
+    file->etag[0] = '\0';
+    file->last_modified[0] = '\0';
+    file->fd = -1;
+    file->address = nullptr;
+    for (int i = 0; i < ENCODING_NUMBER; ++i) {
+        file->encode_state[i].store(ENCODE_NONE, std::memory_order_relaxed);
+        file->encoded[i].data = nullptr;
+        file->encoded[i].length = 0;
+    }
+    file->refs.store(1, std::memory_order_relaxed);
+    file->cached = false;
+    file->hash = 0;
+    file->hash_next = file->lru_prev = file->lru_next = nullptr;
+    return file;
+}
+
+/**
+ * 打开文件，只接受其他人可读的普通文件
+ * 小于 SENDFILE_THRESHOLD 的文件建立映射后关闭描述符，更大的文件保留描述符
+ * @return 成功返回 0，否则返回 errno
+ */
+int FileCache::open_file(const char *path, CachedFile *&file) {
+    struct stat file_stat{};
+    if (stat(path, &file_stat) < 0)
+        return errno == ENOTDIR ? ENOENT : errno;
+    if (!(file_stat.st_mode & S_IROTH))
+        return EACCES;
+    if (!S_ISREG(file_stat.st_mode))
+        return EISDIR;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno;
+    char *address = nullptr;
+    if (file_stat.st_size < SENDFILE_THRESHOLD) {
+        // 空文件不需要映射
+        if (file_stat.st_size > 0) {
+            address = (char *) mmap(nullptr, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED) {
+                int err = errno;
+                close(fd);
+                return err;
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+
+    file = new_file(path);
+    file->file_stat = file_stat;
+    file->fd = fd;
+    file->address = address;
+    // 条件请求使用的验证器，文件变化后条目失效重新打开，所以每个快照只需要生成一次
+    unsigned long long mtime_ns = file_stat.st_mtim.tv_sec * 1000000000ULL + file_stat.st_mtim.tv_nsec;
+    snprintf(file->etag, sizeof file->etag, "%lx-%lx-%llx", (unsigned long) file_stat.st_ino,
+             (unsigned long) file_stat.st_size, mtime_ns);
+    CoarseClock::format_http_date(file_stat.st_mtime, file->last_modified);
+    return 0;
+}
+
+bool FileCache::read_content(const CachedFile *file, char *buffer, long length) {
+    int fd = file->fd;
+    if (fd == -1) {
+        fd = open(file->path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        struct stat file_stat{};
+        if (fstat(fd, &file_stat) < 0 || file_stat.st_ino != file->file_stat.st_ino ||
+            file_stat.st_size != file->file_stat.st_size ||
+            file_stat.st_mtim.tv_sec != file->file_stat.st_mtim.tv_sec ||
+            file_stat.st_mtim.tv_nsec != file->file_stat.st_mtim.tv_nsec) {
+            close(fd);
+            return false;
+        }
+    }
+    long have = 0;
+    while (have < length) {
+        long n = pread(fd, buffer + have, length - have, have);
+        if (n < 0 && errno == EINTR)
+            continue;
+        // 读取失败或者文件在打开之后被截断
+        if (n <= 0)
+            break;
+        have += n;
+    }
+    if (fd != file->fd)
+        close(fd);
+    return have == length;
+}
+
+void FileCache::destroy(CachedFile *file) {
+    if (file->address)
+        munmap(file->address, file->file_stat.st_size);
+    if (file->fd != -1)
+        close(file->fd);
+    for (int i = 0; i < ENCODING_NUMBER; ++i) {
+        if (file->encoded[i].data) {
+            delete[] file->encoded[i].data;
+            Compressor::get_instance()->forget(file->encoded[i].length);
+        }
+    }
+    delete file;
+}
+
+int FileCache::acquire(const char *path, CachedFile *&file) {
+    file = nullptr;
+    if (!m_enabled.load(std::memory_order_acquire) || !canonical(path))
+        return open_file(path, file);
+
+    unsigned hash = hash_of(path);
+    Shard &shard = m_shards[hash % FILE_CACHE_SHARDS];
+    unsigned bucket = (hash / FILE_CACHE_SHARDS) % BUCKET_NUMBER;
+
+    /**
+     * 命中：增加引用并移动到 LRU 表头，缓存的错误直接返回
+     */
+    shard.locker.lock();
+    for (CachedFile *p = shard.buckets[bucket]; p; p = p->hash_next) {
+        if (p->hash == hash && p->path == path) {
+            if (!p->error)
+                p->refs.fetch_add(1, std::memory_order_relaxed);
+            if (p != shard.lru_head) {
+                p->lru_prev->lru_next = p->lru_next;
+                if (p->lru_next)
+                    p->lru_next->lru_prev = p->lru_prev;
+                else
+                    shard.lru_tail = p->lru_prev;
+                p->lru_prev = nullptr;
+                p->lru_next = shard.lru_head;
+                shard.lru_head->lru_prev = p;
+                shard.lru_head = p;
+            }
+            shard.locker.unlock();
+            if (p->error)
+                return p->error;
+            file = p;
+            return 0;
+        }
+    }
+    unsigned generation = shard.generation;
+    shard.locker.unlock();
+
+    /**
+     * 没有命中：在锁外打开文件，再插入缓存
+     * 不存在、没有权限与不是普通文件的结果也缓存，文件出现或者权限变化时 inotify 同样会通知失效，
+     * 这样查找不存在的文件（比如没有预先压缩的 sidecar 文件）也不需要文件系统调用
+     * 期间其它线程可能已经插入了同一个文件，这时使用已经在缓存中的那个；
+     * 期间分片有过失效时，打开的可能是变化之前的文件，通知已经错过，这次只给调用者使用，不插入
+     */
+    int ret = open_file(path, file);
+    if (ret != 0) {
+        if (ret != ENOENT && ret != EACCES && ret != EISDIR)
+            return ret;
+        file = new_file(path);
+        file->error = ret;
+    }
+    file->hash = hash;
+    file->cached = true;
+    // 缓存本身持有一个引用，错误条目不交给调用者
+    file->refs.store(file->error ? 1 : 2, std::memory_order_relaxed);
+
+    CachedFile *victim = nullptr;
+    CachedFile *existing = nullptr;
+    shard.locker.lock();
+    for (CachedFile *p = shard.buckets[bucket]; p; p = p->hash_next) {
+        if (p->hash == hash && p->path == path) {
+            if (!p->error)
+                p->refs.fetch_add(1, std::memory_order_relaxed);
+            existing = p;
+            break;
+        }
+    }
+    bool stale = !existing && shard.generation != generation;
+    if (!existing && !stale) {
+        if (shard.count >= SHARD_CAPACITY) {
+            victim = shard.lru_tail;
+            unlink(shard, victim);
+            victim->cached = false;
+        }
+        file->hash_next = shard.buckets[bucket];
+        shard.buckets[bucket] = file;
+        file->lru_prev = nullptr;
+        file->lru_next = shard.lru_head;
+        if (shard.lru_head)
+            shard.lru_head->lru_prev = file;
+        shard.lru_head = file;
+        if (!shard.lru_tail)
+            shard.lru_tail = file;
+        ++shard.count;
+    }
+    shard.locker.unlock();
+
+    if (existing) {
+        destroy(file);
+        file = existing;
+    } else if (stale) {
+        file->cached = false;
+        if (file->error) {
+            destroy(file);
+            file = nullptr;
+            return ret;
+        }
+        file->refs.store(1, std::memory_order_relaxed);
+        return 0;
+    }
+    // 被淘汰的条目没有正在发送的响应时直接关闭
+    if (victim)
+        release(victim);
+    if (file->error) {
+        ret = file->error;
+        file = nullptr;
+        return ret;
+    }
+    return 0;
+}
+
+void FileCache::release(CachedFile *file) {
+    if (file && file->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy(file);
+}
+
+void FileCache::unlink(Shard &shard, CachedFile *file) {
+    unsigned bucket = (file->hash / FILE_CACHE_SHARDS) % BUCKET_NUMBER;
+    CachedFile **p = &shard.buckets[bucket];
+    while (*p != file)
+        p = &(*p)->hash_next;
+    *p = file->hash_next;
+    file->hash_next = nullptr;
+
+    if (file->lru_prev)
+        file->lru_prev->lru_next = file->lru_next;
+    else
+        shard.lru_head = file->lru_next;
+    if (file->lru_next)
+        file->lru_next->lru_prev = file->lru_prev;
+    else
+        shard.lru_tail = file->lru_prev;
+    file->lru_prev = file->lru_next = nullptr;
+    --shard.count;
+}
+
+void FileCache::invalidate(const char *path) {
+    unsigned hash = hash_of(path);
+    Shard &shard = m_shards[hash % FILE_CACHE_SHARDS];
+    unsigned bucket = (hash / FILE_CACHE_SHARDS) % BUCKET_NUMBER;
+
+    CachedFile *file = nullptr;
+    shard.locker.lock();
+    ++shard.generation;
+    for (CachedFile *p = shard.buckets[bucket]; p; p = p->hash_next) {
+        if (p->hash == hash && p->path == path) {
+            unlink(shard, p);
+            p->cached = false;
+            file = p;
+            break;
+        }
+    }
+    shard.locker.unlock();
+    if (file) {
+        LOG_DEBUG("file cache invalidate %s", path);
+        release(file);
+    }
+    // 响应缓存中的条目可能比打开文件缓存中的活得更久，不论上面有没有找到都要使其失效
+    ResponseCache::get_instance()->invalidate(path);
+}
+
+void FileCache::invalidate_all() {
+    for (Shard &shard : m_shards) {
+        shard.locker.lock();
+        ++shard.generation;
+        CachedFile *list = shard.lru_head;
+        for (int i = 0; i < BUCKET_NUMBER; ++i)
+            shard.buckets[i] = nullptr;
+        shard.lru_head = shard.lru_tail = nullptr;
+        shard.count = 0;
+        shard.locker.unlock();
+        while (list) {
+            CachedFile *next = list->lru_next;
+            list->cached = false;
+            list->hash_next = list->lru_prev = list->lru_next = nullptr;
+            release(list);
+            list = next;
+        }
+    }
+    ResponseCache::get_instance()->invalidate_all();
+}
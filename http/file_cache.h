@@ -0,0 +1,148 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/23 16:10
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_FILE_CACHE_H
+#define MYTINYWEBSERVER_FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include "mime.h"
+#include "compressor.h"
+#include "../lock/Locker.h"
+#include "../config/config.h"
+#include "../timer/coarse_clock.h"
+
+/**
+ * 缓存中的一个文件
+ * 小文件保存只读映射，直接作为 iovec 发送；大文件保存描述符，用 sendfile 发送。
+ * sendfile 使用自己的偏移，不改变描述符的文件位置，所以多个连接可以同时发送同一个文件。
+ * 文件不存在、没有权限等结果同样缓存，这样的条目只有 error，不交给调用者。
+ */
+struct CachedFile {
+    std::string path;           // 缓存的键，即 www 根目录下的文件路径
+    int error;                  // 打开文件失败时的 errno，成功为 0
+    struct stat file_stat;      // 打开文件时的状态
+    const MimeType *mime;       // 由扩展名决定的文件类型
+    char etag[64];              // 由 inode、大小与修改时间生成的实体标签，不含引号
+    char last_modified[32];     // 修改时间，HTTP 日期格式
+    int fd;                     // 大文件的描述符，小文件为 -1
+    char *address;              // 小文件的映射，大文件为 nullptr
+    std::atomic<int> encode_state[ENCODING_NUMBER];     // 各种编码的压缩状态，ENCODE_STATE
+    struct {
+        char *data;
+        long length;
+    } encoded[ENCODING_NUMBER];     // 后台压缩的结果，encode_state 为 ENCODE_READY 之后只读
+    std::atomic<int> refs;      // 引用计数，缓存本身持有一个，每个正在发送的响应各持有一个
+    std::atomic<bool> cached;   // 是否还在缓存中，被淘汰或者失效之后为 false
+    unsigned hash;
+    CachedFile *hash_next;      // 哈希桶链表
+    CachedFile *lru_prev;       // LRU 链表，表头是最近使用的
+    CachedFile *lru_next;
+};
+
+/**
+ * 打开文件与文件状态的缓存，进程内共享
+ * 按路径哈希分成 FILE_CACHE_SHARDS 个分片，每个分片一把锁、一张哈希表与一条 LRU 链表，
+ * 总条目数超过 FILE_CACHE_NUMBER 时淘汰分片中最久没有使用的文件。
+ * 条目带引用计数，被淘汰或者失效时正在发送的响应仍然持有它，最后一个引用释放时才关闭与取消映射。
+ *
+ * inotify 监视 www 根目录及其子目录，文件被修改、删除或者移动时后台线程使对应的条目失效。
+ * 命中缓存时不需要任何文件系统调用；inotify 不可用时不缓存，每次请求都重新打开文件。
+ */
+class FileCache {
+public:
+    static FileCache *get_instance() {
+        static FileCache instance;
+        return &instance;
+    }
+
+    /**
+     * 监视 www 根目录，并创建处理 inotify 事件的后台线程
+     * @param root www 根目录
+     * @return inotify 不可用时返回 false，此时缓存不启用
+     */
+    bool init(const char *root);
+
+    /**
+     * 取得文件，调用者持有一个引用，用完之后调用 release
+     * @param path 文件路径
+     * @param file 得到的文件
+     * @return 成功返回 0，否则返回 errno：ENOENT 文件不存在，EACCES 没有读取权限，EISDIR 不是普通文件
+     */
+    int acquire(const char *path, CachedFile *&file);
+
+    void release(CachedFile *file);
+
+    // 增加一个引用
+    static void retain(CachedFile *file) { file->refs.fetch_add(1, std::memory_order_relaxed); }
+
+    // 使一个路径对应的条目失效
+    void invalidate(const char *path);
+
+    // 使所有条目失效，目录被移动或者 inotify 事件队列溢出时使用
+    void invalidate_all();
+
+    // inotify 是否正常工作，不工作时文件变化得不到通知，依赖它的缓存都不能启用
+    bool enabled() const { return m_enabled.load(std::memory_order_acquire); }
+
+    /**
+     * 用 pread 读取文件打开时那个快照的内容，不访问映射
+     * 工作线程直接读映射时，文件被同时截断会触发 SIGBUS；pread 只会读到较短的内容
+     * 映射的小文件没有描述符，重新打开路径，inode、大小或者修改时间与快照不同时返回失败
+     * @return 读满 length 返回 true
+     */
+    static bool read_content(const CachedFile *file, char *buffer, long length);
+
+    static unsigned hash_of(const char *path);
+
+    static bool canonical(const char *path);
+
+private:
+    FileCache();
+
+    ~FileCache();
+
+    static void *watch_thread(void *arg);
+
+    void watch();
+
+    void add_watch(const std::string &dir);
+
+    static CachedFile *new_file(const char *path);
+
+    static int open_file(const char *path, CachedFile *&file);
+
+    static void destroy(CachedFile *file);
+
+private:
+    struct Shard {
+        Locker locker;
+        CachedFile **buckets = nullptr;
+        CachedFile *lru_head = nullptr;
+        CachedFile *lru_tail = nullptr;
+        int count = 0;
+        unsigned generation = 0;    // 每次失效加一，在锁外打开文件期间有失效时不插入
+    };
+
+    static const int SHARD_CAPACITY = (FILE_CACHE_NUMBER + FILE_CACHE_SHARDS - 1) / FILE_CACHE_SHARDS;
+    static const int BUCKET_NUMBER = 2 * SHARD_CAPACITY;
+
+    // 从哈希表与 LRU 链表中摘下条目，调用时持有分片的锁
+    void unlink(Shard &shard, CachedFile *file);
+
+    Shard m_shards[FILE_CACHE_SHARDS];
+    std::atomic<bool> m_enabled;      // inotify 正常工作时才缓存
+    int m_inotify_fd;
+    std::unordered_map<int, std::string> m_watches;     // 监视描述符到目录的映射，只在后台线程中使用
+};
+
+#endif //MYTINYWEBSERVER_FILE_CACHE_H
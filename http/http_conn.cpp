@@ -16,22 +16,52 @@
 #include <cstdlib>
 #include <cstdio>
 #include <sys/mman.h>
-#include <cstdarg>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
 #include "http_conn.h"
+#include "http_scan.h"
+#include "http_format.h"
+#include "buffer_pool.h"
+#include "file_cache.h"
+#include "response_cache.h"
+#include "compressor.h"
+#include "mime.h"
+#include "io_pool.h"
 #include "../config/config.h"
 #include "../log/log.h"
+#include "../timer/coarse_clock.h"
+#include "../reactor/event_loop.h"
 
 //定义http响应的一些状态信息
-const char *ok_200_title = "OK";
-const char *error_400_title = "Bad Request";
 const char *error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char *error_403_title = "Forbidden";
 const char *error_403_form = "You do not have permission to get file form this server.\n";
-const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
-const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_501_form = "The transfer coding of the request body is not supported.\n";
+
+/**
+ * 预先拼接好的状态行，生成响应头时直接拷贝
+ */
+struct StatusLine {
+    int status;
+    const char *line;
+    size_t length;
+};
+
+#define STATUS_LINE(status, title) {status, "HTTP/1.1 " #status " " title "\r\n", sizeof("HTTP/1.1 " #status " " title "\r\n") - 1}
+
+static const StatusLine STATUS_LINES[] = {
+        STATUS_LINE(200, "OK"),
+        STATUS_LINE(206, "Partial Content"),
+        STATUS_LINE(304, "Not Modified"),
+        STATUS_LINE(400, "Bad Request"),
+        STATUS_LINE(403, "Forbidden"),
+        STATUS_LINE(404, "Not Found"),
+        STATUS_LINE(416, "Range Not Satisfiable"),
+        STATUS_LINE(500, "Internal Error"),
+        STATUS_LINE(501, "Not Implemented"),
+};
 
 /**
  * 对文件描述符设置非阻塞
@@ -118,37 +148,25 @@ void mod_fd(int epoll_fd, int fd, int ev) {
     epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
 }
 
-// 初始化用户数静态变量
-int http_conn::m_user_count = 0;
-// 初始化 epoll 内核事件表静态文件描述符变量为 -1
-int http_conn::m_epoll_fd = -1;
-
-/**
- * 关闭连接，关闭一个连接，客户总量减一
- * @param real_close 是否是真的关闭连接
- */
-void http_conn::close_conn(bool real_close) {
-    if (real_close && m_socket_fd != -1) {
-        remove_fd(m_epoll_fd, m_socket_fd);
-        m_socket_fd = -1;
-        m_user_count--;
-    }
-}
+// 初始化用户数静态变量，多个事件循环会同时修改
+std::atomic<int> http_conn::m_user_count(0);
 
 /**
  * 初始化连接,由外部调用来初始化套接字地址
+ * 事件后端的注册由事件循环完成
+ * @param loop 接受这个连接的事件循环
  * @param socket_fd 要初始化的 socket 文件描述符 id
  * @param addr 客户端地址信息
  */
-void http_conn::init(int socket_fd, const sockaddr_in &addr) {
+void http_conn::init(EventLoop *loop, int socket_fd, const sockaddr_in &addr) {
+    m_loop = loop;
     m_socket_fd = socket_fd;
     m_address = addr;
 
-    // 将对应的 socket 文件描述符，添加到内核 epoll 事件表中
-    add_fd(m_epoll_fd, socket_fd, true);
     m_user_count++;
+    release();
     init();
-    LOG_DEBUG("%s now have %d users!", "init connection done!", m_user_count);
+    LOG_DEBUG("%s now have %d users!", "init connection done!", m_user_count.load());
 }
 
 /**
@@ -158,34 +176,189 @@ void http_conn::init(int socket_fd, const sockaddr_in &addr) {
 void http_conn::init() {
     bytes_to_send = 0;
     bytes_have_send = 0;
-    m_check_state = CHECK_STATE_REQUEST_LINE;
+    m_linger = false;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_cold_file = nullptr;
+    m_io_wait = false;
 
+    m_line_start_idx = 0;
+    m_checked_idx = 0;
+    m_request_start_idx = 0;
+    m_read_idx = 0;
+    m_write_idx = 0;
+    m_response_start = 0;
+    init_request();
+
+    // 读写缓存区在收到数据、生成响应时才从缓冲区池中申请
+    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
+/**
+ * 初始化单个请求的解析状态，流水线中的请求依次复用
+ */
+void http_conn::init_request() {
+    m_check_state = CHECK_STATE_REQUEST_LINE;
     m_keepalive = false;
     m_method = GET;
     m_url = nullptr;
     m_version = nullptr;
     m_host = nullptr;
     m_content_length = 0;
+    m_field_idx = -1;
+    m_line_len = 0;
+    m_headers.clear();
+    cgi = 0;
+    m_string = nullptr;
+    m_mime = nullptr;
+    m_encoding = ENCODING_IDENTITY;
+    m_body = nullptr;
+    m_body_length = 0;
+    m_range_count = 0;
+}
 
-    m_line_start_idx = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+/**
+ * 当前请求处理完毕，下一个请求从它的末尾开始（POST 需要跳过请求体）
+ */
+void http_conn::finish_request() {
+    // 请求体的长度在解析请求头时已经限制在读缓冲区之内，并且已经全部读入
+    long end = m_checked_idx + m_content_length;
+    m_line_start_idx = m_checked_idx = m_request_start_idx = (int) end;
+    init_request();
+}
 
-    cgi = 0;
+/**
+ * 响应全部发送之后，把还没有处理的请求数据移动到读缓存区开头
+ * 解析到一半的请求中记录的位置与指针一起平移
+ */
+void http_conn::compact_read() {
+    int delta = m_request_start_idx;
+    if (delta == 0)
+        return;
+    m_read_idx -= delta;
+    memmove(m_read_buf, m_read_buf + delta, m_read_idx + 1);
+    m_checked_idx -= delta;
+    m_line_start_idx -= delta;
+    m_request_start_idx = 0;
+    if (m_url)
+        m_url -= delta;
+    if (m_version)
+        m_version -= delta;
+    if (m_host)
+        m_host -= delta;
+    m_headers.shift(-delta);
+}
 
-    // 初始化所有的 buff 缓存区为 0
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buff, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+/**
+ * 保证读取缓存区能放下 need 字节（另外保留一个字节给字符串结尾），不够时按级别扩大
+ * 已经读到的数据拷贝到新的缓存区，解析过程中记录的指针一起调整
+ * @param need 需要容纳的数据长度
+ * @return 超过 READ_BUFFER_MAX 时返回 false
+ */
+bool http_conn::reserve_read(long need) {
+    if (m_read_buf && need < m_read_size)
+        return true;
+    if (need >= READ_BUFFER_MAX)
+        return false;
+    long size = need + 1;
+    if (size < 2L * m_read_size)
+        size = 2L * m_read_size;
+    if (size > READ_BUFFER_MAX)
+        size = READ_BUFFER_MAX;
+    int capacity = 0;
+    char *buffer = BufferPool::get_instance()->acquire((int) size, capacity);
+    if (!buffer)
+        return false;
+    if (m_read_buf) {
+        memcpy(buffer, m_read_buf, m_read_idx);
+        long delta = buffer - m_read_buf;
+        if (m_url)
+            m_url += delta;
+        if (m_version)
+            m_version += delta;
+        if (m_host)
+            m_host += delta;
+        if (m_string)
+            m_string += delta;
+        BufferPool::get_instance()->release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buffer;
+    m_read_size = capacity;
+    return true;
+}
+
+/**
+ * 生成响应之前申请写缓存区，一个批次的响应头都放在这一块缓存区中
+ * @return 是否成功
+ */
+bool http_conn::reserve_write() {
+    if (m_write_buff)
+        return true;
+    m_write_buff = BufferPool::get_instance()->acquire(BUFFER_CHUNK_SIZE, m_write_size);
+    return m_write_buff != nullptr;
+}
+
+/**
+ * 连接关闭时归还缓冲区，并取消还没有发送完的响应的文件映射
+ */
+void http_conn::release() {
+    m_generation.fetch_add(1, std::memory_order_release);
+    release_files();
+    BufferPool::get_instance()->release(m_read_buf, m_read_size);
+    m_read_buf = nullptr;
+    m_read_size = 0;
+    m_read_idx = 0;
+    BufferPool::get_instance()->release(m_write_buff, m_write_size);
+    m_write_buff = nullptr;
+    m_write_size = 0;
+    BufferPool::get_instance()->release(m_part_buff, m_part_size);
+    m_part_buff = nullptr;
+    m_part_size = 0;
+}
+
+/**
+ * 取常见请求头的值
+ * @param id 请求头编号
+ * @param length 值的长度
+ * @return 指向读缓冲区中的值，以 \0 结尾；不存在时返回 nullptr
+ */
+const char *http_conn::get_header(HEADER_ID id, int &length) const {
+    const HeaderIndex::Span *span = m_headers.get(id);
+    if (!span) {
+        length = 0;
+        return nullptr;
+    }
+    length = span->length;
+    return m_read_buf + span->offset;
 }
 
+/**
+ * 从状态机，用向量化的扫描器查找行尾，同时记录第一个字段分隔符的位置
+ * 数据不完整时返回 LINE_OPEN，已经扫描过的位置与分隔符位置都保留，下次读到数据后接着扫描
+ * @return 行的读取状态
+ */
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
     LOG_DEBUG("%s", "parse_line start!");
-    // 在还未监测完缓存区中的所有字符时，依次对缓存区内容
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
-        temp = m_read_buf[m_checked_idx];
+    // 新的一行开始，清除上一行的字段分隔符位置
+    if (m_checked_idx == m_line_start_idx)
+        m_field_idx = -1;
+    /**
+     * 请求行的字段以空格或 \t 分隔，请求头的名字与值以冒号分隔
+     * 找到第一个字段分隔符之后，同一行只再查找行尾
+     */
+    char delim1 = ':', delim2 = ':';
+    if (m_check_state == CHECK_STATE_REQUEST_LINE) {
+        delim1 = ' ';
+        delim2 = '\t';
+    }
+    while (m_checked_idx < m_read_idx) {
+        if (m_field_idx >= 0)
+            delim1 = delim2 = '\r';
+        const char *hit = HttpScanner::find(m_read_buf + m_checked_idx, m_read_buf + m_read_idx, delim1, delim2);
+        m_checked_idx = (int) (hit - m_read_buf);
+        if (m_checked_idx == m_read_idx)
+            break;
+        char temp = *hit;
         // 解析到某一行的末尾
         if (temp == '\r') {
             // \r 后面就是这一行缓存的末尾，即达到了读取的 buff 缓存末尾
@@ -193,6 +366,7 @@ http_conn::LINE_STATUS http_conn::parse_line() {
                 return LINE_OPEN;
                 // \r 后面就是 \n 即将这一行、完全读取完毕
             else if (m_read_buf[m_checked_idx + 1] == '\n') {
+                m_line_len = m_checked_idx - m_line_start_idx;
                 // 在 buff 里面添加 null 字符，形成字符串
                 m_read_buf[m_checked_idx++] = '\0';
                 m_read_buf[m_checked_idx++] = '\0';
@@ -203,6 +377,7 @@ http_conn::LINE_STATUS http_conn::parse_line() {
         } else if (temp == '\n') {
             // 读取到 \n ，如果前面是 \r 就代表这一行已经读取完毕了
             if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') {
+                m_line_len = m_checked_idx - 1 - m_line_start_idx;
                 // 在 buff 里面添加 null 字符，形成字符串
                 m_read_buf[m_checked_idx - 1] = '\0';
                 m_read_buf[m_checked_idx++] = '\0';
@@ -210,6 +385,9 @@ http_conn::LINE_STATUS http_conn::parse_line() {
             }
             return LINE_BAD;
         }
+        // 字段分隔符，记录位置后继续查找行尾
+        m_field_idx = m_checked_idx - m_line_start_idx;
+        ++m_checked_idx;
     }
     // 这行 buff 未读取到末尾，返回开放状态，继续进行操作
     return LINE_OPEN;
@@ -221,8 +399,8 @@ http_conn::LINE_STATUS http_conn::parse_line() {
  * @return
  */
 bool http_conn::read_once() {
-    // 如果缓存区已经满了，直接返回失败
-    if (m_read_idx >= READ_BUFFER_SIZE)
+    // 如果缓存区已经满了并且不能再扩大，直接返回失败
+    if (!reserve_read(m_read_idx + 1))
         return false;
     // 读取多少字节
     long bytes_read;
@@ -232,13 +410,14 @@ bool http_conn::read_once() {
  */
 #ifdef conn_fdLT
     // 从客户端 socket 连接里读取数据
-    bytes_read = recv(m_socket_fd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+    bytes_read = recv(m_socket_fd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
     // 调用 recv 失败，进行错误处理
     if (bytes_read <= 0) {
         return false;
     }
 
     m_read_idx += bytes_read;
+    m_read_buf[m_read_idx] = '\0';
     return true;
 #endif
 
@@ -246,9 +425,10 @@ bool http_conn::read_once() {
  * ET 模式，即边缘触发模式需要一次性全部读完
  */
 #ifdef conn_fdET
-    while (true) {
+    // 缓存区读满时扩大，已经达到上限时先停下，处理完已经收到的请求后再继续读取
+    while (reserve_read(m_read_idx + 1)) {
         // 从客户端 socket 连接里读取数据
-        bytes_read = recv(m_socket_fd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = recv(m_socket_fd, m_read_buf + m_read_idx, m_read_size - 1 - m_read_idx, 0);
         // 错误处理
         if (bytes_read == -1) {
             // todo 这些错误信息需要详细进行处理
@@ -259,11 +439,28 @@ bool http_conn::read_once() {
             return false;
         }
         m_read_idx += bytes_read;
+        // 读到的数据总是以 \0 结尾，保留的最后一个字节就是为它准备的
+        m_read_buf[m_read_idx] = '\0';
     }
     return true;
 #endif
 }
 
+/**
+ * 追加由事件循环收取的数据
+ * @param data 收到的数据
+ * @param len 数据长度
+ * @return 缓存区扩大到上限也放不下时返回 false
+ */
+bool http_conn::append_read(const char *data, long len) {
+    if (!reserve_read(m_read_idx + len))
+        return false;
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    m_read_buf[m_read_idx] = '\0';
+    return true;
+}
+
 /**
  * todo 这个 url 请求行解析细节还没摸清除
  * @param text 请求内容
@@ -271,15 +468,15 @@ bool http_conn::read_once() {
  */
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     /**
-     * 查找 ACCEPT 中任何字符在 S 中的第一次出现。即查找空格或者 \t
+     * 第一个空格或者 \t 的位置在 parse_line 扫描行尾时已经记录下来
      *
      * GET /home.html HTTP/1.1
      *    *
      */
-    m_url = strpbrk(text, " \t");
-    if (!m_url) {
+    if (m_field_idx < 0) {
         return REQUEST_BAD;
     }
+    m_url = text + m_field_idx;
     /**
      * 请求头第一个空格或者 \t 出现的时候，前面就是请求方式
      *
@@ -333,7 +530,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
      * 不进行改变了
      */
     m_version += strspn(m_version, " \t");
-    if (strcasecmp(m_version, "HTTP/1.1") != 0)
+    /**
+     * HTTP/1.1 默认保持连接，HTTP/1.0 只有带 Connection: keep-alive 时才保持
+     */
+    if (strcasecmp(m_version, "HTTP/1.1") == 0)
+        m_keepalive = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") != 0)
         return REQUEST_BAD;
     /**
      * 兼容 http(s):// 开头的 url ，并重置为 /
@@ -350,9 +552,10 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
      */
     if (!m_url || m_url[0] != '/')
         return REQUEST_BAD;
-    // todo 当 url 为 / 时，显示判断界面，应该是直接跳转 index.html，需要修改
-    if (strlen(m_url) == 1)
-        strcat(m_url, "index.html");
+    /**
+     * url 为 / 时由 do_request 映射到 index.html，这里不再原地追加，
+     * 否则会覆盖读缓存区中紧跟着的数据（流水线中的下一个请求）
+     */
     /**
      * 请求行判断完毕，下面需要进行请求头的判断
      */
@@ -361,6 +564,26 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     return REQUEST_OK;
 }
 
+/**
+ * 逗号分隔的列表中是否有某个选项，大小写不敏感
+ * @param list 请求头的值，例如 Connection: keep-alive, Upgrade
+ * @param token 要查找的选项
+ */
+static bool has_token(const char *list, const char *token) {
+    size_t token_len = strlen(token);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            ++p;
+        const char *name = p;
+        while (*p && *p != ',' && *p != ' ' && *p != '\t')
+            ++p;
+        if ((size_t) (p - name) == token_len && strncasecmp(name, token, token_len) == 0)
+            return true;
+    }
+    return false;
+}
+
 /**
  * 解析请求头
  * @param text 要解析的内容
@@ -378,31 +601,66 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
         }
         m_check_state = CHECK_STATE_CONTENT;
         return REQUEST_GET;
-    } // 解析请求头中的 Connection: 行
-    else if (strncasecmp(text, "Connection:", 11) == 0) {
-        text += 11;
-        /**
-         * 跳过冒号后面的空格
-         * Connection: keep-alive
-         */
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0)
-            m_keepalive = true;
-    } // 解析 Content-length:
-    else if (strncasecmp(text, "Content-length:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        char *pEnd;
-        m_content_length = strtol(text, &pEnd, 10);
-    } // 解析 Host:
-    else if (strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    } // 错误处理
-    else {
-        printf("oop!unknow header: %s\n", text);
-        //LOG_INFO("oop!unknow header: %s", text);
+    }
+    /**
+     * 冒号的位置在 parse_line 扫描行尾时已经记录下来，没有冒号的行不是合法的请求头，忽略
+     */
+    if (m_field_idx < 0)
+        return REQUEST_NO;
+    int name_len = m_field_idx;
+    /**
+     * 跳过冒号后面的空格，并去掉值末尾的空白
+     * Connection: keep-alive
+     */
+    char *value = text + name_len + 1;
+    value += strspn(value, " \t");
+    int value_len = m_line_len - (int) (value - text);
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t'))
+        value[--value_len] = '\0';
+    /**
+     * 只记录名字与值在读缓冲区中的位置，常见请求头通过完美哈希得到编号
+     */
+    HEADER_ID id = HeaderIndex::lookup(text, name_len);
+    // 同名的常见请求头索引中只保留第一个，重复的 Content-Length 要和第一个比较
+    bool repeated = m_headers.get(id) != nullptr;
+    m_headers.add(id, (int) (text - m_read_buf), name_len, (int) (value - m_read_buf), value_len);
+    switch (id) {
+        case HEADER_CONNECTION:
+            // close 优先，否则按 keep-alive 覆盖版本的默认值
+            if (has_token(value, "close"))
+                m_keepalive = false;
+            else if (has_token(value, "keep-alive"))
+                m_keepalive = true;
+            break;
+        case HEADER_CONTENT_LENGTH: {
+            /**
+             * 请求体与请求头一起放在读缓冲区中，超过 READ_BUFFER_MAX 的长度不可能读完；
+             * 负数或者不是数字的值会让下一个请求的起点错乱，都按错误的请求处理
+             */
+            if (value[0] < '0' || value[0] > '9')
+                return REQUEST_BAD;
+            char *end;
+            errno = 0;
+            long long length = strtoll(value, &end, 10);
+            if (*end != '\0' || errno == ERANGE || length > READ_BUFFER_MAX)
+                return REQUEST_BAD;
+            // 多个值不同的 Content-Length 无法确定请求体的长度（RFC 9112 6.3）
+            if (repeated && length != m_content_length)
+                return REQUEST_BAD;
+            m_content_length = (long) length;
+            break;
+        }
+        case HEADER_TRANSFER_ENCODING:
+            /**
+             * 请求体不支持任何传输编码，chunked 的数据会被当作下一个请求解析，
+             * 回复 501 之后关闭连接（RFC 9112 6.1）
+             */
+            return REQUEST_NOT_IMPLEMENTED;
+        case HEADER_HOST:
+            m_host = value;
+            break;
+        default:
+            break;
     }
     return REQUEST_NO;
 }
@@ -415,9 +673,8 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
 http_conn::HTTP_CODE http_conn::parse_content(char *text) {
     // 读取的 id 数目，达到了内容长度与已经检查过的字符数，即已经完全读取完毕
     if (m_read_idx >= (m_content_length + m_checked_idx)) {
-        // 添加字符串末尾标志
-        text[m_content_length] = '\0';
-        // POST 请求中的数据内容
+        // POST 请求中的数据内容，长度为 m_content_length
+        // 后面可能紧跟着流水线中的下一个请求，不能原地添加 \0
         m_string = text;
         return REQUEST_GET;
     }
@@ -435,10 +692,12 @@ http_conn::HTTP_CODE http_conn::process_read() {
         text = get_line();
         // 更新下一行开始处理的 id
         m_line_start_idx = m_checked_idx;
-        // 输出日志
-        LOG_INFO("%s", text);
-        // 刷新缓冲区
-        Log::get_instance()->flush();
+        /**
+         * 输出请求行与请求头，只输出这一行；
+         * 检查内容时 text 是读缓存区中剩下的全部数据，包括流水线中后面的请求，不输出
+         */
+        if (m_check_state != CHECK_STATE_CONTENT)
+            LOG_DEBUG("%.*s", m_line_len, text);
         switch (m_check_state) {
             // 主状态机：检查请求行
             case CHECK_STATE_REQUEST_LINE: {
@@ -449,24 +708,22 @@ http_conn::HTTP_CODE http_conn::process_read() {
             } // 状态机：检查请求头
             case CHECK_STATE_HEADER: {
                 ret = parse_headers(text);
+                if (ret == REQUEST_BAD || ret == REQUEST_NOT_IMPLEMENTED)
+                    return ret;
                 break;
             }
-            // 状态机：POST 检查内容
+            // 状态机：检查内容
             /**
-             * todo 这种处理方式还不太合理，后面还需要进行优化处理
-             * 可以考虑增加状态机状态， 或者使用 m_method 进行分类处理
+             * 任何方法都可能带请求体，读完之后才能确定流水线中下一个请求的起点，
+             * 没有请求体时长度为 0，直接处理
              */
             case CHECK_STATE_CONTENT: {
                 LOG_DEBUG("%s", "CHECK_STATE_CONTENT");
-                if (m_method == GET){
+                ret = parse_content(text);
+                if (ret == REQUEST_GET)
                     return do_request();
-                } else if (m_method == POST){
-                    ret = parse_content(text);
-                    if (ret == REQUEST_GET)
-                        return do_request();
-                    line_status = LINE_OPEN;
-                    break;
-                }
+                line_status = LINE_OPEN;
+                break;
             }
             default:
                 LOG_ERROR("%s", "process_read error! INTERNAL_ERROR");
@@ -481,98 +738,343 @@ http_conn::HTTP_CODE http_conn::process_read() {
  * @return
  */
 http_conn::HTTP_CODE http_conn::do_request() {
-    strcpy(m_real_file, WWW_ROOT_DIR);
-    size_t len = strlen(WWW_ROOT_DIR);
+    // 上一个请求的文件应该已经交给发送队列或者释放，留下的引用不能当作这个请求的文件
+    release_request_file();
 
     //printf("m_url:%s\n", m_url);
     const char *p = strstr(m_url, "/");
     // 只有 /
-    if (strlen(p) == 1) {
-        strcat(m_real_file, "/index.html");
-    } else
-        // todo 需要检查这个路径拼接合并是否合理
-        strcat(m_real_file, p);
+    if (strlen(p) == 1)
+        p = "/index.html";
+    // todo 需要检查这个路径拼接合并是否合理
+    // 请求头最长可以到 READ_BUFFER_MAX，放不下文件名的 url 按错误的请求处理
+    int n = snprintf(m_real_file, FILENAME_LEN, "%s%s", WWW_ROOT_DIR, p);
+    if (n < 0 || n >= FILENAME_LEN)
+        return REQUEST_BAD;
 
     /**
-     * 检查文件状态
+     * 可压缩类型的文件按 Accept-Encoding 协商内容编码，有预先压缩的 sidecar 文件或者后台压缩好的内容时
+     * 发送压缩版本；客户端不接受压缩或者还没有压缩版本时走下面不压缩的路径
+     * 文件状态、描述符与映射都来自打开文件缓存，命中时不需要文件系统调用
+     * 范围请求只对不压缩的版本处理，不协商编码，也不使用缓存的完整响应
      */
-    // 1. 文件是否存在
-    if (stat(m_real_file, &m_file_stat) < 0)
-        return REQUEST_NO_RESOURCE;
-    // 2. 文件是否有读取权限
-    if (!(m_file_stat.st_mode & S_IROTH))
-        return REQUEST_FORBIDDEN;
-    // 3. 文件是否是文件夹
-    if (S_ISDIR(m_file_stat.st_mode))
-        return REQUEST_BAD;
-    // 以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
+    const MimeType *mime = mime_of(m_real_file);
+    int length;
+    bool ranged = m_method == GET && get_header(HEADER_RANGE, length);
+    int encodings[ENCODING_NUMBER];
+    int encoding_count = 0;
+    if (mime->compressible && !ranged)
+        encoding_count = parse_accept_encoding(get_header(HEADER_ACCEPT_ENCODING, length), encodings);
+    int ret = 0;
+    if (encoding_count > 0) {
+        ret = FileCache::get_instance()->acquire(m_real_file, m_file);
+        if (ret == 0 && select_encoding(encodings, encoding_count)) {
+            m_mime = mime;
+            return check_conditional();
+        }
+    }
+    if (ret == 0 && !ranged) {
+        // 小文件不压缩的完整响应已经缓存时直接发送
+        CoarseClock::DateCache date{};
+        CoarseClock::get_instance()->read(date);
+        m_response = ResponseCache::get_instance()->acquire(m_real_file, date);
+        if (m_response) {
+            if (m_file) {
+                FileCache::get_instance()->release(m_file);
+                m_file = nullptr;
+            }
+            m_mime = mime;
+            return check_conditional();
+        }
+    }
+    if (ret == 0 && !m_file)
+        ret = FileCache::get_instance()->acquire(m_real_file, m_file);
+
     /**
-     * 映射地址从 ADDR 附近开始并扩展 LEN 字节。
-     * 从OFFSET根据PROT和FLAGS进入FD描述的文件。
-     * 如果 ADDR 不为零，则它是所需的映射地址。
-     * 如果在 FLAGS 中设置了 MAP_FIXED 位，则映射将恰好位于 ADDR（必须是页面对齐的）；
-     * 否则系统会选择一个方便的附近地址。
-     *
-     * 返回值是实际选择的映射地址或错误的 MAP_FAILED（在这种情况下设置了“errno”）。
-     * 成功的“mmap”调用会释放受影响区域的所有先前映射。
+     * 不存在、没有读取权限以及不是普通文件的情况由缓存在打开文件时检查
      */
-    m_file_address = (char *) mmap(nullptr, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    // 文件映射出错
-    if (!m_file_address) {
-        close(fd);
-        LOG_ERROR("%s", errno);
-        return INTERNAL_ERROR;
+    switch (ret) {
+        case 0:
+            m_mime = mime;
+            return check_conditional();
+        case ENOENT:
+            return REQUEST_NO_RESOURCE;
+        case EACCES:
+            return REQUEST_FORBIDDEN;
+        case EISDIR:
+            return REQUEST_BAD;
+        default:
+            LOG_ERROR("open %s failed, errno is:%d", m_real_file, ret);
+            return INTERNAL_ERROR;
     }
-    close(fd);
-    return REQUEST_FILE;
 }
 
 /**
- * 取消文件映射
+ * 条件请求：If-None-Match 与要发送的表示的实体标签匹配，或者没有 If-None-Match 时
+ * If-Modified-Since 不早于文件的修改时间，回复 304，不发送内容
+ * 验证器在文件打开时已经生成，这里不需要文件系统调用
+ * @return REQUEST_NOT_MODIFIED，或者继续检查范围请求的结果
  */
-void http_conn::unmap() {
-    if (m_file_address) {
-        int ret = munmap(m_file_address, m_file_stat.st_size);
-        if (ret == 0)
-            m_file_address = nullptr;
-        else {
-            LOG_ERROR("%s", errno);
+http_conn::HTTP_CODE http_conn::check_conditional() {
+    if (m_method != GET)
+        return REQUEST_FILE;
+    const char *etag = m_response ? m_response->etag : m_file->etag;
+    int length;
+    const char *value = get_header(HEADER_IF_NONE_MATCH, length);
+    if (value)
+        return etag_match(value, etag) ? REQUEST_NOT_MODIFIED : check_range();
+
+    value = get_header(HEADER_IF_MODIFIED_SINCE, length);
+    if (!value)
+        return check_range();
+    const char *last_modified = m_response ? m_response->last_modified : m_file->last_modified;
+    time_t mtime = m_response ? m_response->mtime : m_file->file_stat.st_mtime;
+    time_t since;
+    // 客户端通常原样带回 Last-Modified，相同时不需要解析日期；晚于当前时间的日期无效
+    if (strcmp(value, last_modified) == 0 ||
+        (CoarseClock::parse_http_date(value, since) && mtime <= since &&
+         since <= CoarseClock::get_instance()->wall_ms() / 1000))
+        return REQUEST_NOT_MODIFIED;
+    return check_range();
+}
+
+/**
+ * 范围请求：If-Range 与文件当前的验证器一致（或者没有 If-Range）时按 Range 发送文件的一部分
+ * 格式错误或者范围太多时忽略 Range，与 If-Range 不一致时说明客户端的部分内容已经过时，都发送完整的文件
+ * @return REQUEST_PARTIAL、REQUEST_RANGE_NOT_SATISFIABLE 或者 REQUEST_FILE
+ */
+http_conn::HTTP_CODE http_conn::check_range() {
+    if (!m_file || m_encoding != ENCODING_IDENTITY)
+        return REQUEST_FILE;
+    int length;
+    const char *value = get_header(HEADER_RANGE, length);
+    if (!value)
+        return REQUEST_FILE;
+    const char *if_range = get_header(HEADER_IF_RANGE, length);
+    if (if_range && !if_range_match(if_range))
+        return REQUEST_FILE;
+    int count = parse_range(value, (long) m_file->file_stat.st_size);
+    if (count < 0)
+        return REQUEST_FILE;
+    return count > 0 ? REQUEST_PARTIAL : REQUEST_RANGE_NOT_SATISFIABLE;
+}
+
+/**
+ * If-Range 只能用强比较：实体标签完全相同，或者日期与 Last-Modified 完全相同
+ * @param value 一个实体标签或者一个 HTTP 日期
+ */
+bool http_conn::if_range_match(const char *value) const {
+    if (*value == '"') {
+        size_t etag_len = strlen(m_file->etag);
+        return strlen(value) == etag_len + 2 && strncmp(value + 1, m_file->etag, etag_len) == 0 &&
+               value[etag_len + 1] == '"';
+    }
+    // 弱标签不能用于 If-Range
+    if (value[0] == 'W' && value[1] == '/')
+        return false;
+    return strcmp(value, m_file->last_modified) == 0;
+}
+
+/**
+ * 解析一个字节位置，最多 18 位数字，不会溢出
+ * @return 是否有数字
+ */
+static bool parse_position(const char *&p, long &value) {
+    const char *start = p;
+    value = 0;
+    while (*p >= '0' && *p <= '9' && p - start < 18)
+        value = value * 10 + (*p++ - '0');
+    return p > start && !(*p >= '0' && *p <= '9');
+}
+
+/**
+ * 解析 Range: bytes=0-499, 500-, -200，可以满足的范围按出现的顺序保存在 m_ranges 中
+ * 超出文件大小的范围不能满足，跳过；结束位置超出文件时截断到文件末尾
+ * @param value 请求头的值
+ * @param size 文件大小
+ * @return 可以满足的范围个数，格式错误或者范围太多返回 -1
+ */
+int http_conn::parse_range(const char *value, long size) {
+    m_range_count = 0;
+    if (strncasecmp(value, "bytes=", 6) != 0)
+        return -1;
+    const char *p = value + 6;
+    int count = 0;
+    int specs = 0;
+    while (true) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            ++p;
+        if (*p == '\0')
+            break;
+        long first, last;
+        bool has_first = parse_position(p, first);
+        if (*p++ != '-')
+            return -1;
+        bool has_last = parse_position(p, last);
+        if ((!has_first && !has_last) || (has_first && has_last && last < first) || ++specs > MAX_RANGES)
+            return -1;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (*p != ',' && *p != '\0')
+            return -1;
+
+        if (!has_first) {
+            // 后缀范围：最后 last 个字节
+            if (last > 0 && size > 0)
+                m_ranges[count++] = {last >= size ? 0 : size - last, last >= size ? size : last};
+        } else if (first < size) {
+            long end = (!has_last || last >= size) ? size - 1 : last;
+            m_ranges[count++] = {first, end - first + 1};
+        }
+    }
+    if (specs == 0)
+        return -1;
+    m_range_count = count;
+    return count;
+}
+
+/**
+ * 弱比较 If-None-Match 中的实体标签，压缩版本的标签带有编码后缀
+ * @param list 逗号分隔的实体标签列表，或者 *
+ * @param etag 文件的实体标签，不含引号与编码后缀
+ * @return 是否有匹配的标签
+ */
+bool http_conn::etag_match(const char *list, const char *etag) const {
+    const char *suffix = m_encoding != ENCODING_IDENTITY ? encoding_name(m_encoding) : nullptr;
+    size_t etag_len = strlen(etag);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',')
+            ++p;
+        if (*p == '*')
+            return true;
+        if (p[0] == 'W' && p[1] == '/')
+            p += 2;
+        if (*p != '"') {
+            // 格式错误，跳过这一项
+            while (*p && *p != ',')
+                ++p;
+            continue;
+        }
+        const char *tag = ++p;
+        while (*p && *p != '"')
+            ++p;
+        size_t tag_len = p - tag;
+        if (*p)
+            ++p;
+        if (tag_len < etag_len || strncmp(tag, etag, etag_len) != 0)
+            continue;
+        if (!suffix && tag_len == etag_len)
+            return true;
+        if (suffix && tag_len == etag_len + 1 + strlen(suffix) && tag[etag_len] == '-' &&
+            strncmp(tag + etag_len + 1, suffix, tag_len - etag_len - 1) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * 按客户端的偏好依次查找压缩版本：先找预先压缩的 sidecar 文件（.br/.gz），再找后台压缩的结果
+ * 客户端最偏好的编码还没有压缩过时交给后台线程压缩，这次先发送其它编码的版本或者不压缩发送
+ * @param encodings 客户端接受的编码，按偏好排列
+ * @param count 编码个数
+ * @return 是否选中了压缩版本
+ */
+bool http_conn::select_encoding(const int *encodings, int count) {
+    for (int i = 0; i < count; ++i) {
+        int encoding = encodings[i];
+        char path[FILENAME_LEN + 4];
+        snprintf(path, sizeof path, "%s%s", m_real_file, encoding_suffix(encoding));
+        CachedFile *sidecar = nullptr;
+        if (FileCache::get_instance()->acquire(path, sidecar) == 0) {
+            if (sidecar->file_stat.st_size > 0) {
+                FileCache::get_instance()->release(m_file);
+                m_file = sidecar;
+                m_encoding = encoding;
+                return true;
+            }
+            FileCache::get_instance()->release(sidecar);
+        }
+        int state = m_file->encode_state[encoding].load(std::memory_order_acquire);
+        if (state == ENCODE_READY) {
+            m_encoding = encoding;
+            m_body = m_file->encoded[encoding].data;
+            m_body_length = m_file->encoded[encoding].length;
+            return true;
         }
+        long size = m_file->file_stat.st_size;
+        if (i == 0 && state == ENCODE_NONE && m_file->cached && size >= COMPRESS_FILE_MIN && size <= COMPRESS_FILE_MAX)
+            Compressor::get_instance()->schedule(m_file, encoding);
     }
+    return false;
 }
 
-bool http_conn::add_response(const char *format, ...) {
-    // 缓存用完了
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
+/**
+ * 释放排队响应以及当前请求引用的文件与缓存响应
+ */
+void http_conn::release_files() {
+    for (int i = 0; i < m_file_count; ++i)
+        FileCache::get_instance()->release(m_files[i]);
+    m_file_count = 0;
+    m_segment_count = 0;
+    m_segment_idx = 0;
+    for (int i = 0; i < m_response_count; ++i)
+        ResponseCache::get_instance()->release(m_responses[i]);
+    m_response_count = 0;
+    release_request_file();
+}
+
+/**
+ * 释放当前请求的文件与缓存响应，它们还没有交给发送队列
+ */
+void http_conn::release_request_file() {
+    if (m_file) {
+        FileCache::get_instance()->release(m_file);
+        m_file = nullptr;
+    }
+    if (m_response) {
+        ResponseCache::get_instance()->release(m_response);
+        m_response = nullptr;
+    }
+}
+
+/**
+ * 把一段内容追加到写缓存区
+ * @param data 内容
+ * @param length 长度
+ * @return 写缓存区放不下时返回 false，不写入任何内容
+ */
+bool http_conn::append(const char *data, size_t length) {
+    if (length > (size_t) (m_write_size - m_write_idx))
         return false;
-    va_list args;
-    va_start(args, format);
+    memcpy(m_write_buff + m_write_idx, data, length);
+    m_write_idx += (int) length;
+    return true;
+}
 
-    int len = vsnprintf(m_write_buff + m_write_idx, WRITE_BUFFER_SIZE - 1, format, args);
-    // 如果写入的数据超过缓冲区中还剩余的空间，则引发错误
-    if (len >= WRITE_BUFFER_SIZE - 1 - m_write_idx) {
-        va_end(args);
+/**
+ * 把整数的十进制追加到写缓存区
+ * @param value 整数
+ * @return 是否成功
+ */
+bool http_conn::append_number(unsigned long value) {
+    if (m_write_size - m_write_idx < DECIMAL_MAX)
         return false;
-    }
-    // 更新 id
-    m_write_idx += len;
-    va_end(args);
-    // todo 这是直接把缓冲区中的所有内容，都显示出来了？不应该是显示从 后面显示的数据嘛
-    LOG_INFO("%s", m_write_buff);
-    // 刷新缓冲区
-    Log::get_instance()->flush();
+    m_write_idx += format_decimal(m_write_buff + m_write_idx, value);
     return true;
 }
 
 /**
- * 添加状态行
- * @param status
- * @param title
+ * 添加状态行，状态行预先拼接好
+ * @param status 状态码
  * @return
  */
-bool http_conn::add_status_line(int status, const char *title) {
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+bool http_conn::add_status_line(int status) {
+    for (const StatusLine &line : STATUS_LINES) {
+        if (line.status == status)
+            return append(line.line, line.length);
+    }
+    return false;
 }
 
 /**
@@ -581,10 +1083,36 @@ bool http_conn::add_status_line(int status, const char *title) {
  * @return 是否成功
  */
 bool http_conn::add_headers(size_t content_len) {
+    bool r0 = add_date();
     bool r1 = add_content_length(content_len);
     bool r2 = add_linger();
+    // 文件响应才有类型与编码，错误页面保持原样
+    if (m_mime) {
+        r2 = add_content_type() && r2;
+        // 只有不压缩的版本支持范围请求
+        if (m_encoding != ENCODING_IDENTITY)
+            r2 = add_content_encoding() && r2;
+        else
+            r2 = add_accept_ranges() && r2;
+        if (m_range_count == 1)
+            r2 = add_content_range() && r2;
+        if (m_mime->compressible)
+            r2 = add_vary() && r2;
+        r2 = add_etag() && add_last_modified() && r2;
+    }
     bool r3 = add_blank_line();
-    return r1 && r2 && r3;
+    return r0 && r1 && r2 && r3;
+}
+
+/**
+ * 添加响应时间，日期字符串由粗粒度时钟每秒格式化一次
+ * @return
+ */
+bool http_conn::add_date() {
+    CoarseClock::DateCache date{};
+    CoarseClock::get_instance()->read(date);
+    return append_literal("Date:") && append(date.http_date, CoarseClock::HTTP_DATE_LENGTH - 1) &&
+           append_literal("\r\n");
 }
 
 /**
@@ -593,7 +1121,7 @@ bool http_conn::add_headers(size_t content_len) {
  * @return
  */
 bool http_conn::add_content_length(size_t content_len) {
-    return add_response("Content-Length:%d\r\n", content_len);
+    return append_literal("Content-Length:") && append_number(content_len) && append_literal("\r\n");
 }
 
 /**
@@ -601,7 +1129,78 @@ bool http_conn::add_content_length(size_t content_len) {
  * @return
  */
 bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+    // 多个范围的响应由分段组成，每个分段头中带有文件类型
+    if (m_range_count > 1)
+        return append_literal("Content-Type:multipart/byteranges; boundary=") &&
+               append(m_boundary, strlen(m_boundary)) && append_literal("\r\n");
+    return append_literal("Content-Type:") && append(m_mime->type, strlen(m_mime->type)) && append_literal("\r\n");
+}
+
+/**
+ * 响应内容编码
+ * @return
+ */
+bool http_conn::add_content_encoding() {
+    const char *name = encoding_name(m_encoding);
+    return append_literal("Content-Encoding:") && append(name, strlen(name)) && append_literal("\r\n");
+}
+
+/**
+ * 可压缩类型的响应随 Accept-Encoding 变化，中间缓存需要区分
+ * @return
+ */
+bool http_conn::add_vary() {
+    return append_literal("Vary:Accept-Encoding\r\n");
+}
+
+/**
+ * 实体标签，压缩版本加上编码后缀，与不压缩的版本区分
+ * @return
+ */
+bool http_conn::add_etag() {
+    const char *etag = m_response ? m_response->etag : m_file->etag;
+    if (!append_literal("ETag:\"") || !append(etag, strlen(etag)))
+        return false;
+    if (m_encoding != ENCODING_IDENTITY) {
+        const char *name = encoding_name(m_encoding);
+        if (!append_literal("-") || !append(name, strlen(name)))
+            return false;
+    }
+    return append_literal("\"\r\n");
+}
+
+/**
+ * 文件的修改时间
+ * @return
+ */
+bool http_conn::add_last_modified() {
+    const char *last_modified = m_response ? m_response->last_modified : m_file->last_modified;
+    return append_literal("Last-Modified:") && append(last_modified, strlen(last_modified)) && append_literal("\r\n");
+}
+
+/**
+ * 告知客户端支持字节范围请求
+ * @return
+ */
+bool http_conn::add_accept_ranges() {
+    return append_literal("Accept-Ranges:bytes\r\n");
+}
+
+/**
+ * 单个范围的响应在哪个位置，没有可以满足的范围时只有文件大小
+ * @return
+ */
+bool http_conn::add_content_range() {
+    if (!append_literal("Content-Range:bytes "))
+        return false;
+    if (m_range_count == 0) {
+        if (!append_literal("*"))
+            return false;
+    } else if (!append_number(m_ranges[0].start) || !append_literal("-") ||
+               !append_number(m_ranges[0].start + m_ranges[0].length - 1)) {
+        return false;
+    }
+    return append_literal("/") && append_number(m_file->file_stat.st_size) && append_literal("\r\n");
 }
 
 /**
@@ -609,7 +1208,9 @@ bool http_conn::add_content_type() {
  * @return
  */
 bool http_conn::add_linger() {
-    return add_response("Connection:%s\r\n", m_keepalive ? "keep-alive" : "close");
+    if (m_keepalive)
+        return append_literal("Connection:keep-alive\r\n");
+    return append_literal("Connection:close\r\n");
 }
 
 /**
@@ -617,7 +1218,7 @@ bool http_conn::add_linger() {
  * @return
  */
 bool http_conn::add_blank_line() {
-    return add_response("%s", "\r\n");
+    return append_literal("\r\n");
 }
 
 /**
@@ -627,7 +1228,7 @@ bool http_conn::add_blank_line() {
  * @return
  */
 bool http_conn::add_content(const char *content) {
-    return add_response("%s", content);
+    return append(content, strlen(content));
 }
 
 /**
@@ -637,117 +1238,445 @@ bool http_conn::add_content(const char *content) {
  */
 bool http_conn::process_write(HTTP_CODE ret) {
     switch (ret) {
+        case REQUEST_BAD: {
+            // 之后的数据不能确定请求的边界，回复之后关闭连接
+            m_keepalive = false;
+            add_status_line(400);
+            add_headers(strlen(error_400_form));
+            if (!add_content(error_400_form))
+                return false;
+            break;
+        }
+        case REQUEST_NOT_IMPLEMENTED: {
+            m_keepalive = false;
+            add_status_line(501);
+            add_headers(strlen(error_501_form));
+            if (!add_content(error_501_form))
+                return false;
+            break;
+        }
         case INTERNAL_ERROR: {
-            add_status_line(500, error_500_title);
+            add_status_line(500);
             add_headers(strlen(error_500_form));
             if (!add_content(error_500_form))
                 return false;
             break;
         }
         case REQUEST_NO_RESOURCE: {
-            add_status_line(404, error_404_title);
+            add_status_line(404);
             add_headers(strlen(error_404_form));
             if (!add_content(error_404_form))
                 return false;
             break;
         }
         case REQUEST_FORBIDDEN: {
-            add_status_line(403, error_403_title);
+            add_status_line(403);
             add_headers(strlen(error_403_form));
             if (!add_content(error_403_form))
                 return false;
             break;
         }
+        case REQUEST_NOT_MODIFIED: {
+            // 只有响应头，没有内容，也不需要 Content-Length
+            add_status_line(304);
+            add_date();
+            add_linger();
+            if (m_mime->compressible)
+                add_vary();
+            add_etag();
+            add_last_modified();
+            if (!add_blank_line())
+                return false;
+            release_request_file();
+            break;
+        }
+        case REQUEST_RANGE_NOT_SATISFIABLE: {
+            add_status_line(416);
+            add_date();
+            add_content_length(0);
+            add_linger();
+            add_content_range();
+            if (!add_blank_line())
+                return false;
+            release_request_file();
+            break;
+        }
+        case REQUEST_PARTIAL: {
+            if (m_range_count > 1)
+                return queue_multipart();
+            // 单个范围直接发送文件的这一段，映射的文件从映射中取，其它文件用 sendfile 从范围的起点发送
+            add_status_line(206);
+            if (!add_headers(m_ranges[0].length))
+                return false;
+            queue_response(m_file, m_file->address, m_ranges[0].start, m_ranges[0].length);
+            return true;
+        }
         case REQUEST_FILE: {
-            add_status_line(200, ok_200_title);
-            if (m_file_stat.st_size != 0) {
-                add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buff;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
+            /**
+             * 第一次请求的小文件生成完整的响应放入响应缓存，之后的请求直接发送
+             * 生成时要读取文件内容，文件不在页缓存中时这次先不缓存，由 I/O 线程读入后正常发送
+             */
+            if (!m_response && m_encoding == ENCODING_IDENTITY && m_file->file_stat.st_size > 0 &&
+                m_file->file_stat.st_size < RESPONSE_CACHE_FILE_MAX &&
+                IoPool::resident(m_file, 0, (long) m_file->file_stat.st_size)) {
+                CoarseClock::DateCache date{};
+                CoarseClock::get_instance()->read(date);
+                m_response = ResponseCache::get_instance()->insert(m_file, date);
+            }
+            if (m_response) {
+                queue_cached_response();
+                return true;
+            }
+            add_status_line(200);
+            // 后台压缩的内容在内存中，其它情况发送文件本身（或者 sidecar 文件）
+            long length = m_body ? m_body_length : (long) m_file->file_stat.st_size;
+            if (length != 0) {
+                add_headers(length);
+                queue_response(m_file, m_body ? m_body : m_file->address, 0, length);
                 return true;
             } else {
                 const char *ok_string = "<html><body></body></html>";
                 add_headers(strlen(ok_string));
+                // 空文件的引用不进入发送队列，生成响应头之后释放
+                release_request_file();
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
         }
         default:
             return false;
     }
-    m_iv[0].iov_base = m_write_buff;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    queue_response(nullptr, nullptr, 0, 0);
     return true;
 }
 
 /**
- * 处理请求
+ * 把写缓存区或者分段头缓存区中的一段文字加入发送队列
+ * 紧挨着上一段 iovec 并且中间没有文件段时合并成一段
+ * @param data 内容
+ * @param length 长度
  */
-void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
-    if (read_ret == REQUEST_NO || read_ret == REQUEST_OK) {
-        mod_fd(m_epoll_fd, m_socket_fd, EPOLLIN);
+void http_conn::queue_text(const char *data, long length) {
+    if (length <= 0)
         return;
+    struct iovec *last = m_iv_count > 0 ? &m_iv[m_iv_count - 1] : nullptr;
+    bool segment_after_last = m_segment_count > 0 && m_segments[m_segment_count - 1].iov_pos == m_iv_count;
+    if (last && !segment_after_last && (char *) last->iov_base + last->iov_len == data) {
+        last->iov_len += length;
+    } else {
+        m_iv[m_iv_count].iov_base = (void *) data;
+        m_iv[m_iv_count].iov_len = length;
+        ++m_iv_count;
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
-        close_conn();
+    bytes_to_send += length;
+}
+
+/**
+ * 把响应内容的一段加入发送队列，内存中的内容占一段 iovec，否则作为文件段用 sendfile 从 offset 发送
+ * @param file 响应的文件
+ * @param body 内存中的响应内容（文件的映射或者压缩结果），为 nullptr 时用 sendfile 发送文件
+ * @param offset 这一段在内容中的起点
+ * @param length 这一段的长度
+ */
+void http_conn::queue_body(CachedFile *file, const char *body, off_t offset, long length) {
+    if (length <= 0)
+        return;
+    if (body) {
+        m_iv[m_iv_count].iov_base = (void *) (body + offset);
+        m_iv[m_iv_count].iov_len = length;
+        ++m_iv_count;
+        // 文件的映射不在页缓存中时，发送时缺页会阻塞事件循环，先记录下来交给 I/O 线程
+        if (body == file->address && !m_cold_file && !IoPool::resident(body + offset, length)) {
+            m_cold_file = file;
+            m_cold_offset = offset;
+            m_cold_length = length;
+        }
+    } else {
+        m_segments[m_segment_count++] = {file, file->fd, offset, length, m_iv_count, offset};
     }
-    mod_fd(m_epoll_fd, m_socket_fd, EPOLLOUT);
+    bytes_to_send += length;
 }
 
-bool http_conn::write() {
-    long n = 0;
-    /**
-     * 连接建立，但要发送的数据为0，重新向内核事件表中注册 one shout 事件
-     */
-    if (bytes_to_send == 0) {
-        mod_fd(m_epoll_fd, m_socket_fd, EPOLLIN);
-        init();
-        return true;
+/**
+ * 文件的引用交给发送队列，全部发送完毕后统一释放
+ */
+void http_conn::hold_file(CachedFile *file) {
+    m_files[m_file_count++] = file;
+    if (file == m_file)
+        m_file = nullptr;
+}
+
+/**
+ * 把刚生成的响应加入发送队列
+ * 响应头在写缓存区中紧挨着上一个响应时合并成一段 iovec，响应内容另占一段或者作为文件段
+ * @param file 响应的文件，没有时为 nullptr，发送队列接管调用者持有的引用
+ * @param body 内存中的响应内容，为 nullptr 时用 sendfile 发送文件
+ * @param offset 要发送的部分在内容中的起点，范围请求时不为 0
+ * @param length 要发送的长度
+ */
+void http_conn::queue_response(CachedFile *file, const char *body, off_t offset, long length) {
+    queue_text(m_write_buff + m_response_start, m_write_idx - m_response_start);
+    if (file) {
+        queue_body(file, body, offset, length);
+        hold_file(file);
+    }
+    m_response_start = m_write_idx;
+    m_linger = m_keepalive;
+}
+
+/**
+ * 多个范围的响应：multipart/byteranges，每个范围前面有一个分段头，最后是结束分隔符
+ * 分段头放在单独的缓存区中，响应头之后依次排队分段头与文件的各个范围，范围仍然零拷贝发送
+ * @return 是否成功
+ */
+bool http_conn::queue_multipart() {
+    if (!m_part_buff) {
+        m_part_buff = BufferPool::get_instance()->acquire(BUFFER_CHUNK_SIZE, m_part_size);
+        if (!m_part_buff)
+            return false;
+    }
+    snprintf(m_boundary, sizeof m_boundary, "%016lx",
+             (unsigned long) (m_file->hash ^ (CoarseClock::get_instance()->wall_ms() * 0x9E3779B97F4A7C15UL)));
+    long size = m_file->file_stat.st_size;
+    int part_end[MAX_RANGES + 1];
+    int idx = 0;
+    long content_length = 0;
+    for (int i = 0; i <= m_range_count; ++i) {
+        int len;
+        if (i < m_range_count)
+            len = snprintf(m_part_buff + idx, m_part_size - idx,
+                           "\r\n--%s\r\nContent-Type:%s\r\nContent-Range:bytes %ld-%ld/%ld\r\n\r\n", m_boundary,
+                           m_mime->type, (long) m_ranges[i].start, (long) m_ranges[i].start + m_ranges[i].length - 1,
+                           size);
+        else
+            len = snprintf(m_part_buff + idx, m_part_size - idx, "\r\n--%s--\r\n", m_boundary);
+        if (len >= m_part_size - idx)
+            return false;
+        idx += len;
+        part_end[i] = idx;
+        content_length += len + (i < m_range_count ? m_ranges[i].length : 0);
+    }
+    add_status_line(206);
+    if (!add_headers(content_length))
+        return false;
+
+    queue_text(m_write_buff + m_response_start, m_write_idx - m_response_start);
+    int part_start = 0;
+    for (int i = 0; i <= m_range_count; ++i) {
+        queue_text(m_part_buff + part_start, part_end[i] - part_start);
+        if (i < m_range_count)
+            queue_body(m_file, m_file->address, m_ranges[i].start, m_ranges[i].length);
+        part_start = part_end[i];
     }
+    hold_file(m_file);
+    m_response_start = m_write_idx;
+    m_linger = m_keepalive;
+    return true;
+}
 
+/**
+ * 把缓存的完整响应加入发送队列，按连接是否保持选择版本，占一段 iovec
+ */
+void http_conn::queue_cached_response() {
+    int variant = m_keepalive ? 1 : 0;
+    m_iv[m_iv_count].iov_base = m_response->data + m_response->offset[variant];
+    m_iv[m_iv_count].iov_len = m_response->length[variant];
+    ++m_iv_count;
+    bytes_to_send += m_response->length[variant];
+    m_responses[m_response_count++] = m_response;
+    m_response = nullptr;
+    m_linger = m_keepalive;
+    // 缓存的响应已经包含文件内容，不再需要打开的文件
+    if (m_file) {
+        FileCache::get_instance()->release(m_file);
+        m_file = nullptr;
+    }
+}
+
+/**
+ * 处理请求
+ * HTTP/1.1 流水线：读缓存区中已经完整的请求依次处理，响应排在一起由一次 writev 发送
+ */
+void http_conn::process() {
+    int responses = 0;
     while (true) {
-        n = writev(m_socket_fd, m_iv, m_iv_count);
-        if (n < 0) {
-            if (errno == EAGAIN) {
-                mod_fd(m_epoll_fd, m_socket_fd, EPOLLOUT);
-                return true;
+        HTTP_CODE read_ret = process_read();
+        if (read_ret == REQUEST_NO || read_ret == REQUEST_OK)
+            break;
+        if (!reserve_write() || !process_write(read_ret)) {
+            if (responses == 0) {
+                /**
+                 * 工作线程不直接关闭连接，只 shutdown 并重新等待读事件，
+                 * 由事件循环在自己的线程中看到连接关闭后统一注销连接与定时器
+                 */
+                shutdown(m_socket_fd, SHUT_RDWR);
+                m_loop->mod_fd(m_socket_fd, EPOLLIN);
+                return;
             }
-            unmap();
-            return false;
+            // 已经有排队的响应，先发送它们，之后关闭连接
+            m_write_idx = m_response_start;
+            m_linger = false;
+            break;
         }
-
-        bytes_have_send += n;
-        bytes_to_send -= n;
+        ++responses;
+        finish_request();
         /**
-         * 发送完毕
-         * todo 要进行深度理解
+         * 客户端要求关闭连接、批次已满、写缓存区放不下下一个响应头，这个响应的文件要用 sendfile 发送，
+         * 已经有一个多范围响应，或者这个响应的文件需要读盘时，先发送已经排队的响应，剩下的请求在发送完成后继续处理
          */
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        } else {
-            m_iv[0].iov_base = m_write_buff + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
+        if (!m_linger || responses >= MAX_PIPELINE || m_write_size - m_write_idx < RESPONSE_HEAD_MAX ||
+            has_sendfile() || m_part_buff || m_cold_file)
+            break;
+    }
+    /**
+     * 映射的文件不在页缓存中时由 I/O 线程读入之后再注册 EPOLLOUT，
+     * 提交之后连接可能马上被 I/O 线程交回事件循环，不能再访问
+     */
+    if (m_cold_file) {
+        CachedFile *file = m_cold_file;
+        m_cold_file = nullptr;
+        if (responses > 0 &&
+            IoPool::get_instance()->submit(m_loop, m_socket_fd, m_generation.load(std::memory_order_relaxed), file,
+                                           m_cold_offset, m_cold_length))
+            return;
+    }
+    m_loop->mod_fd(m_socket_fd, responses > 0 ? EPOLLOUT : EPOLLIN);
+}
 
-        if (bytes_to_send <= 0) {
-            unmap();
-            mod_fd(m_epoll_fd, m_socket_fd, EPOLLIN);
-            if (m_keepalive) {
-                init();
-                return true;
-            } else {
-                return false;
+/**
+ * I/O 线程读完文件内容之后，由事件循环线程调用继续发送
+ * 连接只在所属的事件循环线程中关闭，这里检查代数之后到 mod_fd 之间连接不会被关闭或者复用
+ * @param generation 提交读取时连接的代数
+ */
+void http_conn::resume_send(unsigned generation) {
+    if (generation != m_generation.load(std::memory_order_acquire))
+        return;
+    m_loop->mod_fd(m_socket_fd, EPOLLOUT);
+}
+
+/**
+ * 非阻塞地发送排队的响应，直到全部发送完毕或者 socket 发送缓冲区已满
+ * iovec 与文件段按顺序交替：先用一次 sendmsg 发送下一个文件段之前的所有 iovec，后面还有文件段时带上 MSG_MORE，
+ * 让响应头与文件开头合并成完整的报文段，再用 sendfile 从文件段的位置发送文件内容。
+ * 只发送了一部分时，iovec 跳过已经发送完的段，文件段记录发送到的位置。
+ * sendfile 之前按 IO_WINDOW 检查文件段是否在页缓存中，不在时交给 I/O 线程读入并停止发送，
+ * 读完之后 resume_send 重新注册 EPOLLOUT，从记录的位置继续
+ * @return 发送出错返回 false，剩余的字节数为 bytes_to_send
+ */
+bool http_conn::send_pending() {
+    // 刚由 I/O 线程读入的窗口不再检查
+    bool resumed = m_io_wait;
+    m_io_wait = false;
+    while (bytes_to_send > 0) {
+        long n;
+        FileSegment *segment = m_segment_idx < m_segment_count ? &m_segments[m_segment_idx] : nullptr;
+        int iov_end = segment ? segment->iov_pos : m_iv_count;
+        if (m_iv_idx < iov_end) {
+            msghdr msg{};
+            msg.msg_iov = m_iv + m_iv_idx;
+            msg.msg_iovlen = iov_end - m_iv_idx;
+            n = sendmsg(m_socket_fd, &msg, segment ? MSG_MORE : 0);
+            if (n < 0)
+                return errno == EAGAIN;
+            // 跳过已经发送完的段，并调整发送了一部分的段
+            long left = n;
+            while (m_iv_idx < iov_end && (size_t) left >= m_iv[m_iv_idx].iov_len) {
+                left -= (long) m_iv[m_iv_idx].iov_len;
+                ++m_iv_idx;
             }
+            if (left > 0) {
+                m_iv[m_iv_idx].iov_base = (char *) m_iv[m_iv_idx].iov_base + left;
+                m_iv[m_iv_idx].iov_len -= left;
+            }
+        } else if (segment) {
+            if (segment->offset >= segment->warm_end) {
+                long window = segment->length < IO_WINDOW ? segment->length : IO_WINDOW;
+                if (!resumed && !IoPool::resident(segment->fd, segment->offset, window)) {
+                    m_io_wait = true;
+                    if (IoPool::get_instance()->submit(m_loop, m_socket_fd,
+                                                       m_generation.load(std::memory_order_relaxed),
+                                                       segment->file, segment->offset, window))
+                        return true;
+                    m_io_wait = false;
+                }
+                resumed = false;
+                segment->warm_end = segment->offset + window;
+            }
+            n = sendfile(m_socket_fd, segment->fd, &segment->offset, segment->warm_end - segment->offset);
+            if (n < 0)
+                return errno == EAGAIN;
+            // 文件在发送过程中被截断
+            if (n == 0)
+                return false;
+            segment->length -= n;
+            if (segment->length == 0)
+                ++m_segment_idx;
+        } else {
+            return false;
         }
+        bytes_have_send += n;
+        bytes_to_send -= n;
+    }
+    return true;
+}
+
+/**
+ * 发送排队的响应
+ * @return 是否保持连接
+ */
+bool http_conn::write() {
+    /**
+     * 连接建立，但要发送的数据为0，重新向内核事件表中注册 one shout 事件
+     */
+    if (bytes_to_send == 0) {
+        m_loop->mod_fd(m_socket_fd, EPOLLIN);
+        return true;
     }
+    if (!send_pending()) {
+        release_files();
+        return false;
+    }
+    // 发送缓冲区已满，等待可写后从记录的位置继续发送；等待读盘时由 I/O 线程重新注册
+    if (bytes_to_send > 0) {
+        if (!m_io_wait)
+            m_loop->mod_fd(m_socket_fd, EPOLLOUT);
+        return true;
+    }
+    if (!finish_write())
+        return false;
+    // 读缓存区中还有请求时由事件循环交给线程池继续处理，否则等待新的数据
+    if (!has_buffered_input())
+        m_loop->mod_fd(m_socket_fd, EPOLLIN);
+    return true;
+}
+
+/**
+ * 响应发送完毕后的收尾工作，取消文件映射，长连接把未处理的请求数据移到读缓存区开头
+ * @return 是否保持连接
+ */
+bool http_conn::finish_write() {
+    release_files();
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_write_idx = 0;
+    m_response_start = 0;
+    BufferPool::get_instance()->release(m_write_buff, m_write_size);
+    m_write_buff = nullptr;
+    m_write_size = 0;
+    BufferPool::get_instance()->release(m_part_buff, m_part_size);
+    m_part_buff = nullptr;
+    m_part_size = 0;
+    if (!m_linger)
+        return false;
+    compact_read();
+    // 没有未处理的数据，连接进入空闲状态，读取缓存区也归还
+    if (m_read_idx == 0) {
+        BufferPool::get_instance()->release(m_read_buf, m_read_size);
+        m_read_buf = nullptr;
+        m_read_size = 0;
+    }
+    return true;
 }
\ No newline at end of file
@@ -14,12 +14,24 @@
 
 #include <netinet/in.h>
 #include <sys/stat.h>
+#include <atomic>
+#include "../timer/timer.h"
+#include "http_header.h"
+
+class EventLoop;
+
+struct CachedFile;
+
+struct CachedResponse;
+
+struct MimeType;
 
 class http_conn {
 public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int MAX_PIPELINE = 16;        // 一次批量发送的最大响应数
+    static const int RESPONSE_HEAD_MAX = 512;  // 一个响应头（包括错误页面内容）的最大长度
+    static const int MAX_RANGES = 8;           // 一个范围请求最多的范围个数，超过时忽略 Range 发送完整的文件
 
     enum METHOD {
         GET = 0,
@@ -40,6 +52,10 @@ public:
         REQUEST_NO_RESOURCE,
         REQUEST_FORBIDDEN,
         REQUEST_FILE,
+        REQUEST_NOT_MODIFIED,
+        REQUEST_PARTIAL,
+        REQUEST_RANGE_NOT_SATISFIABLE,
+        REQUEST_NOT_IMPLEMENTED,
         INTERNAL_ERROR,
         CLOSED_CONNECTION
     };
@@ -55,8 +71,7 @@ public:
     };
 
 public:
-    static int m_epoll_fd;
-    static int m_user_count;
+    static std::atomic<int> m_user_count;
 
 public:
     http_conn() = default;
@@ -64,9 +79,7 @@ public:
     ~http_conn() = default;
 
 public:
-    void init(int socket_fd, const sockaddr_in &addr);
-
-    void close_conn(bool real_close = true);
+    void init(EventLoop *loop, int socket_fd, const sockaddr_in &addr);
 
     void process();
 
@@ -78,16 +91,66 @@ public:
         return &m_address;
     }
 
+    // 连接对应的定时器数据，与连接对象一起预先分配
+    ClientData *get_client_data() {
+        return &m_client_data;
+    }
+
+    /**
+     * 以下接口供基于完成通知的事件循环（io_uring）使用：
+     * 数据由事件循环收取后拷贝进来，响应由事件循环按 iovec 一次发送
+     */
+    bool append_read(const char *data, long len);
+
+    struct iovec *get_iovec(int &iov_count) {
+        iov_count = m_iv_count - m_iv_idx;
+        return m_iv + m_iv_idx;
+    }
+
+    long get_bytes_to_send() const { return bytes_to_send; }
+
+    // 最后一个排队的响应是否保持连接
+    bool is_keepalive() const { return m_linger; }
+
+    // 读缓冲区中还有没有处理的请求数据（流水线中后续的请求）
+    bool has_buffered_input() const { return m_read_idx > m_request_start_idx; }
+
+    // 排队的响应中有没有要用 sendfile 发送的文件段
+    bool has_sendfile() const { return m_segment_count > 0; }
+
+    bool send_pending();
+
+    // 要发送的文件内容正在由 I/O 线程读入页缓存，读完之后由 resume_send 重新注册 EPOLLOUT
+    bool is_waiting_io() const { return m_io_wait; }
+
+    // I/O 线程读完之后由所属的事件循环线程调用，连接已经关闭或者被复用时忽略
+    void resume_send(unsigned generation);
+
+    bool finish_write();
+
+    // 连接关闭时归还缓冲区，释放还没有发送完的文件
+    void release();
+
 private:
+    EventLoop *m_loop{};      // 连接所属的事件循环
     int m_socket_fd{};        // 代表此连接的 socket 文件描述符
     sockaddr_in m_address{};  // 客户端连接地址
-    char m_read_buf[READ_BUFFER_SIZE]{};  // 读取缓存区
+    ClientData m_client_data{};   // 定时器数据，内嵌定时器节点
+    std::atomic<unsigned> m_generation{};     // 连接的代数，建立与关闭时加一，事件循环据此判断 I/O 线程读完时连接是否还在等待
+    char *m_read_buf{};   // 读取缓存区，从缓冲区池中申请，没有未处理的数据时归还
+    int m_read_size{};    // 读取缓存区的大小，最多扩大到 READ_BUFFER_MAX
     long m_read_idx{};     // 开始读取的字节游标
     int m_checked_idx{};  // 已经通过检查的字节游标
     int m_line_start_idx{};   // 开始处理的行
+    int m_request_start_idx{};    // 当前请求的起点，之前的数据属于已经处理完的请求
+    int m_field_idx{};    // 当前行第一个字段分隔符相对行首的偏移，请求行是空格，请求头是冒号，-1 表示没有
+    int m_line_len{};     // 当前行的长度，不包含行尾的 \r\n
+    HeaderIndex m_headers;    // 请求头索引，保存在读缓冲区中的位置
 
-    char m_write_buff[WRITE_BUFFER_SIZE]{};   // 写缓存区
+    char *m_write_buff{};     // 写缓存区，按顺序存放排队响应的响应头，响应发送完毕后归还
+    int m_write_size{};       // 写缓存区的大小
     int m_write_idx{};    // 写游标
+    int m_response_start{};   // 正在生成的响应头在写缓存区中的起点
 
     CHECK_STATE m_check_state;  // 从状态机标志
     METHOD m_method;    // HTTP 请求方法
@@ -96,12 +159,55 @@ private:
     char *m_version{};    // HTTP 请求版本
     char *m_host{};   // http 请求头中的 host 字段
     long m_content_length{};   // 内容长度
-    bool m_keepalive{};   // 是否开启长连接
-    char *m_file_address{};   //
+    bool m_keepalive{};   // 当前请求是否开启长连接
+    bool m_linger{};      // 最后一个排队的响应是否保持连接
+    CachedFile *m_file{};     // 当前请求的文件，从打开文件缓存中取得
+    CachedResponse *m_response{};     // 当前请求的完整响应，从响应缓存中取得
+    const MimeType *m_mime{};     // 当前请求的文件类型，只有文件响应才有
+    int m_encoding{};     // 当前请求协商出的内容编码，CONTENT_ENCODING
+    const char *m_body{};     // 后台压缩的文件内容，属于 m_file
+    long m_body_length{};
+
+    /**
+     * 范围请求中可以满足的范围，start 从 0 开始，已经截断到文件大小之内
+     */
+    struct ByteRange {
+        off_t start;
+        long length;
+    };
+    ByteRange m_ranges[MAX_RANGES]{};
+    int m_range_count{};
+    char m_boundary[20]{};    // multipart/byteranges 的分隔符
+    char *m_part_buff{};      // 多个范围的分段头，从缓冲区池中申请，一个批次最多一个多范围响应
+    int m_part_size{};
+
+    /**
+     * 用 sendfile 发送的文件段，排在 m_iv[iov_pos] 之前，前面的 iovec 发送完之后发送
+     */
+    struct FileSegment {
+        CachedFile *file;
+        int fd;
+        off_t offset;     // 下一个要发送的位置
+        long length;      // 还没有发送的长度
+        int iov_pos;
+        off_t warm_end;   // 已经确认在页缓存中的位置
+    };
 
-    struct stat m_file_stat{};    // 文件权限状态
-    struct iovec m_iv[2]{};   //
+    // 排队的响应，每个响应一段响应头，文件内容另占一段；多范围响应的每个分段头与范围各占一段
+    struct iovec m_iv[2 * MAX_PIPELINE + 2 * MAX_RANGES]{};
     int m_iv_count{};
+    int m_iv_idx{};   // 第一段还没有发送完的 iovec
+    CachedFile *m_files[MAX_PIPELINE]{};     // 排队响应引用的文件，发送完毕后释放引用
+    int m_file_count{};
+    CachedResponse *m_responses[MAX_PIPELINE]{};     // 排队的缓存响应，发送完毕后释放引用
+    int m_response_count{};
+    FileSegment m_segments[MAX_RANGES]{};    // 一个批次最多一个 sendfile 发送的响应，文件属于 m_files
+    int m_segment_count{};
+    int m_segment_idx{};      // 第一个还没有发送完的文件段
+    CachedFile *m_cold_file{};    // 排队的响应中不在页缓存中的映射，生成响应之后交给 I/O 线程读入
+    off_t m_cold_offset{};
+    long m_cold_length{};
+    bool m_io_wait{};     // 发送中的文件段正在由 I/O 线程读入
     int cgi{};    // 是否启用的POST
     char *m_string{}; // 存储请求头数据
 
@@ -111,6 +217,40 @@ private:
 private:
     void init();
 
+    void init_request();
+
+    void finish_request();
+
+    bool select_encoding(const int *encodings, int count);
+
+    HTTP_CODE check_conditional();
+
+    bool etag_match(const char *list, const char *etag) const;
+
+    HTTP_CODE check_range();
+
+    bool if_range_match(const char *value) const;
+
+    int parse_range(const char *value, long size);
+
+    void queue_text(const char *data, long length);
+
+    void queue_body(CachedFile *file, const char *body, off_t offset, long length);
+
+    void hold_file(CachedFile *file);
+
+    void queue_response(CachedFile *file, const char *body, off_t offset, long length);
+
+    bool queue_multipart();
+
+    void queue_cached_response();
+
+    void compact_read();
+
+    bool reserve_read(long need);
+
+    bool reserve_write();
+
     HTTP_CODE process_read();
 
     bool process_write(HTTP_CODE ret);
@@ -125,20 +265,48 @@ private:
 
     char *get_line() { return m_read_buf + m_line_start_idx; };
 
+    // 取常见请求头的值，值以 \0 结尾，不存在时返回 nullptr
+    const char *get_header(HEADER_ID id, int &length) const;
+
     LINE_STATUS parse_line();
 
-    void unmap();
+    void release_files();
+
+    void release_request_file();
+
+    // 响应头生成的性能测试（http/bench_header.cpp）直接调用下面的函数
+    friend struct HeaderBench;
 
-    bool add_response(const char *format, ...);
+    bool append(const char *data, size_t length);
+
+    // 追加字符串常量，长度在编译期确定
+    template<size_t N>
+    bool append_literal(const char (&text)[N]) { return append(text, N - 1); }
+
+    bool append_number(unsigned long value);
 
     bool add_content(const char *content);
 
-    bool add_status_line(int status, const char *title);
+    bool add_status_line(int status);
 
     bool add_headers(size_t content_length);
 
     bool add_content_type();
 
+    bool add_content_encoding();
+
+    bool add_vary();
+
+    bool add_etag();
+
+    bool add_last_modified();
+
+    bool add_accept_ranges();
+
+    bool add_content_range();
+
+    bool add_date();
+
     bool add_content_length(size_t content_length);
 
     bool add_linger();
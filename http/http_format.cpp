@@ -0,0 +1,59 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/26 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include "http_format.h"
+
+// 00 到 99 的两位数字
+static const char DIGIT_PAIRS[] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static int count_digits(unsigned long value) {
+    int digits = 1;
+    while (value >= 10000) {
+        value /= 10000;
+        digits += 4;
+    }
+    if (value >= 1000)
+        return digits + 3;
+    if (value >= 100)
+        return digits + 2;
+    if (value >= 10)
+        return digits + 1;
+    return digits;
+}
+
+int format_decimal(char *buf, unsigned long value) {
+    int digits = count_digits(value);
+    // 从个位开始，两位一组从后往前写
+    char *p = buf + digits;
+    while (value >= 100) {
+        const char *pair = DIGIT_PAIRS + (value % 100) * 2;
+        value /= 100;
+        *--p = pair[1];
+        *--p = pair[0];
+    }
+    if (value >= 10) {
+        const char *pair = DIGIT_PAIRS + value * 2;
+        *--p = pair[1];
+        *--p = pair[0];
+    } else {
+        *--p = (char) ('0' + value);
+    }
+    return digits;
+}
@@ -0,0 +1,31 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/26 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_HTTP_FORMAT_H
+#define MYTINYWEBSERVER_HTTP_FORMAT_H
+
+/**
+ * 响应头中整数的格式化
+ * 响应头的其它部分都是预先准备好的字符串，直接 memcpy；只有长度、范围等整数需要格式化，
+ * 按两位一组查表转换，不经过 printf 的格式解析与 locale 处理
+ */
+
+// 64 位无符号整数的最大十进制位数
+const int DECIMAL_MAX = 20;
+
+/**
+ * 把整数格式化为十进制
+ * @param buf 输出位置，至少 DECIMAL_MAX 字节，不添加 \0
+ * @param value 整数
+ * @return 位数
+ */
+int format_decimal(char *buf, unsigned long value);
+
+#endif //MYTINYWEBSERVER_HTTP_FORMAT_H
@@ -0,0 +1,127 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/21 10:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <strings.h>
+#include "http_header.h"
+
+/**
+ * 常见请求头的名字，下标就是 HEADER_ID
+ */
+static constexpr const char *HEADER_NAMES[HEADER_NUMBER] = {
+        "",
+        "Host", "Connection", "Content-Length", "Content-Type", "Transfer-Encoding",
+        "Accept", "Accept-Encoding", "Accept-Language", "User-Agent", "Referer",
+        "Cookie", "If-None-Match", "If-Modified-Since", "If-Match", "If-Unmodified-Since",
+        "If-Range", "Range", "Cache-Control", "Pragma", "Upgrade",
+        "Origin", "Authorization", "Expect", "Keep-Alive", "Accept-Charset",
+        "TE", "Via", "Forwarded", "X-Forwarded-For", "Upgrade-Insecure-Requests"
+};
+
+/**
+ * 完美哈希：只用名字长度、首字符与末字符（转为小写）计算槽位，
+ * 参数是针对上面的名字集合搜索出来的，新增名字后由下面的 static_assert 检查是否仍然没有冲突
+ */
+static const unsigned HASH_SIZE = 64;
+
+static constexpr unsigned fold(char c) {
+    return (unsigned) (unsigned char) c | 0x20u;
+}
+
+static constexpr size_t length_of(const char *s, size_t n = 0) {
+    return s[n] == '\0' ? n : length_of(s, n + 1);
+}
+
+static constexpr unsigned header_hash(const char *name, size_t length) {
+    return length == 0 ? 0 : ((unsigned) length * 6 + fold(name[0]) * 11 + fold(name[length - 1])) & (HASH_SIZE - 1);
+}
+
+static constexpr unsigned name_hash(int id) {
+    return header_hash(HEADER_NAMES[id], length_of(HEADER_NAMES[id]));
+}
+
+// 第 id 个名字与之后的名字都不冲突
+static constexpr bool unique_from(int id, int other) {
+    return other >= HEADER_NUMBER ? true :
+           (name_hash(id) != name_hash(other) && unique_from(id, other + 1));
+}
+
+static constexpr bool collision_free(int id = 1) {
+    return id >= HEADER_NUMBER ? true : (unique_from(id, id + 1) && collision_free(id + 1));
+}
+
+static_assert(collision_free(), "header hash has collisions, choose new parameters");
+
+// 槽位 slot 上的请求头编号
+static constexpr HEADER_ID slot_id(unsigned slot, int id = 1) {
+    return id >= HEADER_NUMBER ? HEADER_UNKNOWN :
+           (name_hash(id) == slot ? (HEADER_ID) id : slot_id(slot, id + 1));
+}
+
+#define SLOT4(n) slot_id(n), slot_id((n) + 1), slot_id((n) + 2), slot_id((n) + 3)
+#define SLOT16(n) SLOT4(n), SLOT4((n) + 4), SLOT4((n) + 8), SLOT4((n) + 12)
+
+/**
+ * 编译期生成的槽位表
+ */
+static constexpr HEADER_ID HEADER_SLOTS[HASH_SIZE] = {
+        SLOT16(0), SLOT16(16), SLOT16(32), SLOT16(48)
+};
+
+#undef SLOT16
+#undef SLOT4
+
+void HeaderIndex::clear() {
+    for (int i = 0; i < HEADER_NUMBER; ++i) {
+        m_known[i].offset = 0;
+        m_known[i].length = -1;
+    }
+    m_field_count = 0;
+}
+
+bool HeaderIndex::add(HEADER_ID id, int name_offset, int name_length, int value_offset, int value_length) {
+    if (id != HEADER_UNKNOWN && m_known[id].length < 0) {
+        m_known[id].offset = value_offset;
+        m_known[id].length = value_length;
+    }
+    if (m_field_count >= MAX_HEADERS)
+        return false;
+    Field &field = m_fields[m_field_count++];
+    field.id = id;
+    field.name.offset = name_offset;
+    field.name.length = name_length;
+    field.value.offset = value_offset;
+    field.value.length = value_length;
+    return true;
+}
+
+void HeaderIndex::shift(int delta) {
+    for (int i = 0; i < HEADER_NUMBER; ++i) {
+        if (m_known[i].length >= 0)
+            m_known[i].offset += delta;
+    }
+    for (int i = 0; i < m_field_count; ++i) {
+        m_fields[i].name.offset += delta;
+        m_fields[i].value.offset += delta;
+    }
+}
+
+/**
+ * 一次哈希定位槽位，再比较一次名字确认
+ */
+HEADER_ID HeaderIndex::lookup(const char *name, size_t length) {
+    if (length == 0)
+        return HEADER_UNKNOWN;
+    HEADER_ID id = HEADER_SLOTS[header_hash(name, length)];
+    // 前 length 个字符相同，并且常见名字也正好在这里结束
+    if (id == HEADER_UNKNOWN || strncasecmp(name, HEADER_NAMES[id], length) != 0 ||
+        HEADER_NAMES[id][length] != '\0')
+        return HEADER_UNKNOWN;
+    return id;
+}
@@ -0,0 +1,114 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/21 10:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_HTTP_HEADER_H
+#define MYTINYWEBSERVER_HTTP_HEADER_H
+
+#include <cstddef>
+
+/**
+ * 常见请求头的编号，与 HEADER_NAMES 中的顺序一致
+ */
+enum HEADER_ID {
+    HEADER_UNKNOWN = 0,
+    HEADER_HOST,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_CONTENT_TYPE,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_USER_AGENT,
+    HEADER_REFERER,
+    HEADER_COOKIE,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_IF_MATCH,
+    HEADER_IF_UNMODIFIED_SINCE,
+    HEADER_IF_RANGE,
+    HEADER_RANGE,
+    HEADER_CACHE_CONTROL,
+    HEADER_PRAGMA,
+    HEADER_UPGRADE,
+    HEADER_ORIGIN,
+    HEADER_AUTHORIZATION,
+    HEADER_EXPECT,
+    HEADER_KEEP_ALIVE,
+    HEADER_ACCEPT_CHARSET,
+    HEADER_TE,
+    HEADER_VIA,
+    HEADER_FORWARDED,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_UPGRADE_INSECURE_REQUESTS,
+    HEADER_NUMBER
+};
+
+/**
+ * 请求头索引
+ * 解析时只记录名字与值在读缓冲区中的偏移与长度，不拷贝数据；
+ * 常见请求头通过编译期构造的完美哈希映射为 HEADER_ID，按编号 O(1) 取值，
+ * 其它请求头按出现顺序保存在 m_fields 中，超出 MAX_HEADERS 的部分直接忽略。
+ *
+ * 偏移相对于读缓冲区的起点，缓冲区内容被整体移动后仍然有效。
+ */
+class HeaderIndex {
+public:
+    static const int MAX_HEADERS = 32;     // 浏览器一般发送 10 到 20 个请求头
+
+    // 读缓冲区中的一段数据，length 为 -1 表示不存在
+    struct Span {
+        int offset;
+        int length;
+    };
+
+    struct Field {
+        HEADER_ID id;
+        Span name;
+        Span value;
+    };
+
+public:
+    HeaderIndex() { clear(); }
+
+    void clear();
+
+    /**
+     * 记录一个请求头，同名的常见请求头只保留第一个
+     * @return 索引已满时返回 false
+     */
+    bool add(HEADER_ID id, int name_offset, int name_length, int value_offset, int value_length);
+
+    // 常见请求头的值，不存在时返回 nullptr
+    const Span *get(HEADER_ID id) const {
+        return m_known[id].length < 0 ? nullptr : &m_known[id];
+    }
+
+    int size() const { return m_field_count; }
+
+    // 读缓冲区中的数据整体移动后，调整所有偏移
+    void shift(int delta);
+
+    const Field &field(int i) const { return m_fields[i]; }
+
+    /**
+     * 把请求头名字映射为编号，大小写不敏感，不是常见请求头时返回 HEADER_UNKNOWN
+     * @param name 名字，不包含冒号
+     * @param length 名字长度
+     */
+    static HEADER_ID lookup(const char *name, size_t length);
+
+private:
+    Span m_known[HEADER_NUMBER];
+    Field m_fields[MAX_HEADERS];
+    int m_field_count;
+};
+
+#endif //MYTINYWEBSERVER_HTTP_HEADER_H
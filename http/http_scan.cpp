@@ -0,0 +1,102 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/20 16:10
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstring>
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * 逐字节扫描，也用来处理向量实现末尾不足一个向量的部分
+ */
+static const char *find_scalar(const char *begin, const char *end, char delim1, char delim2) {
+    for (; begin < end; ++begin) {
+        char c = *begin;
+        if (c == '\r' || c == '\n' || c == delim1 || c == delim2)
+            return begin;
+    }
+    return end;
+}
+
+#ifdef HTTP_SCAN_X86
+
+/**
+ * SSE4.2：pcmpestri 在 16 字节中查找字符集合中任意字符第一次出现的位置
+ */
+__attribute__((target("sse4.2")))
+static const char *find_sse42(const char *begin, const char *end, char delim1, char delim2) {
+    const __m128i set = _mm_setr_epi8('\r', '\n', delim1, delim2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - begin >= 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *) begin);
+        int index = _mm_cmpestri(set, 4, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (index < 16)
+            return begin + index;
+        begin += 16;
+    }
+    return find_scalar(begin, end, delim1, delim2);
+}
+
+/**
+ * AVX2：分别与四个字符比较后合并，movemask 得到位图，最低位的 1 就是第一个分隔符
+ */
+__attribute__((target("avx2")))
+static const char *find_avx2(const char *begin, const char *end, char delim1, char delim2) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i d1 = _mm256_set1_epi8(delim1);
+    const __m256i d2 = _mm256_set1_epi8(delim2);
+    while (end - begin >= 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *) begin);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(data, cr), _mm256_cmpeq_epi8(data, lf)),
+                                      _mm256_or_si256(_mm256_cmpeq_epi8(data, d1), _mm256_cmpeq_epi8(data, d2)));
+        auto mask = (unsigned) _mm256_movemask_epi8(hit);
+        if (mask)
+            return begin + __builtin_ctz(mask);
+        begin += 32;
+    }
+    return find_sse42(begin, end, delim1, delim2);
+}
+
+#endif
+
+HttpScanner::FIND_FUNC HttpScanner::m_find = HttpScanner::select();
+const char *HttpScanner::m_name = "scalar";
+
+HttpScanner::FIND_FUNC HttpScanner::get(const char *name) {
+    if (strcmp(name, "scalar") == 0)
+        return find_scalar;
+#ifdef HTTP_SCAN_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2"))
+        return find_sse42;
+    // AVX2 的末尾交给 SSE4.2 处理，两个都支持才能使用
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2"))
+        return find_avx2;
+#endif
+    return nullptr;
+}
+
+/**
+ * 按 CPU 支持的指令集选择实现，优先使用向量宽的
+ */
+HttpScanner::FIND_FUNC HttpScanner::select() {
+    static const char *const names[] = {"avx2", "sse4.2", "scalar"};
+    for (const char *name : names) {
+        FIND_FUNC find = get(name);
+        if (find) {
+            m_name = name;
+            return find;
+        }
+    }
+    return find_scalar;
+}
@@ -0,0 +1,52 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/20 16:10
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_HTTP_SCAN_H
+#define MYTINYWEBSERVER_HTTP_SCAN_H
+
+/**
+ * HTTP 报文的分隔符扫描
+ * 一次在缓冲区中查找 \r、\n 以及两个字段分隔符（请求行是空格与 \t，请求头是冒号）中最先出现的一个，
+ * AVX2 每次比较 32 字节，SSE4.2 每次 16 字节，都不支持时逐字节比较。
+ * 具体实现在第一次使用前按 CPU 支持的指令集选择，编译时不需要打开 -mavx2 等选项。
+ */
+class HttpScanner {
+public:
+    /**
+     * @param begin 扫描起点
+     * @param end 扫描终点（不包含）
+     * @param delim1 字段分隔符
+     * @param delim2 字段分隔符，只有一个时与 delim1 相同
+     * @return 第一个分隔符的位置，没有找到返回 end
+     */
+    static const char *find(const char *begin, const char *end, char delim1, char delim2) {
+        return m_find(begin, end, delim1, delim2);
+    }
+
+    // 当前使用的实现，"avx2"、"sse4.2" 或 "scalar"
+    static const char *name() { return m_name; }
+
+    typedef const char *(*FIND_FUNC)(const char *, const char *, char, char);
+
+    /**
+     * 按名字取得某个实现，用来在同一台机器上比较不同的实现
+     * @param name "avx2"、"sse4.2" 或 "scalar"
+     * @return 名字不存在或 CPU 不支持时返回 nullptr
+     */
+    static FIND_FUNC get(const char *name);
+
+private:
+    static FIND_FUNC m_find;
+    static const char *m_name;
+
+    static FIND_FUNC select();
+};
+
+#endif //MYTINYWEBSERVER_HTTP_SCAN_H
@@ -0,0 +1,148 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/27 10:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstdint>
+#include "io_pool.h"
+#include "file_cache.h"
+#include "../reactor/event_loop.h"
+#include "../config/config.h"
+#include "../log/log.h"
+
+IoPool::IoPool() : m_queue(nullptr), m_reads(0) {
+}
+
+bool IoPool::init(int thread_number) {
+    m_queue = new BlockQueue<Job>(IO_QUEUE_SIZE);
+    int created = 0;
+    for (int i = 0; i < thread_number; ++i) {
+        pthread_t tid;
+        if (pthread_create(&tid, nullptr, worker, this) != 0)
+            break;
+        pthread_detach(tid);
+        ++created;
+    }
+    // 一个线程都没有创建成功时不提交读取，直接发送
+    if (created == 0) {
+        delete m_queue;
+        m_queue = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool IoPool::submit(EventLoop *loop, int fd, unsigned generation, CachedFile *file, off_t offset, long length) {
+    if (!m_queue)
+        return false;
+    // I/O 线程持有一个引用，读取期间文件描述符不会被关闭
+    FileCache::retain(file);
+    if (!m_queue->push({loop, fd, generation, file, offset, length})) {
+        FileCache::get_instance()->release(file);
+        return false;
+    }
+    m_reads.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool IoPool::resident(const char *address, long length) {
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    if (length <= 0)
+        return true;
+    auto start = (uintptr_t) address & ~(uintptr_t) (page_size - 1);
+    auto end = (uintptr_t) address + length;
+    // 按段检查，每段最多 64 页
+    unsigned char pages[64];
+    while (start < end) {
+        uintptr_t chunk_end = start + sizeof pages * page_size;
+        if (chunk_end > end)
+            chunk_end = end;
+        // 检查失败时当作在页缓存中，保持原来的直接发送
+        if (mincore((void *) start, chunk_end - start, pages) != 0)
+            return true;
+        long count = (long) ((chunk_end - start + page_size - 1) / page_size);
+        for (long i = 0; i < count; ++i) {
+            if (!(pages[i] & 1))
+                return false;
+        }
+        start = chunk_end;
+    }
+    return true;
+}
+
+bool IoPool::resident(int fd, off_t offset, long length) {
+    if (length <= 0)
+        return true;
+    char byte;
+    iovec iov{&byte, 1};
+    const off_t positions[] = {offset, offset + length / 2, offset + length - 1};
+    for (off_t position : positions) {
+        // 需要读盘时立即返回 EAGAIN；文件系统不支持 RWF_NOWAIT 时当作在页缓存中
+        if (preadv2(fd, &iov, 1, position, RWF_NOWAIT) < 0 && errno == EAGAIN)
+            return false;
+    }
+    return true;
+}
+
+bool IoPool::resident(const CachedFile *file, off_t offset, long length) {
+    if (file->address)
+        return resident(file->address + offset, length);
+    return resident(file->fd, offset, length);
+}
+
+void *IoPool::worker(void *arg) {
+    ((IoPool *) arg)->run();
+    return nullptr;
+}
+
+void IoPool::run() {
+    const long buffer_size = 64 * 1024;
+    char *buffer = new char[buffer_size];
+    Job job{};
+    while (m_queue->pop(job)) {
+        /**
+         * 阻塞地读入这一段，读到的内容丢弃，只是为了让它进入页缓存
+         * 映射的小文件没有文件描述符，逐页访问映射触发缺页；大文件 pread 之后再提示内核预读下一段，
+         * 顺序发送大文件时下一次检查通常已经在页缓存中
+         */
+        off_t end = job.offset + job.length;
+        if (job.file->address) {
+            // 文件被截断时直接访问映射会触发 SIGBUS，MADV_POPULATE_READ 只返回错误
+            static const long page_size = sysconf(_SC_PAGESIZE);
+            auto start = (uintptr_t) (job.file->address + job.offset) & ~(uintptr_t) (page_size - 1);
+            auto stop = (uintptr_t) (job.file->address + end);
+#ifdef MADV_POPULATE_READ
+            if (madvise((void *) start, stop - start, MADV_POPULATE_READ) != 0)
+#endif
+                madvise((void *) start, stop - start, MADV_WILLNEED);
+        } else {
+            off_t offset = job.offset;
+            while (offset < end) {
+                long want = end - offset < buffer_size ? end - offset : buffer_size;
+                long n = pread(job.file->fd, buffer, want, offset);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                // 出错或者文件被截断，交给发送时处理
+                if (n <= 0)
+                    break;
+                offset += n;
+            }
+            posix_fadvise(job.file->fd, end, job.length, POSIX_FADV_WILLNEED);
+        }
+        LOG_DEBUG("cold read %s: %ld bytes at %ld", job.file->path.c_str(), job.length, (long) job.offset);
+        job.loop->resume_send(job.fd, job.generation);
+        FileCache::get_instance()->release(job.file);
+    }
+    delete[] buffer;
+}
@@ -0,0 +1,85 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/27 10:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_IO_POOL_H
+#define MYTINYWEBSERVER_IO_POOL_H
+
+#include <sys/types.h>
+#include <atomic>
+#include "../log/block_queue.h"
+
+struct CachedFile;
+
+class EventLoop;
+
+/**
+ * 冷文件读取线程池
+ * 响应的文件内容（小文件的映射、sendfile 发送的文件段）在发送之前检查是否在页缓存中，
+ * 不在时不发送，把这一段交给 I/O 线程用阻塞的 pread 读入页缓存，读完之后把连接交回所属的事件循环继续发送。
+ * 磁盘读取只阻塞 I/O 线程，事件循环与工作线程不会因为缺页或者 sendfile 读盘而停顿。
+ */
+class IoPool {
+public:
+    static IoPool *get_instance() {
+        static IoPool instance;
+        return &instance;
+    }
+
+    // 创建 I/O 线程
+    bool init(int thread_number);
+
+    /**
+     * 在后台把文件的一段读入页缓存，完成后通过 EventLoop::resume_send 交回连接所属的事件循环
+     * @param loop 连接所属的事件循环
+     * @param fd 等待这段内容的连接
+     * @param generation 连接的代数，由事件循环检查，连接在读取期间关闭或者被复用时不再继续发送
+     * @param file 文件，读取期间持有一个引用
+     * @param offset 起点
+     * @param length 长度
+     * @return 没有 I/O 线程或者队列已满时返回 false，调用者直接发送
+     */
+    bool submit(EventLoop *loop, int fd, unsigned generation, CachedFile *file, off_t offset, long length);
+
+    // 映射的内存是否都在页缓存中，用 mincore 检查
+    static bool resident(const char *address, long length);
+
+    // 文件的一段是否在页缓存中，用 RWF_NOWAIT 的 preadv2 检查首、中、尾三个字节
+    static bool resident(int fd, off_t offset, long length);
+
+    // 缓存文件的一段是否在页缓存中，映射的小文件检查映射，其它检查文件描述符
+    static bool resident(const CachedFile *file, off_t offset, long length);
+
+    // 交给 I/O 线程读取的次数
+    unsigned long reads() const { return m_reads.load(std::memory_order_relaxed); }
+
+private:
+    IoPool();
+
+    ~IoPool() = default;
+
+    static void *worker(void *arg);
+
+    void run();
+
+private:
+    struct Job {
+        EventLoop *loop;
+        int fd;
+        unsigned generation;
+        CachedFile *file;
+        off_t offset;
+        long length;
+    };
+
+    BlockQueue<Job> *m_queue;
+    std::atomic<unsigned long> m_reads;
+};
+
+#endif //MYTINYWEBSERVER_IO_POOL_H
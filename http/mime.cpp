@@ -0,0 +1,61 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/25 09:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstring>
+#include <strings.h>
+#include "mime.h"
+
+static const MimeType MIME_TYPES[] = {
+        {"html",  "text/html; charset=utf-8",              true},
+        {"htm",   "text/html; charset=utf-8",              true},
+        {"css",   "text/css; charset=utf-8",               true},
+        {"js",    "application/javascript; charset=utf-8", true},
+        {"mjs",   "application/javascript; charset=utf-8", true},
+        {"json",  "application/json",                      true},
+        {"txt",   "text/plain; charset=utf-8",             true},
+        {"xml",   "application/xml",                       true},
+        {"svg",   "image/svg+xml",                         true},
+        {"csv",   "text/csv; charset=utf-8",               true},
+        {"md",    "text/markdown; charset=utf-8",          true},
+        {"map",   "application/json",                      true},
+        {"wasm",  "application/wasm",                      true},
+        {"ico",   "image/x-icon",                          true},
+        {"ttf",   "font/ttf",                              true},
+        {"otf",   "font/otf",                              true},
+        {"png",   "image/png",                             false},
+        {"jpg",   "image/jpeg",                            false},
+        {"jpeg",  "image/jpeg",                            false},
+        {"gif",   "image/gif",                             false},
+        {"webp",  "image/webp",                            false},
+        {"avif",  "image/avif",                            false},
+        {"woff",  "font/woff",                             false},
+        {"woff2", "font/woff2",                            false},
+        {"mp3",   "audio/mpeg",                            false},
+        {"mp4",   "video/mp4",                             false},
+        {"webm",  "video/webm",                            false},
+        {"pdf",   "application/pdf",                       false},
+        {"zip",   "application/zip",                       false},
+        {"gz",    "application/gzip",                      false},
+        {"br",    "application/octet-stream",              false},
+};
+
+static const MimeType DEFAULT_MIME_TYPE = {"", "application/octet-stream", false};
+
+const MimeType *mime_of(const char *path) {
+    const char *dot = strrchr(path, '.');
+    // 没有扩展名，或者 . 出现在目录名中
+    if (!dot || strchr(dot, '/'))
+        return &DEFAULT_MIME_TYPE;
+    for (const MimeType &mime : MIME_TYPES) {
+        if (strcasecmp(dot + 1, mime.extension) == 0)
+            return &mime;
+    }
+    return &DEFAULT_MIME_TYPE;
+}
@@ -0,0 +1,30 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/25 09:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_MIME_H
+#define MYTINYWEBSERVER_MIME_H
+
+/**
+ * 文件类型，由扩展名决定
+ */
+struct MimeType {
+    const char *extension;      // 扩展名，不含 .
+    const char *type;           // Content-Type 的值
+    bool compressible;          // 文本类的内容值得压缩，图片、压缩包等已经压缩过的不再压缩
+};
+
+/**
+ * 按扩展名查找文件类型，不区分大小写
+ * @param path 文件路径
+ * @return 没有扩展名或者不认识的扩展名返回 application/octet-stream
+ */
+const MimeType *mime_of(const char *path);
+
+#endif //MYTINYWEBSERVER_MIME_H
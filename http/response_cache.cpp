@@ -0,0 +1,315 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/24 10:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "response_cache.h"
+#include "file_cache.h"
+#include "../log/log.h"
+
+ResponseCache::ResponseCache() {
+    for (Shard &shard : m_shards)
+        shard.buckets = new CachedResponse *[BUCKET_NUMBER]();
+}
+
+ResponseCache::~ResponseCache() {
+    invalidate_all();
+    for (Shard &shard : m_shards)
+        delete[] shard.buckets;
+}
+
+/**
+ * 生成文件的响应，响应头与 http_conn::process_write 生成的相同
+ */
+CachedResponse *ResponseCache::build(const CachedFile *file, const CoarseClock::DateCache &date) {
+    long body_len = file->file_stat.st_size;
+    char head[2][512];
+    int head_len[2];
+    for (int i = 0; i < 2; ++i) {
+        head_len[i] = snprintf(head[i], sizeof head[i],
+                               "%s %d %s\r\nDate:%s\r\nContent-Length:%ld\r\nConnection:%s\r\nContent-Type:%s\r\nAccept-Ranges:bytes\r\n%s"
+                               "ETag:\"%s\"\r\nLast-Modified:%s\r\n\r\n",
+                               "HTTP/1.1", 200, "OK", date.http_date, body_len, i ? "keep-alive" : "close",
+                               file->mime->type, file->mime->compressible ? "Vary:Accept-Encoding\r\n" : "",
+                               file->etag, file->last_modified);
+        if (head_len[i] >= (int) sizeof head[i])
+            return nullptr;
+    }
+
+    auto *response = new CachedResponse();
+    response->size = head_len[0] + head_len[1] + 2 * body_len;
+    response->data = new char[response->size];
+    int offset = 0;
+    for (int i = 0; i < 2; ++i) {
+        response->offset[i] = offset;
+        response->length[i] = head_len[i] + (int) body_len;
+        response->date_offset[i] = offset + (int) (strstr(head[i], "Date:") - head[i]) + 5;
+        memcpy(response->data + offset, head[i], head_len[i]);
+        offset += response->length[i];
+    }
+
+    /**
+     * 文件内容用 pread 读取，不拷贝映射：文件被同时截断时读取失败，而不是 SIGBUS
+     */
+    char *body = response->data + response->offset[0] + head_len[0];
+    if (!FileCache::read_content(file, body, body_len)) {
+        LOG_ERROR("read %s failed, errno is:%d", file->path.c_str(), errno);
+        destroy(response);
+        return nullptr;
+    }
+    memcpy(response->data + response->offset[1] + head_len[1], body, body_len);
+
+    response->path = file->path;
+    response->date_sec = date.sec;
+    memcpy(response->etag, file->etag, sizeof response->etag);
+    memcpy(response->last_modified, file->last_modified, sizeof response->last_modified);
+    response->mtime = file->file_stat.st_mtime;
+    response->refs.store(1, std::memory_order_relaxed);
+    response->hash = FileCache::hash_of(file->path.c_str());
+    response->hash_next = response->lru_prev = response->lru_next = nullptr;
+    return response;
+}
+
+/**
+ * 拷贝一份响应并换上新的日期，HTTP 日期的长度固定，其它内容的位置都不变
+ */
+CachedResponse *ResponseCache::refresh(const CachedResponse *old, const CoarseClock::DateCache &date) {
+    auto *response = new CachedResponse();
+    response->path = old->path;
+    response->size = old->size;
+    response->data = new char[response->size];
+    memcpy(response->data, old->data, response->size);
+    size_t date_len = strlen(date.http_date);
+    for (int i = 0; i < 2; ++i) {
+        response->offset[i] = old->offset[i];
+        response->length[i] = old->length[i];
+        response->date_offset[i] = old->date_offset[i];
+        memcpy(response->data + response->date_offset[i], date.http_date, date_len);
+    }
+    response->date_sec = date.sec;
+    memcpy(response->etag, old->etag, sizeof response->etag);
+    memcpy(response->last_modified, old->last_modified, sizeof response->last_modified);
+    response->mtime = old->mtime;
+    response->refs.store(1, std::memory_order_relaxed);
+    response->hash = old->hash;
+    response->hash_next = response->lru_prev = response->lru_next = nullptr;
+    return response;
+}
+
+void ResponseCache::destroy(CachedResponse *response) {
+    delete[] response->data;
+    delete response;
+}
+
+CachedResponse *ResponseCache::find(Shard &shard, unsigned hash, const char *path) {
+    for (CachedResponse *p = shard.buckets[bucket_of(hash)]; p; p = p->hash_next) {
+        if (p->hash == hash && p->path == path)
+            return p;
+    }
+    return nullptr;
+}
+
+void ResponseCache::link(Shard &shard, CachedResponse *response) {
+    unsigned bucket = bucket_of(response->hash);
+    response->hash_next = shard.buckets[bucket];
+    shard.buckets[bucket] = response;
+    response->lru_prev = nullptr;
+    response->lru_next = shard.lru_head;
+    if (shard.lru_head)
+        shard.lru_head->lru_prev = response;
+    shard.lru_head = response;
+    if (!shard.lru_tail)
+        shard.lru_tail = response;
+    shard.memory += response->size;
+}
+
+void ResponseCache::unlink(Shard &shard, CachedResponse *response) {
+    CachedResponse **p = &shard.buckets[bucket_of(response->hash)];
+    while (*p != response)
+        p = &(*p)->hash_next;
+    *p = response->hash_next;
+    response->hash_next = nullptr;
+
+    if (response->lru_prev)
+        response->lru_prev->lru_next = response->lru_next;
+    else
+        shard.lru_head = response->lru_next;
+    if (response->lru_next)
+        response->lru_next->lru_prev = response->lru_prev;
+    else
+        shard.lru_tail = response->lru_prev;
+    response->lru_prev = response->lru_next = nullptr;
+    shard.memory -= response->size;
+}
+
+// 移动到 LRU 表头
+void ResponseCache::touch(Shard &shard, CachedResponse *response) {
+    if (response == shard.lru_head)
+        return;
+    response->lru_prev->lru_next = response->lru_next;
+    if (response->lru_next)
+        response->lru_next->lru_prev = response->lru_prev;
+    else
+        shard.lru_tail = response->lru_prev;
+    response->lru_prev = nullptr;
+    response->lru_next = shard.lru_head;
+    shard.lru_head->lru_prev = response;
+    shard.lru_head = response;
+}
+
+void ResponseCache::release_list(CachedResponse *list) {
+    while (list) {
+        CachedResponse *next = list->hash_next;
+        list->hash_next = nullptr;
+        release(list);
+        list = next;
+    }
+}
+
+CachedResponse *ResponseCache::acquire(const char *path, const CoarseClock::DateCache &date) {
+    if (!FileCache::get_instance()->enabled() || !FileCache::canonical(path))
+        return nullptr;
+    unsigned hash = FileCache::hash_of(path);
+    Shard &shard = shard_of(hash);
+
+    shard.locker.lock();
+    CachedResponse *response = find(shard, hash, path);
+    if (!response) {
+        ++shard.misses;
+        shard.locker.unlock();
+        return nullptr;
+    }
+    ++shard.hits;
+    touch(shard, response);
+    response->refs.fetch_add(1, std::memory_order_relaxed);
+    shard.locker.unlock();
+    if (response->date_sec == date.sec)
+        return response;
+
+    /**
+     * 换秒之后第一次命中，在锁外生成这一秒的响应，再替换缓存中的旧响应
+     * 期间其它线程可能已经替换过，这时使用它生成的响应；旧响应已经失效时新响应只给这一次请求使用
+     */
+    CachedResponse *fresh = refresh(response, date);
+    CachedResponse *garbage = nullptr;
+    shard.locker.lock();
+    CachedResponse *current = find(shard, hash, path);
+    if (current == response) {
+        unlink(shard, response);
+        garbage = response;
+        fresh->refs.store(2, std::memory_order_relaxed);
+        link(shard, fresh);
+    } else if (current && current->date_sec == date.sec) {
+        current->refs.fetch_add(1, std::memory_order_relaxed);
+        garbage = fresh;
+        fresh = current;
+    }
+    shard.locker.unlock();
+    release_list(garbage);
+    release(response);
+    return fresh;
+}
+
+CachedResponse *ResponseCache::insert(const CachedFile *file, const CoarseClock::DateCache &date) {
+    if (!FileCache::get_instance()->enabled() || !FileCache::canonical(file->path.c_str()))
+        return nullptr;
+    CachedResponse *response = build(file, date);
+    if (!response)
+        return nullptr;
+    // 单个响应超过分片的内存上限，只给这一次请求使用
+    if (response->size > SHARD_MEMORY)
+        return response;
+
+    Shard &shard = shard_of(response->hash);
+    CachedResponse *garbage = nullptr;
+    shard.locker.lock();
+    /**
+     * 失效时先把文件从打开文件缓存中摘下，再使响应失效，两者之间插入的响应由后者清除，
+     * 所以这里在锁内检查文件还在打开文件缓存中，就不会留下过期的响应
+     */
+    if (!file->cached) {
+        shard.locker.unlock();
+        return response;
+    }
+    CachedResponse *existing = find(shard, response->hash, file->path.c_str());
+    if (existing) {
+        unlink(shard, existing);
+        existing->hash_next = garbage;
+        garbage = existing;
+    }
+    response->refs.store(2, std::memory_order_relaxed);
+    link(shard, response);
+    // 超出内存上限时淘汰最久没有使用的响应
+    while (shard.memory > SHARD_MEMORY) {
+        CachedResponse *victim = shard.lru_tail;
+        unlink(shard, victim);
+        victim->hash_next = garbage;
+        garbage = victim;
+    }
+    shard.locker.unlock();
+    release_list(garbage);
+    return response;
+}
+
+void ResponseCache::release(CachedResponse *response) {
+    if (response && response->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy(response);
+}
+
+void ResponseCache::invalidate(const char *path) {
+    unsigned hash = FileCache::hash_of(path);
+    Shard &shard = shard_of(hash);
+    shard.locker.lock();
+    CachedResponse *response = find(shard, hash, path);
+    if (response)
+        unlink(shard, response);
+    shard.locker.unlock();
+    release(response);
+}
+
+void ResponseCache::invalidate_all() {
+    for (Shard &shard : m_shards) {
+        shard.locker.lock();
+        CachedResponse *list = shard.lru_head;
+        for (int i = 0; i < BUCKET_NUMBER; ++i)
+            shard.buckets[i] = nullptr;
+        shard.lru_head = shard.lru_tail = nullptr;
+        shard.memory = 0;
+        shard.locker.unlock();
+        while (list) {
+            CachedResponse *next = list->lru_next;
+            list->hash_next = list->lru_prev = list->lru_next = nullptr;
+            release(list);
+            list = next;
+        }
+    }
+}
+
+unsigned long ResponseCache::hits() {
+    unsigned long total = 0;
+    for (Shard &shard : m_shards) {
+        shard.locker.lock();
+        total += shard.hits;
+        shard.locker.unlock();
+    }
+    return total;
+}
+
+unsigned long ResponseCache::misses() {
+    unsigned long total = 0;
+    for (Shard &shard : m_shards) {
+        shard.locker.lock();
+        total += shard.misses;
+        shard.locker.unlock();
+    }
+    return total;
+}
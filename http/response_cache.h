@@ -0,0 +1,136 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/24 10:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_RESPONSE_CACHE_H
+#define MYTINYWEBSERVER_RESPONSE_CACHE_H
+
+#include <ctime>
+#include <atomic>
+#include <string>
+#include "../lock/Locker.h"
+#include "../config/config.h"
+#include "../timer/coarse_clock.h"
+
+struct CachedFile;
+
+/**
+ * 缓存的完整响应，创建之后不再修改
+ * 同一块内存中依次存放保持连接与关闭连接两个版本，每个版本都是状态行、响应头与文件内容连续存放，
+ * 命中时直接作为一段 iovec 发送。
+ */
+struct CachedResponse {
+    std::string path;           // 缓存的键，与打开文件缓存相同
+    char *data;                 // 两个版本的响应
+    int offset[2];              // 两个版本在 data 中的起点，下标 0 为关闭连接，1 为保持连接
+    int length[2];              // 两个版本的长度
+    int date_offset[2];         // 两个版本中 Date 值的位置，换秒时据此生成新的响应
+    time_t date_sec;            // Date 对应的秒
+    char etag[64];              // 文件的实体标签与修改时间，命中时处理条件请求
+    char last_modified[32];
+    time_t mtime;
+    long size;                  // 占用的内存，计入缓存的内存上限
+    std::atomic<int> refs;      // 引用计数，缓存本身持有一个，每个正在发送的响应各持有一个
+    unsigned hash;
+    CachedResponse *hash_next;
+    CachedResponse *lru_prev;
+    CachedResponse *lru_next;
+};
+
+/**
+ * 小文件的完整响应缓存，进程内共享
+ * 小于 RESPONSE_CACHE_FILE_MAX 的文件第一次请求时把响应序列化好放入缓存，之后命中时
+ * 不需要查找打开文件缓存，也不需要格式化响应头，一次 send 发送共享的内存。
+ *
+ * 与打开文件缓存一样按路径分片，每个分片一把锁、一张哈希表与一条 LRU 链表，
+ * 分片占用的内存超过 RESPONSE_CACHE_MEMORY / RESPONSE_CACHE_SHARDS 时淘汰最久没有使用的响应。
+ * 文件变化由打开文件缓存的 inotify 线程通知失效，inotify 不可用时不缓存。
+ *
+ * 响应中的 Date 每秒变化一次：命中的响应不是当前这一秒生成的时，拷贝一份并替换其中的日期，
+ * 所以每个热点文件每秒最多生成一次响应。
+ */
+class ResponseCache {
+public:
+    static ResponseCache *get_instance() {
+        static ResponseCache instance;
+        return &instance;
+    }
+
+    /**
+     * 查找缓存的响应，调用者持有一个引用，发送完毕后调用 release
+     * @param path 文件路径
+     * @param date 当前的日期，缓存的响应不是这一秒生成的时更新 Date
+     * @return 没有命中时返回 nullptr
+     */
+    CachedResponse *acquire(const char *path, const CoarseClock::DateCache &date);
+
+    /**
+     * 为刚打开的文件生成响应并放入缓存
+     * @param file 打开文件缓存中的文件，已经不在打开文件缓存中（可能已经变化）时生成的响应不放入缓存
+     * @param date 当前的日期
+     * @return 生成的响应，调用者持有一个引用；缓存不可用或者读取文件失败时返回 nullptr
+     */
+    CachedResponse *insert(const CachedFile *file, const CoarseClock::DateCache &date);
+
+    void release(CachedResponse *response);
+
+    void invalidate(const char *path);
+
+    void invalidate_all();
+
+    // 命中与没有命中的次数
+    unsigned long hits();
+
+    unsigned long misses();
+
+private:
+    ResponseCache();
+
+    ~ResponseCache();
+
+    static CachedResponse *build(const CachedFile *file, const CoarseClock::DateCache &date);
+
+    static CachedResponse *refresh(const CachedResponse *old, const CoarseClock::DateCache &date);
+
+    static void destroy(CachedResponse *response);
+
+private:
+    struct Shard {
+        Locker locker;
+        CachedResponse **buckets = nullptr;
+        CachedResponse *lru_head = nullptr;
+        CachedResponse *lru_tail = nullptr;
+        long memory = 0;
+        unsigned long hits = 0;
+        unsigned long misses = 0;
+    };
+
+    static const long SHARD_MEMORY = RESPONSE_CACHE_MEMORY / RESPONSE_CACHE_SHARDS;
+    static const int BUCKET_NUMBER = 256;
+
+    Shard &shard_of(unsigned hash) { return m_shards[hash % RESPONSE_CACHE_SHARDS]; }
+
+    static unsigned bucket_of(unsigned hash) { return (hash / RESPONSE_CACHE_SHARDS) % BUCKET_NUMBER; }
+
+    // 以下函数调用时持有分片的锁
+    CachedResponse *find(Shard &shard, unsigned hash, const char *path);
+
+    void link(Shard &shard, CachedResponse *response);
+
+    void unlink(Shard &shard, CachedResponse *response);
+
+    void touch(Shard &shard, CachedResponse *response);
+
+    // 释放从缓存中摘下的响应，它们以 hash_next 串成链表，在锁外调用
+    void release_list(CachedResponse *list);
+
+    Shard m_shards[RESPONSE_CACHE_SHARDS];
+};
+
+#endif //MYTINYWEBSERVER_RESPONSE_CACHE_H
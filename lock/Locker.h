@@ -8,6 +8,12 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <atomic>
+#include <climits>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 /**
  * 锁的类封装，内部使用线程互斥锁实现
@@ -101,4 +107,59 @@ public:
     bool post() { return sem_post(&m_sem) == 0; }
 };
 
+/**
+ * 基于 futex 的事件计数器（eventcount），用于让空闲线程在无锁队列上休眠
+ * 等待方：key = prepare_wait() -> 再检查一次条件 -> 满足则 cancel_wait()，否则 wait(key)
+ * 通知方：先让条件成立（比如入队），再 notify_one()/notify_all()
+ * 没有线程在等待时，通知只是一次原子读，不会进入内核
+ */
+class EventCount {
+    std::atomic<unsigned> m_epoch{0};   // 每次通知加一，futex 等待在这个值上
+    std::atomic<int> m_waiters{0};      // 正在等待（或准备等待）的线程数
+
+    static long futex(std::atomic<unsigned> *addr, int op, unsigned val, const struct timespec *timeout = nullptr) {
+        return syscall(SYS_futex, (unsigned *) addr, op, val, timeout, nullptr, 0);
+    }
+
+public:
+    // 宣告自己准备等待，返回当前纪元
+    unsigned prepare_wait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    // 再次检查发现条件已经满足，放弃等待
+    void cancel_wait() { m_waiters.fetch_sub(1, std::memory_order_seq_cst); }
+
+    // 纪元没有变化时休眠，直到被通知
+    void wait(unsigned key) {
+        while (m_epoch.load(std::memory_order_seq_cst) == key) {
+            futex(&m_epoch, FUTEX_WAIT_PRIVATE, key);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    // 与 wait 相同，但最多休眠 timeout_ms 毫秒，被信号打断时也会提前返回，调用者自己再检查条件
+    void wait_for(unsigned key, long timeout_ms) {
+        struct timespec timeout{timeout_ms / 1000, timeout_ms % 1000 * 1000000};
+        if (m_epoch.load(std::memory_order_seq_cst) == key)
+            futex(&m_epoch, FUTEX_WAIT_PRIVATE, key, &timeout);
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void notify_one() { notify(1); }
+
+    void notify_all() { notify(INT_MAX); }
+
+private:
+    void notify(int count) {
+        // 与等待方的 prepare_wait 配对，保证要么等待方看到条件成立，要么这里看到等待方
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) == 0)
+            return;
+        m_epoch.fetch_add(1, std::memory_order_seq_cst);
+        futex(&m_epoch, FUTEX_WAKE_PRIVATE, count);
+    }
+};
+
 #endif //MYTINYWEBSERVER_LOCKER_H
@@ -0,0 +1,54 @@
+#!/bin/bash
+#*******************************************************************************
+# @author: Cuyu Tang
+# @email: me@expoli.tech
+# @website: www.expoli.tech
+# @date: 2023/4/30 11:10
+# @version: 1.0
+# @description: 
+#*******************************************************************************
+
+# 日志刷新策略的每秒请求数测试：每种刷新策略（-f）与日志格式（-l）的组合各测量 RUNS 次，结果从小到大排列
+# 服务器返回一个 6 字节的文件，请求的开销主要在解析与日志上，bench_load 用 16 个长连接请求 3 秒
+# 用法：log/bench_flush.sh 构建目录 [服务器程序]
+#   构建目录中需要有 bench_load；服务器程序默认是构建目录中的 MyTinyWebServer
+# 环境变量：
+#   RUNS（默认 5）、CONNECTIONS（默认 16）、SECONDS_PER_RUN（默认 3）
+#   POLICIES（默认 "immediate interval size error"），设为 - 时不传 -f，用于没有刷新策略的旧版本
+#   FORMATS（默认 "text deferred"）
+#   SERVER_ARGS 传给服务器的其他参数，例如 "-v debug" 让每个请求的请求头都写入日志
+
+BUILD=$(cd "${1:?usage: $0 build_dir [server]}" && pwd)
+SERVER=$(realpath "${2:-$BUILD/MyTinyWebServer}")
+LOAD=$BUILD/bench_load
+RUNS=${RUNS:-5}
+CONNECTIONS=${CONNECTIONS:-16}
+SECONDS_PER_RUN=${SECONDS_PER_RUN:-3}
+POLICIES=${POLICIES:-immediate interval size error}
+FORMATS=${FORMATS:-text deferred}
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+mkdir -p "$DIR/www"
+echo hello > "$DIR/www/a.txt"
+cd "$DIR" || exit 1
+
+for policy in $POLICIES; do
+    for format in $FORMATS; do
+        args=(-l "$format")
+        [ "$policy" != - ] && args+=(-f "$policy")
+        printf '%-10s %-9s ' "$policy" "$format"
+        for ((run = 0; run < RUNS; ++run)); do
+            port=$((20000 + RANDOM % 20000))
+            # shellcheck disable=SC2086
+            "$SERVER" 127.0.0.1 $port "${args[@]}" $SERVER_ARGS > /dev/null 2>&1 &
+            pid=$!
+            sleep 0.5
+            "$LOAD" $port /a.txt "$CONNECTIONS" "$SECONDS_PER_RUN" | grep -o 'requests/s=[0-9]*' | cut -d= -f2
+            kill -TERM $pid
+            wait $pid 2> /dev/null
+            rm -f ./*ServerLog*
+        done | sort -n | tr '\n' ' '
+        echo
+    done
+done
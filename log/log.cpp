@@ -8,193 +8,611 @@
 ********************************************************************************/
 
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
 #include <cstring>
 #include <cstdarg>
+#include <new>
 #include "log.h"
+#include "../timer/coarse_clock.h"
 
-Log::Log() {
-    m_count = 0;
-    m_is_async = false;
+// 一次 writev 最多收集的缓冲区个数，每个缓冲区最多两段
+static const int WRITE_RING_NUMBER = 32;
+
+// 延迟格式化与二进制模式下刷写线程输出缓冲区的大小
+static const int WRITE_BUFFER_SIZE = 256 * 1024;
+
+int log_mode_of(const char *name) {
+    if (strcmp(name, "text") == 0)
+        return LOG_MODE_TEXT;
+    if (strcmp(name, "deferred") == 0)
+        return LOG_MODE_DEFERRED;
+    if (strcmp(name, "binary") == 0)
+        return LOG_MODE_BINARY;
+    return -1;
+}
+
+int log_level_of(const char *name) {
+    static const char *const names[] = {"debug", "info", "warn", "error"};
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; ++level) {
+        if (strcmp(name, names[level]) == 0)
+            return level;
+    }
+    return -1;
+}
+
+const char *log_level_name(int level) {
+    static const char *const names[] = {"debug", "info", "warn", "error"};
+    return (level >= LOG_LEVEL_DEBUG && level <= LOG_LEVEL_ERROR) ? names[level] : "info";
+}
+
+int log_flush_policy_of(const char *name) {
+    if (strcmp(name, "immediate") == 0)
+        return FLUSH_IMMEDIATE;
+    if (strcmp(name, "interval") == 0)
+        return FLUSH_INTERVAL;
+    if (strcmp(name, "size") == 0)
+        return FLUSH_SIZE;
+    if (strcmp(name, "error") == 0)
+        return FLUSH_ON_ERROR;
+    return -1;
+}
+
+int log_full_policy_of(const char *name) {
+    if (strcmp(name, "block") == 0)
+        return FULL_BLOCK;
+    if (strcmp(name, "drop") == 0)
+        return FULL_DROP;
+    return -1;
 }
 
 /**
- * 析构函数，处理文件指针
+ * 线程当前使用的环形缓冲区，线程退出时交还，留给之后创建的线程复用
+ */
+struct RingHolder {
+    LogRing *ring = nullptr;
+
+    ~RingHolder() {
+        if (ring)
+            ring->in_use.store(false, std::memory_order_release);
+    }
+};
+
+static thread_local RingHolder local_holder;
+
+std::atomic<int> Log::m_level(LOG_LEVEL_INFO);
+
+void Log::set_level(int level) {
+    if (level < LOG_LEVEL_DEBUG)
+        level = LOG_LEVEL_DEBUG;
+    if (level > LOG_LEVEL_ERROR)
+        level = LOG_LEVEL_ERROR;
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+Log::Log() : m_dir_name(), m_log_name(), m_split_lines(LOG_SPLIT_LINES), m_log_buf_size(LOG_BUFF_SIZE),
+             m_ring_size(LOG_RING_SIZE), m_count(0), m_part(0), m_today(0), m_fd(-1), m_mode(LOG_MODE_TEXT),
+             m_flush_policy(FLUSH_INTERVAL), m_full_policy(FULL_BLOCK), m_formats(),
+             m_format_count(0), m_formats_written(0), m_record(nullptr), m_out(nullptr), m_out_size(0),
+             m_out_idx(0), m_rings(nullptr), m_running(false), m_flush_requested(false), m_dropped(0),
+             m_dropped_reported(0), m_thread() {
+}
+
+/**
+ * 析构函数，停止刷写线程，写出剩余的日志并关闭文件
+ * 环形缓冲区不释放，进程退出时其它线程可能还在写日志
  */
 Log::~Log() {
-    if (m_fp != nullptr) {
-        fclose(m_fp);
+    if (m_running.exchange(false)) {
+        m_flush_event.notify_one();
+        pthread_join(m_thread, nullptr);
     }
-    // 释放日志缓存
-    delete[] m_buf;
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    delete[] m_record;
+    delete[] m_out;
 }
 
 /**
  * 初始化函数
  * todo 判断文件夹是否存在的函数，并给出默认的位置（比如运行目录下的 log 文件夹）
  * @param file_name log 文件名字
- * @param log_buf_size log 日志缓存区大小
+ * @param log_buf_size 一行日志的最大长度
  * @param split_lines 最大行数
- * @param max_queue_size 最长日志条队列
+ * @param ring_size 每个线程环形缓冲区的大小
+ * @param mode 日志模式
+ * @param flush_policy 写出策略
+ * @param full_policy 缓冲区满时的处理
  * @return
  */
-bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size) {
-    // 如果设置了 max_queue_size,则设置为异步
-    if (max_queue_size >= 1) {
-        m_is_async = true;
-        m_log_queue = new BlockQueue<std::string>(max_queue_size);
-
-        pthread_t tid;
-        /**
-         * flush_log_thread为回调函数,这里表示创建线程异步写日志
-         */
-        pthread_create(&tid, nullptr, flush_log_thread, nullptr);
-    }
-    /**
-     * 初始化日志缓存区
-     */
+bool Log::init(const char *file_name, int log_buf_size, int split_lines, long ring_size, int mode,
+               int flush_policy, int full_policy) {
+    m_mode = mode;
+    m_flush_policy = flush_policy;
+    m_full_policy = full_policy;
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
     m_split_lines = split_lines;
-    /**
-     * 记录初始化时间
-     */
-    time_t t = time(nullptr);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    // 至少能放下两行最长的日志
+    m_ring_size = 2;
+    while (m_ring_size < ring_size || m_ring_size < 2L * log_buf_size)
+        m_ring_size <<= 1;
 
     /**
      * 找到字符串中最后一次出现的字符
-     * 返回指向 C 字符串 str 中字符最后一次出现的指针。
-     * 终止空字符被认为是 C 字符串的一部分。
-     * 因此，它也可以定位到检索指向字符串末尾的指针。
      * a/c/d/aaa.log
      */
     const char *p = strrchr(file_name, '/');
-    // 保存日志全部的名称
-    char log_full_name[256] = {0};
-    /**
-     * 年_月_日_filename
-     */
     if (p == nullptr) {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                 file_name);
+        snprintf(m_log_name, LOG_FILE_NAME_LENGTH, "%s", file_name);
     } else {
         // 日志文件名字
-        strcpy(m_log_name, p + 1);
+        snprintf(m_log_name, LOG_FILE_NAME_LENGTH, "%s", p + 1);
         // 将文件名除最后的日志名之外的所有字符串当作文件夹名字
-        strncpy(m_dir_name, file_name, p - file_name + 1);
-        snprintf(log_full_name, 255, "%s/%d_%02d_%02d_%s", m_dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1,
-                 my_tm.tm_mday, m_log_name);
+        snprintf(m_dir_name, LOG_FILE_NAME_LENGTH, "%.*s", (int) (p - file_name + 1), file_name);
+    }
+    if (m_mode == LOG_MODE_BINARY)
+        strncat(m_log_name, ".bin", LOG_FILE_NAME_LENGTH - strlen(m_log_name) - 1);
+    if (m_mode != LOG_MODE_TEXT) {
+        // 一条记录不超过一行日志的缓冲区，格式化之后再加上时间前缀与换行
+        m_record = new char[log_buf_size];
+        m_out_size = WRITE_BUFFER_SIZE > 4 * log_buf_size ? WRITE_BUFFER_SIZE : 4 * log_buf_size;
+        m_out = new char[m_out_size];
     }
 
+    /**
+     * 记录初始化时间
+     */
+    time_t t = time(nullptr);
+    struct tm my_tm{};
+    localtime_r(&t, &my_tm);
     m_today = my_tm.tm_mday;
-    // 以追加的方式打开日志文件
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == nullptr)
+    if (!open_file(my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, 0))
         return false;
+
+    m_running.store(true);
+    if (pthread_create(&m_thread, nullptr, flush_log_thread, this) != 0) {
+        m_running.store(false);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 打开（追加）某一天的日志文件
+ * @param part 按行数切分的序号，0 表示当天的第一个文件，之后的文件名加上 .part
+ */
+bool Log::open_file(int year, int mon, int mday, long long part) {
+    char log_full_name[2 * LOG_FILE_NAME_LENGTH + 48];
+    // 年_月_日_filename
+    if (part == 0) {
+        snprintf(log_full_name, sizeof log_full_name, "%s%d_%02d_%02d_%s", m_dir_name, year, mon, mday, m_log_name);
+    } else {
+        snprintf(log_full_name, sizeof log_full_name, "%s%d_%02d_%02d_%s.%lld", m_dir_name, year, mon, mday,
+                 m_log_name, part);
+    }
+    int fd = open(log_full_name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = fd;
+    if (m_mode == LOG_MODE_BINARY) {
+        // 新文件以标记开头，之后重新写入所有格式串，每个文件可以单独解码
+        if (lseek(fd, 0, SEEK_END) == 0)
+            write(fd, LOG_BINARY_MAGIC, sizeof LOG_BINARY_MAGIC);
+        m_formats_written = 0;
+    }
     return true;
 }
 
 /**
  * 日志写函数
+ * 在调用线程自己的缓冲区中格式化并追加，只有缓冲区满时才等待刷写线程
  * @param level 日志等级
  * @param format 日志的格式
  * @param ...
  */
 void Log::write_log(int level, const char *format, ...) {
-    struct timeval now = {0, 0};
-    gettimeofday(&now, nullptr);
-
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-
-    char s[16] = {0};
-
-    switch (level) {
-        case 0:
-            strcpy(s, "[debug]:");
-            break;
-        case 1:
-            strcpy(s, "[info]:");
-            break;
-        case 2:
-            strcpy(s, "[warn]:");
-            break;
-        case 3:
-            strcpy(s, "[erro]:");
-            break;
-        default:
-            strcpy(s, "[info]:");
-            break;
-    }
+    if (!m_running.load(std::memory_order_relaxed))
+        return;
+    LogRing *ring = local_ring();
+    if (!ring)
+        return;
+
     /**
-     * 写入一个log，对m_count++, m_split_lines最大行数
+     * 时间取自事件循环维护的粗粒度时钟，日期字符串已经格式化好
      */
-    m_mutex.lock();
-    m_count++;
+    char *buf = ring->line();
+    int size = ring->line_size();
+    va_list args;
+    va_start(args, format);
+    if (m_mode != LOG_MODE_TEXT) {
+        // 记录中只放格式化好的内容，时间前缀与换行由刷写线程加上
+        int m = vsnprintf(buf + sizeof(LogRecord), size - sizeof(LogRecord), format, args);
+        va_end(args);
+        if (m < 0)
+            m = 0;
+        if (m > (int) (size - sizeof(LogRecord) - 1))
+            m = (int) (size - sizeof(LogRecord) - 1);
+        LogRecord record{};
+        record.length = (uint32_t) (sizeof(LogRecord) + m);
+        record.type = LOG_RECORD_TEXT;
+        record.level = (uint16_t) level;
+        record.time_ms = CoarseClock::get_instance()->wall_ms();
+        memcpy(buf, &record, sizeof record);
+        append(ring, buf, record.length, level);
+        return;
+    }
+
     /**
-     * 对日志按日期进行分类
+     * 时间取自事件循环维护的粗粒度时钟，日期字符串已经格式化好
+     * 2000-01-01 00:00:00.123 [debug]
      */
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) {
-        char new_log[256] = {0};
-        /*
-         * 刷新缓存区内容，并关闭原来的文件描述符
-         */
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-
-        snprintf(tail, 15, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-
-        if (m_today != my_tm.tm_mday) {
-            snprintf(new_log, 255, "%s/%s%s", m_dir_name, tail, m_log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
-        } else {
-            snprintf(new_log, 255, "%s/%s%s.%lld", m_dir_name, tail, m_log_name, m_count / m_split_lines);
+    CoarseClock::DateCache date{};
+    CoarseClock::get_instance()->read(date);
+    long millisecond = (long) (CoarseClock::get_instance()->wall_ms() % 1000);
+    int n = snprintf(buf, 48, "%s.%03ld %s ", date.log_date, millisecond, log_level_tag(level));
+    // 留出换行符，超长的日志截断
+    int m = vsnprintf(buf + n, size - n, format, args);
+    va_end(args);
+    if (m < 0)
+        m = 0;
+    if (m > size - n - 1)
+        m = size - n - 1;
+    buf[n + m] = '\n';
+    append(ring, buf, n + m + 1, level);
+}
+
+/**
+ * 把一行日志或者一条记录追加到线程自己的缓冲区，按写出策略决定是否叫醒刷写线程
+ * 缓冲区放不下时按 m_full_policy 等待或者丢弃
+ */
+void Log::append(LogRing *ring, const char *data, long length, int level) {
+    if (ring->free_space() < length) {
+        if (m_full_policy == FULL_DROP) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            flush();
+            return;
         }
-        m_fp = fopen(new_log, "a");
+        if (!wait_space(ring, length))
+            return;
     }
+    long used = ring->write(data, length);
+    if (m_flush_policy == FLUSH_IMMEDIATE || (m_flush_policy == FLUSH_ON_ERROR && level >= LOG_LEVEL_ERROR)) {
+        flush();
+        return;
+    }
+    // 刚好超过写出阈值时叫醒刷写线程，之后的日志不再重复通知
+    long threshold = flush_threshold(ring);
+    if (used >= threshold && used - length < threshold)
+        m_flush_event.notify_one();
+}
 
-    m_mutex.unlock();
-
-    // 如果此调用来自用户程序，则为用户定义标准宏。
-    va_list args;
-    va_start(args, format);
+/**
+ * 缓冲区积累到多少时写出
+ * 不管哪种策略，超过一半时都写出，避免写日志的线程因为缓冲区满而等待
+ */
+long Log::flush_threshold(const LogRing *ring) const {
+    long half = ring->capacity() / 2;
+    return m_flush_policy == FLUSH_SIZE && LOG_FLUSH_SIZE < half ? LOG_FLUSH_SIZE : half;
+}
 
-    std::string log_str;
-    m_mutex.lock();
-    /**
-     * 2000-01-01 00:00:00.123456 [debug]
-     */
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    // PrintFError ("Error opening '%s'",szFileName);
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, args);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
-
-    m_mutex.unlock();
-    /**
-     * 异步写入、但是队列未满，将 log 字符串压入队列
-     */
-    if (m_is_async && !m_log_queue->full()) {
-        m_log_queue->push(log_str);
+int Log::register_format(int level, const char *format) {
+    m_format_mutex.lock();
+    int id = m_format_count.load(std::memory_order_relaxed);
+    if (id < LOG_FORMAT_NUMBER) {
+        m_formats[id].format = format;
+        m_formats[id].level = level;
+        // 写日志的线程之后放入缓冲区的记录由 release 发布，刷写线程取出记录时一定能看到这个格式串
+        m_format_count.store(id + 1, std::memory_order_release);
     } else {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        id = -1;
     }
-    va_end(args);
+    m_format_mutex.unlock();
+    return id;
 }
 
 void Log::flush() {
-    m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
-    m_mutex.unlock();
-}
\ No newline at end of file
+    // 已经请求过的不再通知，连续调用只有第一次可能进入内核
+    if (!m_flush_requested.load(std::memory_order_relaxed) && !m_flush_requested.exchange(true))
+        m_flush_event.notify_one();
+}
+
+/**
+ * 取得当前线程的环形缓冲区，第一次写日志时从已经退出的线程留下的缓冲区中领取，没有时新建并登记
+ */
+LogRing *Log::local_ring() {
+    if (local_holder.ring)
+        return local_holder.ring;
+    for (LogRing *ring = m_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        bool expected = false;
+        if (!ring->in_use.load(std::memory_order_relaxed) && ring->in_use.compare_exchange_strong(expected, true))
+            return local_holder.ring = ring;
+    }
+    LogRing *ring;
+    try {
+        ring = new LogRing(m_ring_size, m_log_buf_size);
+    } catch (...) {
+        return nullptr;
+    }
+    ring->in_use.store(true, std::memory_order_relaxed);
+    ring->next = m_rings.load(std::memory_order_relaxed);
+    while (!m_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed));
+    return local_holder.ring = ring;
+}
+
+/**
+ * 缓冲区放不下时叫醒刷写线程并等待，直到腾出空间
+ * @return 刷写线程已经停止时返回 false，这条日志丢弃
+ */
+bool Log::wait_space(LogRing *ring, long length) {
+    while (ring->free_space() < length) {
+        unsigned key = m_space_event.prepare_wait();
+        flush();
+        if (ring->free_space() >= length || !m_running.load()) {
+            m_space_event.cancel_wait();
+            if (!m_running.load())
+                return false;
+            continue;
+        }
+        m_space_event.wait(key);
+    }
+    return true;
+}
+
+void *Log::flush_log_thread(void *args) {
+    ((Log *) args)->run();
+    return nullptr;
+}
+
+/**
+ * 刷写线程
+ * interval 策略等待一个刷写间隔，其它策略一直等待；有缓冲区超过阈值或者有线程调用 flush 时提前醒来，
+ * 然后一次写出所有缓冲区
+ */
+void Log::run() {
+    while (m_running.load()) {
+        unsigned key = m_flush_event.prepare_wait();
+        if (should_write() || !m_running.load())
+            m_flush_event.cancel_wait();
+        else if (m_flush_policy == FLUSH_INTERVAL)
+            m_flush_event.wait_for(key, LOG_FLUSH_INTERVAL_MS);
+        else
+            m_flush_event.wait(key);
+        m_flush_requested.store(false);
+        write_batch();
+        m_space_event.notify_all();
+    }
+    // 停止之前写出剩余的日志
+    write_batch();
+    m_space_event.notify_all();
+}
+
+bool Log::should_write() const {
+    if (m_flush_requested.load())
+        return true;
+    for (LogRing *ring = m_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        if (ring->used() >= flush_threshold(ring))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * 写出所有缓冲区中的日志，写入之前按日期切换文件，写入之后按行数切分文件
+ * 上一批之后有丢弃的日志时，在这一批的最后记一行丢弃的条数
+ */
+void Log::write_batch() {
+    CoarseClock::DateCache date{};
+    CoarseClock::get_instance()->read(date);
+    if (date.sec != 0 && m_today != date.mday && open_file(date.year, date.mon, date.mday, 0)) {
+        m_today = date.mday;
+        m_count = 0;
+        m_part = 0;
+    }
+
+    if (m_mode == LOG_MODE_TEXT)
+        write_rings();
+    else
+        write_records();
+    write_dropped();
+
+    long long part = m_count / m_split_lines;
+    if (part != m_part && open_file(date.year, date.mon, date.mday, part))
+        m_part = part;
+}
+
+/**
+ * 文本模式：收集所有缓冲区中的日志一次 writev 写入文件，写完之后释放缓冲区的空间
+ */
+void Log::write_rings() {
+    struct iovec iov[2 * WRITE_RING_NUMBER];
+    LogRing *rings[WRITE_RING_NUMBER];
+    long lengths[WRITE_RING_NUMBER];
+    int ring_count = 0;
+    int iov_count = 0;
+    LogRing *ring = m_rings.load(std::memory_order_acquire);
+    while (ring || ring_count > 0) {
+        if (ring) {
+            long length;
+            int count = ring->peek(iov + iov_count, length);
+            if (count > 0) {
+                iov_count += count;
+                rings[ring_count] = ring;
+                lengths[ring_count++] = length;
+            }
+            ring = ring->next;
+            if (ring && ring_count < WRITE_RING_NUMBER)
+                continue;
+        }
+        if (ring_count == 0)
+            continue;
+        count_lines(iov, iov_count);
+        write_all(iov, iov_count);
+        for (int i = 0; i < ring_count; ++i) {
+            rings[i]->consume(lengths[i]);
+        }
+        ring_count = 0;
+        iov_count = 0;
+    }
+}
+
+/**
+ * 延迟格式化与二进制模式：逐条取出记录，格式化成文本或者原样拷贝到输出缓冲区，
+ * 拷贝之后就释放缓冲区的空间，输出缓冲区满时写入文件
+ */
+void Log::write_records() {
+    for (LogRing *ring = m_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        long length = ring->used();
+        long pos = 0;
+        LogRecord record{};
+        while (pos + (long) sizeof record <= length) {
+            ring->read(pos, &record, sizeof record);
+            // 记录由写日志的线程在一行日志的缓冲区中编码，长度不会超出
+            if (record.length < sizeof record || record.length > (uint32_t) m_log_buf_size)
+                break;
+            ring->read(pos, m_record, record.length);
+            pos += record.length;
+            ++m_count;
+            const char *payload = m_record + sizeof record;
+            long payload_length = record.length - sizeof record;
+
+            if (m_mode == LOG_MODE_BINARY) {
+                if (record.type == LOG_RECORD_EVENT && record.format_id >= (uint32_t) m_formats_written)
+                    write_formats(record.format_id);
+                if (reserve_out((int) record.length)) {
+                    memcpy(m_out + m_out_idx, m_record, record.length);
+                    m_out_idx += (int) record.length;
+                }
+                continue;
+            }
+
+            // 与文本模式相同：整行（包括换行）不超过 m_log_buf_size
+            if (!reserve_out(m_log_buf_size))
+                continue;
+            char *line = m_out + m_out_idx;
+            int n = log_format_prefix(line, m_log_buf_size, record.time_ms, record.level);
+            int m;
+            if (record.type == LOG_RECORD_EVENT) {
+                m = log_format_args(line + n, m_log_buf_size - n, m_formats[record.format_id].format, payload,
+                                    payload_length);
+            } else {
+                m = payload_length < m_log_buf_size - n - 1 ? (int) payload_length : m_log_buf_size - n - 1;
+                memcpy(line + n, payload, m);
+            }
+            line[n + m] = '\n';
+            m_out_idx += n + m + 1;
+        }
+        ring->consume(length);
+    }
+    flush_out();
+}
+
+/**
+ * 二进制模式：把编号不超过 id 的格式串中还没有写入当前文件的写入
+ */
+void Log::write_formats(unsigned id) {
+    int count = m_format_count.load(std::memory_order_acquire);
+    while (m_formats_written < count && (unsigned) m_formats_written <= id) {
+        const FormatEntry &entry = m_formats[m_formats_written];
+        long length = (long) strlen(entry.format);
+        if (length > m_log_buf_size - (long) sizeof(LogRecord))
+            length = m_log_buf_size - (long) sizeof(LogRecord);
+        LogRecord record{};
+        record.length = (uint32_t) (sizeof record + length);
+        record.type = LOG_RECORD_FORMAT;
+        record.level = (uint16_t) entry.level;
+        record.format_id = (uint32_t) m_formats_written;
+        if (!reserve_out((int) record.length))
+            return;
+        memcpy(m_out + m_out_idx, &record, sizeof record);
+        memcpy(m_out + m_out_idx + sizeof record, entry.format, length);
+        m_out_idx += (int) record.length;
+        ++m_formats_written;
+    }
+}
+
+/**
+ * 把上一次之后丢弃的日志条数作为一条 WARN 日志写入文件，二进制模式写成文本记录
+ */
+void Log::write_dropped() {
+    unsigned long long dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped == m_dropped_reported)
+        return;
+    char text[64];
+    int m = snprintf(text, sizeof text, "%llu log lines dropped, buffer full", dropped - m_dropped_reported);
+    m_dropped_reported = dropped;
+
+    char line[sizeof(LogRecord) + 128];
+    int64_t now = CoarseClock::get_instance()->wall_ms();
+    int n;
+    if (m_mode == LOG_MODE_BINARY) {
+        LogRecord record{};
+        record.length = (uint32_t) (sizeof record + m);
+        record.type = LOG_RECORD_TEXT;
+        record.level = LOG_LEVEL_WARN;
+        record.time_ms = now;
+        memcpy(line, &record, sizeof record);
+        memcpy(line + sizeof record, text, m);
+        n = (int) record.length;
+    } else {
+        n = log_format_prefix(line, sizeof line, now, LOG_LEVEL_WARN);
+        memcpy(line + n, text, m);
+        line[n + m] = '\n';
+        n += m + 1;
+    }
+    struct iovec iov{line, (size_t) n};
+    write_all(&iov, 1);
+    ++m_count;
+}
+
+// 输出缓冲区放不下时先写出
+bool Log::reserve_out(int length) {
+    if (m_out_idx + length > m_out_size)
+        flush_out();
+    return m_out_idx + length <= m_out_size;
+}
+
+void Log::flush_out() {
+    if (m_out_idx == 0)
+        return;
+    struct iovec iov{m_out, (size_t) m_out_idx};
+    write_all(&iov, 1);
+    m_out_idx = 0;
+}
+
+// 写入失败（比如磁盘满）时丢弃这一批日志，不让写日志的线程一直等待
+void Log::write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(m_fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        // 跳过已经写完的段
+        while (count > 0 && (size_t) n >= iov->iov_len) {
+            n -= (ssize_t) iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+void Log::count_lines(const struct iovec *iov, int count) {
+    for (int i = 0; i < count; ++i) {
+        const char *p = (const char *) iov[i].iov_base;
+        const char *end = p + iov[i].iov_len;
+        while ((p = (const char *) memchr(p, '\n', end - p)) != nullptr) {
+            ++m_count;
+            ++p;
+        }
+    }
+}
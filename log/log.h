@@ -12,11 +12,78 @@
 #define MYTINYWEBSERVER_LOG_H
 
 
-#include <cstdio>
-#include <string>
-#include "block_queue.h"
+#include <pthread.h>
+#include <atomic>
+#include "log_ring.h"
+#include "log_format.h"
+#include "../lock/Locker.h"
+#include "../config/config.h"
+#include "../timer/coarse_clock.h"
 
+/**
+ * 日志模式
+ */
+enum LOG_MODE {
+    LOG_MODE_TEXT = 0,      // 写日志的线程格式化成文本
+    LOG_MODE_DEFERRED,      // 写日志的线程只记录参数，刷写线程格式化成文本
+    LOG_MODE_BINARY         // 写日志的线程只记录参数，刷写线程原样写入二进制文件，用 log_decode 解码
+};
+
+// 按名字（text、deferred、binary）取日志模式，不认识的名字返回 -1
+int log_mode_of(const char *name);
+
+/**
+ * 日志等级
+ */
+enum LOG_LEVEL {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR
+};
+
+// 按名字（debug、info、warn、error）取日志等级，不认识的名字返回 -1
+int log_level_of(const char *name);
+
+const char *log_level_name(int level);
+
+/**
+ * 写出策略，决定刷写线程什么时候把缓冲区中的日志写入文件
+ * 不管哪种策略，某个线程的缓冲区超过一半、调用 flush 以及进程退出时都会写出
+ */
+enum LOG_FLUSH_POLICY {
+    FLUSH_IMMEDIATE = 0,    // 每条日志都叫醒刷写线程，尽快写出
+    FLUSH_INTERVAL,         // 每隔 LOG_FLUSH_INTERVAL_MS 写出一次
+    FLUSH_SIZE,             // 某个线程的缓冲区积累到 LOG_FLUSH_SIZE 时写出
+    FLUSH_ON_ERROR          // 只在记录 ERROR 日志时写出，之前积累的日志一起写出
+};
+
+// 按名字（immediate、interval、size、error）取写出策略，不认识的名字返回 -1
+int log_flush_policy_of(const char *name);
+
+/**
+ * 缓冲区满时的处理
+ */
+enum LOG_FULL_POLICY {
+    FULL_BLOCK = 0,         // 等待刷写线程腾出空间，不丢日志，写日志的线程可能被磁盘拖慢
+    FULL_DROP               // 丢弃这条日志并计数，写日志的线程不等待，丢弃的条数由刷写线程记入日志
+};
 
+// 按名字（block、drop）取缓冲区满时的处理，不认识的名字返回 -1
+int log_full_policy_of(const char *name);
+
+
+/**
+ * 日志
+ * 每个线程把日志行格式化到自己的环形缓冲区（LogRing）中，不加锁，也不分配内存；
+ * 一个后台刷写线程收集所有线程的缓冲区，一次 writev 写入日志文件（group commit）。
+ * 刷写线程按写出策略（LOG_FLUSH_POLICY）写出，调用处不需要自己刷新。
+ * 同一个线程的日志保持顺序，不同线程的日志按批次交错。
+ * 只有刷写线程操作日志文件，按天与按行数切分文件也在刷写线程中进行。
+ *
+ * 延迟格式化与二进制模式下缓冲区中是 LogRecord 记录，调用处的格式串第一次使用时登记一个编号，
+ * 之后每次调用只编码编号、时间与参数，不调用 vsnprintf。
+ */
 class Log {
 private:
     static const int LOG_FILE_NAME_LENGTH = 128;
@@ -24,35 +91,81 @@ private:
     char m_log_name[LOG_FILE_NAME_LENGTH];    //log文件名
 
     int m_split_lines;  //日志最大行数
-    int m_log_buf_size; //日志缓冲区大小
+    int m_log_buf_size; //一行日志的最大长度
+    long m_ring_size;   //每个线程环形缓冲区的大小
     long long m_count;  //日志行数记录
+    long long m_part;   //当天按行数切分的第几个文件
     int m_today;        //因为按天分类,记录当前时间是那一天
-    FILE *m_fp;         //打开log的文件指针
-    char *m_buf;
+    int m_fd;           //日志文件，只由刷写线程写入
+    int m_mode;         //日志模式，LOG_MODE
+    int m_flush_policy; //写出策略，LOG_FLUSH_POLICY
+    int m_full_policy;  //缓冲区满时的处理，LOG_FULL_POLICY
 
-    BlockQueue<std::string> *m_log_queue;   // 阻塞队列，内部是循环队列
-    bool m_is_async;                        //是否同步标志位
-    Locker m_mutex;
+    /**
+     * 登记的格式串，编号是下标，只增加不删除
+     */
+    struct FormatEntry {
+        const char *format;
+        int level;
+    };
+    FormatEntry m_formats[LOG_FORMAT_NUMBER];
+    std::atomic<int> m_format_count;
+    Locker m_format_mutex;
+    int m_formats_written;  //当前文件中已经写入的格式串个数，二进制模式使用
+    char *m_record;         //刷写线程取出一条记录的缓冲区
+    char *m_out;            //刷写线程格式化或者拷贝记录的输出缓冲区
+    int m_out_size;
+    int m_out_idx;
+
+    std::atomic<LogRing *> m_rings;         // 所有线程的环形缓冲区
+    std::atomic<bool> m_running;            // 刷写线程是否在运行，停止之后的日志直接丢弃
+    std::atomic<bool> m_flush_requested;    // 有线程调用了 flush，刷写线程尽快写一次
+    std::atomic<unsigned long long> m_dropped;  // 缓冲区满而丢弃的日志条数
+    unsigned long long m_dropped_reported;      // 已经记入日志的丢弃条数，只由刷写线程使用
+    EventCount m_flush_event;   // 刷写线程在这里等待下一次写入
+    EventCount m_space_event;   // 缓冲区满的线程在这里等待刷写线程腾出空间
+    pthread_t m_thread;
 
 private:
     Log();
 
     virtual ~Log();
 
-    /**
-     * 异步写日志，内联函数
-     */
-    void *async_write_log() {
-        std::string single_log;
-        /**
-         * 当队列不为空的时候，从队列中取出并写入文件描述符
-         */
-        while (m_log_queue->pop(single_log)) {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    static std::atomic<int> m_level;    // 运行时的日志等级，低于它的日志在宏中就被跳过
+
+    static void *flush_log_thread(void *args);
+
+    void run();
+
+    bool should_write() const;
+
+    long flush_threshold(const LogRing *ring) const;
+
+    void write_batch();
+
+    void write_rings();
+
+    void write_records();
+
+    bool reserve_out(int length);
+
+    void flush_out();
+
+    void write_formats(unsigned id);
+
+    void write_dropped();
+
+    void write_all(struct iovec *iov, int count);
+
+    void count_lines(const struct iovec *iov, int count);
+
+    bool open_file(int year, int mon, int mday, long long part);
+
+    LogRing *local_ring();
+
+    bool wait_space(LogRing *ring, long length);
+
+    void append(LogRing *ring, const char *data, long length, int level);
 
 public:
     /**
@@ -64,35 +177,93 @@ public:
         return &instance;
     }
 
-    /**
-     * 异步写日志函数
-     * @param args 函数参数
-     * @return
-     */
-    static void *flush_log_thread(void *args) {
-        Log::get_instance()->async_write_log();
-    }
+    // 这个等级的日志是否需要记录，LOG_* 宏在求值参数之前检查
+    static bool enabled(int level) { return level >= m_level.load(std::memory_order_relaxed); }
+
+    static int level() { return m_level.load(std::memory_order_relaxed); }
+
+    // 设置运行时的日志等级，超出范围的截断到 DEBUG 与 ERROR 之间，可以在任意线程中调用
+    static void set_level(int level);
 
     /**
-     * 可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
+     * 可选择的参数有日志文件、一行日志的最大长度、最大行数以及每个线程环形缓冲区的大小
      * @param file_name 日志文件名
-     * @param log_buf_size 日志缓冲区大小
+     * @param log_buf_size 一行日志的最大长度，超出的部分截断
      * @param split_lines 最大行数
-     * @param max_queue_size 最长日志条队列
+     * @param ring_size 每个线程环形缓冲区的大小，向上取整到 2 的幂
+     * @param mode 日志模式，二进制模式的文件名加上 .bin
+     * @param flush_policy 写出策略
+     * @param full_policy 缓冲区满时的处理
      * @return
      */
     bool init(const char *file_name, int log_buf_size = LOG_BUFF_SIZE, int split_lines = LOG_SPLIT_LINES,
-              int max_queue_size = LOG_MAX_QUEUE_SIZE);
+              long ring_size = LOG_RING_SIZE, int mode = LOG_MODE_TEXT, int flush_policy = FLUSH_INTERVAL,
+              int full_policy = FULL_BLOCK);
+
+    /**
+     * 登记调用处的格式串，由 LOG_* 宏在每个调用处第一次执行时调用一次
+     * @return 格式串编号，登记满了返回 -1，这个调用处之后按文本模式记录
+     */
+    int register_format(int level, const char *format);
 
     void write_log(int level, const char *format, ...);
 
+    /**
+     * LOG_* 宏的入口
+     * 文本模式与没有编号的调用处格式化成文本；否则只把编号、时间与参数编码成一条记录
+     */
+    template<typename... Args>
+    void log(int format_id, int level, const char *format, Args... args) {
+        if (m_mode == LOG_MODE_TEXT || format_id < 0) {
+            write_log(level, format, args...);
+            return;
+        }
+        if (!m_running.load(std::memory_order_relaxed))
+            return;
+        LogRing *ring = local_ring();
+        if (!ring)
+            return;
+        char *buf = ring->line();
+        char *end = log_put_args(buf + sizeof(LogRecord), buf + ring->line_size(), args...);
+        if (!end) {
+            // 参数太长，格式化成文本，超长的部分截断
+            write_log(level, format, args...);
+            return;
+        }
+        LogRecord record{};
+        record.length = (uint32_t) (end - buf);
+        record.type = LOG_RECORD_EVENT;
+        record.level = (uint16_t) level;
+        record.format_id = (uint32_t) format_id;
+        record.time_ms = CoarseClock::get_instance()->wall_ms();
+        memcpy(buf, &record, sizeof record);
+        append(ring, buf, record.length, level);
+    }
+
+    // 请求刷写线程尽快把已经记录的日志写入文件，不等待写入完成，一般不需要调用，由写出策略决定
     void flush();
 
+    // 缓冲区满而丢弃的日志条数（drop 策略）
+    unsigned long long dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
 };
 
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
+/**
+ * 每个调用处有自己的格式串编号，第一次执行时登记，format 必须是字符串常量
+ * 先比较编译期的等级下限（常量，低于下限的调用整个被编译器去掉），再比较运行时的等级，
+ * 不需要记录的日志不会求值参数，也不会进入 Log
+ */
+#define LOG_BASE(level, format, ...) \
+    do { \
+        if ((level) >= LOG_LEVEL_FLOOR && Log::enabled(level)) { \
+            static const int log_format_id = Log::get_instance()->register_format(level, "" format); \
+            Log::get_instance()->log(log_format_id, level, format, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(format, ...) LOG_BASE(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
 
 #endif //MYTINYWEBSERVER_LOG_H
@@ -0,0 +1,93 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/28 16:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "log_format.h"
+
+/**
+ * 二进制日志解码工具，把二进制模式写入的日志文件还原成与文本模式相同的日志行
+ * 用法：log_decode 日志文件...，结果输出到标准输出
+ */
+
+static const int LINE_SIZE = 8192;
+
+static bool decode(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    char magic[sizeof LOG_BINARY_MAGIC];
+    if (fread(magic, 1, sizeof magic, fp) != sizeof magic || memcmp(magic, LOG_BINARY_MAGIC, sizeof magic) != 0) {
+        fprintf(stderr, "%s: not a binary log file\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    // 格式串按编号保存，同一个文件中进程重启之后会重新定义
+    std::vector<std::string> formats;
+    std::vector<char> payload;
+    char line[LINE_SIZE];
+    LogRecord record{};
+    bool ok = true;
+    while (fread(&record, 1, sizeof record, fp) == sizeof record) {
+        if (record.length < sizeof record) {
+            fprintf(stderr, "%s: corrupted record\n", path);
+            ok = false;
+            break;
+        }
+        payload.resize(record.length - sizeof record + 1);
+        if (fread(payload.data(), 1, record.length - sizeof record, fp) != record.length - sizeof record) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            ok = false;
+            break;
+        }
+        long length = (long) (record.length - sizeof record);
+        if (record.type == LOG_RECORD_FORMAT) {
+            if (formats.size() <= record.format_id)
+                formats.resize(record.format_id + 1);
+            formats[record.format_id].assign(payload.data(), length);
+            continue;
+        }
+
+        int n = log_format_prefix(line, LINE_SIZE, record.time_ms, record.level);
+        int m;
+        if (record.type == LOG_RECORD_EVENT) {
+            if (record.format_id >= formats.size()) {
+                m = snprintf(line + n, LINE_SIZE - n, "(unknown format %u)", record.format_id);
+            } else {
+                m = log_format_args(line + n, LINE_SIZE - n, formats[record.format_id].c_str(), payload.data(),
+                                    length);
+            }
+        } else {
+            m = length < LINE_SIZE - n - 1 ? (int) length : LINE_SIZE - n - 1;
+            memcpy(line + n, payload.data(), m);
+        }
+        line[n + m] = '\n';
+        fwrite(line, 1, n + m + 1, stdout);
+    }
+    fclose(fp);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s binary_log_file...\n", argv[0]);
+        return 1;
+    }
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        ok = decode(argv[i]) && ok;
+    }
+    return ok ? 0 : 1;
+}
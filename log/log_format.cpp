@@ -0,0 +1,200 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/28 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstdio>
+#include <ctime>
+#include "log_format.h"
+
+static const char *const LEVEL_TAGS[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+
+const char *log_level_tag(int level) {
+    return (level >= 0 && level <= 3) ? LEVEL_TAGS[level] : LEVEL_TAGS[1];
+}
+
+/**
+ * 编码后的参数的读取游标，读完或者数据不完整时返回失败
+ */
+struct ArgReader {
+    const char *p;
+    const char *end;
+
+    bool next(char &type, int64_t &value, const char *&text, uint32_t &length) {
+        if (end - p < 1)
+            return false;
+        type = *p;
+        if (type == LOG_ARG_STRING) {
+            if (end - p < 5)
+                return false;
+            memcpy(&length, p + 1, 4);
+            if ((uint32_t) (end - p - 5) < length)
+                return false;
+            text = p + 5;
+            p += 5 + length;
+            return true;
+        }
+        if (end - p < 9)
+            return false;
+        memcpy(&value, p + 1, 8);
+        p += 9;
+        return true;
+    }
+
+    // 取 * 宽度或精度
+    int next_int() {
+        char type;
+        int64_t value = 0;
+        const char *text;
+        uint32_t length;
+        if (!next(type, value, text, length) || type == LOG_ARG_STRING || type == LOG_ARG_DOUBLE)
+            return 0;
+        return (int) value;
+    }
+};
+
+int log_format_args(char *out, int size, const char *format, const char *args, long args_length) {
+    if (size <= 0)
+        return 0;
+    ArgReader reader{args, args + args_length};
+    int n = 0;
+    const char *f = format;
+    while (*f && n < size - 1) {
+        if (*f != '%') {
+            out[n++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[n++] = '%';
+            f += 2;
+            continue;
+        }
+
+        /**
+         * 解析一个转换说明：%[flags][width][.precision][length]conversion
+         * 宽度与精度是 * 时从参数中取，长度修饰符丢弃，按参数实际的类型重新生成
+         */
+        const char *start = f++;
+        char spec[32] = "%";
+        int spec_len = 1;
+        while (*f && strchr("-+ #0'", *f) && spec_len < 8)
+            spec[spec_len++] = *f++;
+        int width = -1;
+        if (*f == '*') {
+            width = reader.next_int();
+            ++f;
+        } else if (*f >= '0' && *f <= '9') {
+            width = 0;
+            while (*f >= '0' && *f <= '9')
+                width = width * 10 + (*f++ - '0');
+        }
+        int precision = -1;
+        if (*f == '.') {
+            ++f;
+            precision = 0;
+            if (*f == '*') {
+                precision = reader.next_int();
+                ++f;
+            } else {
+                while (*f >= '0' && *f <= '9')
+                    precision = precision * 10 + (*f++ - '0');
+            }
+        }
+        while (*f && strchr("hlLqjzt", *f))
+            ++f;
+        char conversion = *f;
+        if (!conversion) {
+            // 不完整的转换说明原样输出
+            f = start;
+            while (*f && n < size - 1)
+                out[n++] = *f++;
+            break;
+        }
+        ++f;
+        if (width >= 0)
+            spec_len += snprintf(spec + spec_len, sizeof spec - spec_len, "%d", width);
+        if (precision >= 0)
+            spec_len += snprintf(spec + spec_len, sizeof spec - spec_len, ".%d", precision);
+
+        char type;
+        int64_t value = 0;
+        const char *text = nullptr;
+        uint32_t length = 0;
+        if (!reader.next(type, value, text, length)) {
+            // 参数比转换说明少，不再继续
+            break;
+        }
+        int room = size - n;
+        int written = 0;
+        if (type == LOG_ARG_STRING) {
+            // 字符串没有结尾的 \0，用精度限制长度；不管转换说明符是什么都按字符串输出
+            int limit = (precision >= 0 && (uint32_t) precision < length) ? precision : (int) length;
+            char string_spec[32];
+            memcpy(string_spec, spec, spec_len);
+            // 去掉已经写入的精度，改用 .*
+            char *dot = (char *) memchr(string_spec, '.', spec_len);
+            int len = dot ? (int) (dot - string_spec) : spec_len;
+            memcpy(string_spec + len, ".*s", 4);
+            written = snprintf(out + n, room, string_spec, limit, text);
+        } else if (type == LOG_ARG_DOUBLE) {
+            double d;
+            memcpy(&d, &value, 8);
+            if (!strchr("fFeEgGaA", conversion))
+                conversion = 'g';
+            spec[spec_len] = conversion;
+            spec[spec_len + 1] = '\0';
+            written = snprintf(out + n, room, spec, d);
+        } else if (conversion == 'p' || type == LOG_ARG_POINTER) {
+            spec[spec_len] = 'p';
+            spec[spec_len + 1] = '\0';
+            written = snprintf(out + n, room, spec, (void *) (uintptr_t) value);
+        } else if (conversion == 'c') {
+            spec[spec_len] = 'c';
+            spec[spec_len + 1] = '\0';
+            written = snprintf(out + n, room, spec, (int) value);
+        } else if (strchr("fFeEgGaA", conversion)) {
+            spec[spec_len] = conversion;
+            spec[spec_len + 1] = '\0';
+            written = snprintf(out + n, room, spec, (double) value);
+        } else {
+            if (!strchr("diuoxX", conversion))
+                conversion = type == LOG_ARG_UINT ? 'u' : 'd';
+            memcpy(spec + spec_len, "ll", 2);
+            spec[spec_len + 2] = conversion;
+            spec[spec_len + 3] = '\0';
+            if (conversion == 'd' || conversion == 'i')
+                written = snprintf(out + n, room, spec, (long long) value);
+            else
+                written = snprintf(out + n, room, spec, (unsigned long long) value);
+        }
+        if (written < 0)
+            written = 0;
+        n += written < room ? written : room - 1;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+int log_format_prefix(char *out, int size, int64_t time_ms, int level) {
+    /**
+     * 刷写线程与解码工具按顺序处理记录，相邻的记录通常在同一秒，缓存上一次的日期字符串
+     */
+    static thread_local time_t last_sec = -1;
+    // 按 int 的最大宽度准备，解码工具遇到损坏的时间戳时年份可能不止四位
+    static thread_local char date[80];
+    time_t sec = (time_t) (time_ms / 1000);
+    if (sec != last_sec) {
+        struct tm tm{};
+        localtime_r(&sec, &tm);
+        snprintf(date, sizeof date, "%d-%02d-%02d %02d:%02d:%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+                 tm.tm_hour, tm.tm_min, tm.tm_sec);
+        last_sec = sec;
+    }
+    int n = snprintf(out, size, "%s.%03d %s ", date, (int) (time_ms % 1000), log_level_tag(level));
+    return n < size ? n : size - 1;
+}
@@ -0,0 +1,134 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/28 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_LOG_FORMAT_H
+#define MYTINYWEBSERVER_LOG_FORMAT_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * 日志的记录格式
+ * 延迟格式化与二进制模式下，写日志的线程不格式化，只把格式串的编号、时间与原始的参数值
+ * 编码成一条记录放入自己的环形缓冲区。延迟格式化模式由刷写线程把记录格式化成文本日志，
+ * 二进制模式把记录原样写入文件，之后用 log_decode 离线解码。
+ *
+ * 二进制日志文件以 LOG_BINARY_MAGIC 开头，之后是一条条记录。格式串在第一次被使用之前
+ * 以 LOG_RECORD_FORMAT 记录写入文件，每个文件都包含自己用到的全部格式串。
+ */
+
+static const char LOG_BINARY_MAGIC[8] = {'T', 'W', 'S', 'L', 'O', 'G', '1', '\n'};
+
+enum LOG_RECORD_TYPE {
+    LOG_RECORD_FORMAT = 1,      // 格式串定义，内容是格式串（不含 \0）
+    LOG_RECORD_EVENT,           // 一次日志调用，内容是编码后的参数
+    LOG_RECORD_TEXT             // 已经格式化好的日志内容（不含时间与换行），用于没有登记格式串的调用
+};
+
+// 参数的类型标记，每个参数一个字节的标记加上参数值
+enum LOG_ARG_TYPE {
+    LOG_ARG_INT = 'i',          // 8 字节有符号整数
+    LOG_ARG_UINT = 'u',         // 8 字节无符号整数
+    LOG_ARG_DOUBLE = 'd',       // 8 字节浮点数
+    LOG_ARG_STRING = 's',       // 4 字节长度加字符串内容，字符串在记录时拷贝
+    LOG_ARG_POINTER = 'p'       // 8 字节指针值
+};
+
+struct LogRecord {
+    uint32_t length;        // 整条记录的长度，包括记录头
+    uint16_t type;          // LOG_RECORD_TYPE
+    uint16_t level;         // 日志等级
+    uint32_t format_id;     // 格式串编号
+    uint32_t reserved;
+    int64_t time_ms;        // 墙上时间，毫秒
+};
+
+/**
+ * 按参数的类型编码一个参数，空间不够时返回 nullptr
+ */
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, char *>::type
+log_put_arg(char *p, char *end, T value) {
+    if (end - p < 9)
+        return nullptr;
+    *p = std::is_signed<T>::value || std::is_enum<T>::value ? LOG_ARG_INT : LOG_ARG_UINT;
+    int64_t v = (int64_t) value;
+    memcpy(p + 1, &v, 8);
+    return p + 9;
+}
+
+template<typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value, char *>::type
+log_put_arg(char *p, char *end, T value) {
+    if (end - p < 9)
+        return nullptr;
+    *p = LOG_ARG_DOUBLE;
+    double v = value;
+    memcpy(p + 1, &v, 8);
+    return p + 9;
+}
+
+template<typename T>
+inline char *log_put_arg(char *p, char *end, T *value) {
+    if (end - p < 9)
+        return nullptr;
+    *p = LOG_ARG_POINTER;
+    uint64_t v = (uint64_t) (uintptr_t) value;
+    memcpy(p + 1, &v, 8);
+    return p + 9;
+}
+
+// 字符串在记录时拷贝，之后原来的内存可能已经被修改或者释放
+inline char *log_put_arg(char *p, char *end, const char *value) {
+    if (!value)
+        value = "(null)";
+    size_t length = strlen(value);
+    if (end - p < 5 + (long) length)
+        return nullptr;
+    *p = LOG_ARG_STRING;
+    uint32_t n = (uint32_t) length;
+    memcpy(p + 1, &n, 4);
+    memcpy(p + 5, value, length);
+    return p + 5 + length;
+}
+
+inline char *log_put_arg(char *p, char *end, char *value) {
+    return log_put_arg(p, end, (const char *) value);
+}
+
+inline char *log_put_args(char *p, char *) {
+    return p;
+}
+
+/**
+ * 依次编码所有参数
+ * @return 编码结束的位置，空间不够时返回 nullptr
+ */
+template<typename T, typename... Rest>
+inline char *log_put_args(char *p, char *end, T value, Rest... rest) {
+    p = log_put_arg(p, end, value);
+    return p ? log_put_args(p, end, rest...) : nullptr;
+}
+
+/**
+ * 用编码后的参数格式化格式串，相当于 vsnprintf
+ * 参数按类型标记取出，与转换说明符不一致时尽量输出，不会越界读取
+ * @return 写入的长度，不超过 size - 1，结尾有 \0
+ */
+int log_format_args(char *out, int size, const char *format, const char *args, long args_length);
+
+// 日志等级在日志行中的标记，"[info]:" 等
+const char *log_level_tag(int level);
+
+// 日志行的时间前缀 "2000-01-01 00:00:00.123 [info]: "，返回写入的长度
+int log_format_prefix(char *out, int size, int64_t time_ms, int level);
+
+#endif //MYTINYWEBSERVER_LOG_FORMAT_H
@@ -0,0 +1,146 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/28 09:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_LOG_RING_H
+#define MYTINYWEBSERVER_LOG_RING_H
+
+#include <sys/uio.h>
+#include <atomic>
+#include <cstring>
+#include <exception>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/**
+ * 一个线程的日志环形缓冲区，单生产者单消费者
+ * 生产者是所属的线程，把格式化好的日志行追加到缓冲区；消费者是后台刷写线程，
+ * 直接用缓冲区中的内存 writev 到日志文件，写完之后才释放空间，日志不需要额外拷贝。
+ * 读写游标单调递增，取模得到缓冲区中的位置，两个游标各占一个缓存行。
+ */
+class LogRing {
+public:
+    /**
+     * @param size 缓冲区大小，必须是 2 的幂
+     * @param line_size 格式化一行日志的缓冲区大小，即一行日志的最大长度
+     */
+    LogRing(long size, int line_size) : in_use(false), next(nullptr), m_data(nullptr), m_line(nullptr),
+                                        m_line_size(line_size), m_mask(size - 1), m_pad0(), m_head(0), m_pad1(),
+                                        m_tail(0), m_pad2() {
+        if (size <= 0 || (size & (size - 1)) != 0 || line_size <= 0 || line_size > size)
+            throw std::exception();
+        m_data = new char[size];
+        m_line = new char[line_size];
+    }
+
+    ~LogRing() {
+        delete[] m_data;
+        delete[] m_line;
+    }
+
+    LogRing(const LogRing &) = delete;
+
+    LogRing &operator=(const LogRing &) = delete;
+
+    long capacity() const { return (long) m_mask + 1; }
+
+    // 所属线程格式化日志行的缓冲区
+    char *line() { return m_line; }
+
+    int line_size() const { return m_line_size; }
+
+    // 生产者：剩余空间
+    long free_space() const {
+        return capacity() - (long) (m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_acquire));
+    }
+
+    /**
+     * 生产者：追加一段数据，调用者先确认空间足够
+     * @return 追加之后缓冲区中等待写出的字节数
+     */
+    long write(const char *data, long length) {
+        unsigned long head = m_head.load(std::memory_order_relaxed);
+        size_t index = head & m_mask;
+        size_t first = capacity() - index;
+        if (first >= (size_t) length) {
+            memcpy(m_data + index, data, length);
+        } else {
+            // 绕回缓冲区开头
+            memcpy(m_data + index, data, first);
+            memcpy(m_data, data + first, length - first);
+        }
+        m_head.store(head + length, std::memory_order_release);
+        return (long) (head + length - m_tail.load(std::memory_order_relaxed));
+    }
+
+    // 等待写出的字节数，生产者与消费者都可以调用
+    long used() const {
+        return (long) (m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire));
+    }
+
+    /**
+     * 消费者：取出所有等待写出的数据，绕回时分成两段
+     * @param iov 至少两个元素
+     * @param length 数据的总长度
+     * @return iovec 的个数
+     */
+    int peek(struct iovec *iov, long &length) const {
+        unsigned long tail = m_tail.load(std::memory_order_relaxed);
+        length = (long) (m_head.load(std::memory_order_acquire) - tail);
+        if (length == 0)
+            return 0;
+        size_t index = tail & m_mask;
+        size_t first = capacity() - index;
+        iov[0].iov_base = m_data + index;
+        if (first >= (size_t) length) {
+            iov[0].iov_len = length;
+            return 1;
+        }
+        iov[0].iov_len = first;
+        iov[1].iov_base = m_data;
+        iov[1].iov_len = length - first;
+        return 2;
+    }
+
+    // 消费者：从第一个没有写出的字节之后 offset 处拷贝 length 字节，调用者保证这些数据已经写入
+    void read(long offset, void *dst, long length) const {
+        size_t index = (m_tail.load(std::memory_order_relaxed) + offset) & m_mask;
+        size_t first = capacity() - index;
+        if (first >= (size_t) length) {
+            memcpy(dst, m_data + index, length);
+        } else {
+            memcpy(dst, m_data + index, first);
+            memcpy((char *) dst + first, m_data, length - first);
+        }
+    }
+
+    // 消费者：peek 或者 read 取出的数据已经处理，释放空间
+    void consume(long length) {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + length, std::memory_order_release);
+    }
+
+public:
+    std::atomic<bool> in_use;   // 是否属于某个线程，线程退出后可以被新线程复用
+    LogRing *next;              // 所有缓冲区组成的链表，只在表头插入，从不删除
+
+private:
+    char *m_data;
+    char *m_line;
+    int m_line_size;
+    unsigned long m_mask;
+    char m_pad0[CACHE_LINE_SIZE];
+    std::atomic<unsigned long> m_head;  // 生产者游标
+    char m_pad1[CACHE_LINE_SIZE];
+    std::atomic<unsigned long> m_tail;  // 消费者游标
+    char m_pad2[CACHE_LINE_SIZE];
+};
+
+#endif //MYTINYWEBSERVER_LOG_RING_H
@@ -1,15 +1,13 @@
 #include <sys/socket.h>
 #include <cstdio>
 #include <cstring>
-#include <sys/epoll.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
 #include <unistd.h>
 #include <cerrno>
-#include <fcntl.h>
 #include <cstdlib>
 #include <cassert>
 #include <csignal>
+#include <pthread.h>
+#include <sched.h>
 
 #include "config/config.h"
 #include "timer/timer.h"
@@ -17,19 +15,16 @@
 #include "lock/Locker.h"
 #include "threadpool/ThreadPool.h"
 #include "http/http_conn.h"
+#include "http/file_cache.h"
+#include "http/response_cache.h"
+#include "http/compressor.h"
+#include "http/io_pool.h"
+#include "reactor/event_loop.h"
 
 
-//这三个函数在http_conn.cpp中定义，改变链接属性
-extern int add_fd(int epoll_fd, int fd, bool one_shot);
-
-extern int remove(int epoll_fd, int fd);
-
-extern int set_nonblocking(int fd);
-
-//设置定时器相关参数
-static int pipe_line_fd[2];
-static SortTimerList timer_list;
-static int epoll_fd = 0;
+//所有的事件循环，信号处理函数需要把信号转发给每一个循环
+static EventLoop *event_loops[MAX_REACTOR_NUMBER];
+static int event_loop_number = 0;
 
 //信号处理函数
 void sig_handler(int sig);
@@ -37,319 +32,166 @@ void sig_handler(int sig);
 //添加信号函数
 void add_sig(int sig, void(handler)(int), bool restart = true);
 
-//定时处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler();
-
-//定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
-void cb_func(ClientData *client_data);
-
-// 错误显示函数
-void show_error(int conn_fd, const char *info);
-
 int main(int argc, char *argv[]) {
-#ifdef ASYNC_LOG
-    Log::get_instance()->init("ServerLog",LOG_BUFF_SIZE,LOG_SPLIT_LINES,8);
-#endif
-#ifdef SYNC_LOG
-    Log::get_instance()->init("ServerLog", LOG_BUFF_SIZE, LOG_SPLIT_LINES, 0);
-#endif
-    if (argc <= 1) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+    /**
+     * -r 事件循环的数量，0 表示每个 CPU 核心一个
+     * -b 事件后端，epoll 或 uring
+     * -s 线程池调度方式，fifo 或 steal
+     * -l 日志模式，text、deferred 或 binary
+     * -f 日志写出策略，immediate、interval、size 或 error
+     * -v 日志等级，debug、info、warn 或 error
+     * -o 日志缓冲区满时的处理，block 或 drop
+     */
+    long reactor_number = REACTOR_NUMBER;
+    const char *backend = EVENT_BACKEND;
+    const char *schedule = POOL_SCHEDULE;
+    int log_mode = log_mode_of(LOG_MODE_NAME);
+    int flush_policy = log_flush_policy_of(LOG_FLUSH_POLICY_NAME);
+    int log_level = log_level_of(LOG_LEVEL_NAME);
+    int full_policy = log_full_policy_of(LOG_FULL_POLICY_NAME);
+    int opt;
+    while ((opt = getopt(argc, argv, "r:b:s:l:f:v:o:")) != -1) {
+        switch (opt) {
+            case 'r':
+                reactor_number = strtol(optarg, nullptr, 10);
+                break;
+            case 'b':
+                backend = optarg;
+                break;
+            case 's':
+                schedule = optarg;
+                break;
+            case 'l':
+                log_mode = log_mode_of(optarg);
+                break;
+            case 'f':
+                flush_policy = log_flush_policy_of(optarg);
+                break;
+            case 'v':
+                log_level = log_level_of(optarg);
+                break;
+            case 'o':
+                full_policy = log_full_policy_of(optarg);
+                break;
+            default:
+                printf("usage: %s ip_address port_number [-r reactor_number] [-b epoll|uring] [-s fifo|steal] [-l text|deferred|binary] [-f immediate|interval|size|error] [-v debug|info|warn|error] [-o block|drop]\n", basename(argv[0]));
+                return 1;
+        }
+    }
+    if (argc - optind < 2 || (strcmp(schedule, "fifo") != 0 && strcmp(schedule, "steal") != 0) || log_mode < 0 ||
+        flush_policy < 0 || log_level < 0 || full_policy < 0) {
+        printf("usage: %s ip_address port_number [-r reactor_number] [-b epoll|uring] [-s fifo|steal] [-l text|deferred|binary] [-f immediate|interval|size|error] [-v debug|info|warn|error] [-o block|drop]\n", basename(argv[0]));
         return 1;
     }
+    Log::get_instance()->init("ServerLog", LOG_BUFF_SIZE, LOG_SPLIT_LINES, LOG_RING_SIZE, log_mode,
+                              flush_policy, full_policy);
+    Log::set_level(log_level);
+    long cpu_number = sysconf(_SC_NPROCESSORS_ONLN);
+    if (reactor_number <= 0)
+        reactor_number = cpu_number > 0 ? cpu_number : 1;
+    if (reactor_number > MAX_REACTOR_NUMBER)
+        reactor_number = MAX_REACTOR_NUMBER;
+
     char *end;
     /**
      * 第二个才是端口，原代码写错了，同时没有对指定 ip 进行处理
      * todo 可以考虑提一个 pr
      */
-    long port = strtol(argv[2], &end, 10);
-    LOG_INFO("listen port: %ld\n", port);
-    Log::get_instance()->flush();
+    long port = strtol(argv[optind + 1], &end, 10);
+    LOG_INFO("listen port: %ld, reactor number: %ld, backend: %s, schedule: %s\n", port, reactor_number, backend,
+             schedule);
     if (errno) {
         printf("%d", errno);
         throw std::exception();
     }
     /**
-     * todo 这个函数的作用
+     * 忽略 SIGPIPE，向已关闭的连接写数据时不终止进程
      */
     add_sig(SIGPIPE, SIG_IGN);
 
+    /**
+     * 打开文件缓存依赖 inotify 通知文件变化，不可用时每次请求都重新打开文件
+     */
+    if (!FileCache::get_instance()->init(WWW_ROOT_DIR)) {
+        LOG_WARN("file cache disabled, inotify on %s unavailable", WWW_ROOT_DIR);
+    }
+    // 后台压缩线程，压缩结果保存在打开文件缓存中
+    if (!Compressor::get_instance()->init()) {
+        LOG_WARN("%s", "compressor thread create failure, only precompressed files are served encoded");
+    }
+    // 冷文件读取线程，不在页缓存中的文件内容由它们读入，事件循环不等待磁盘
+    if (!IoPool::get_instance()->init(IO_THREAD_NUMBER)) {
+        LOG_WARN("%s", "io thread create failure, cold files are read by the event loop");
+    }
+
     ThreadPool<http_conn> *thread_pool;
     try {
-        thread_pool = new ThreadPool<http_conn>(THREAD_NUMBER, MAX_REQUEST);
+        thread_pool = new ThreadPool<http_conn>(THREAD_NUMBER, MAX_REQUEST,
+                                                strcmp(schedule, "steal") == 0 ? SCHEDULE_STEAL : SCHEDULE_FIFO);
     } catch (...) {
         throw std::exception();
     }
     /**
-     * 创建客户端 http 连接池
+     * 创建客户端 http 连接池，每个连接内嵌自己的定时器数据
      */
     auto *clients = new http_conn[MAX_FD];
     assert(clients);
-    /**
-     * 创建 socket 文件描述符，流类型
-     */
-    int listen_fd = socket(PF_INET, SOCK_STREAM, 0);
-    assert(listen_fd >= 0);
 
-    long ret;
-    sockaddr_in address{};
-    bzero(&address, sizeof address);
-    address.sin_family = AF_INET;
-    // todo 命令读取了地址，但是没有使用，可以进行改进
-    address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(port);
-
-    int flag = 1;
-    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
-    ret = bind(listen_fd, (struct sockaddr *) &address, sizeof address);
-    assert(ret >= 0);
     /**
-     * todo 开始监听，第二个应该是缓存队列还是什么的需要进一步确认
+     * 创建事件循环，每个循环拥有自己的监听 socket、事件后端与定时器链表
      */
-    ret = listen(listen_fd, 5);
-    assert(ret >= 0);
-
-    /**
-     * 创建内核事件表
-     */
-    epoll_event events[MAX_EVENT_NUMBER];
-    epoll_fd = epoll_create(5);
-    assert(epoll_fd != -1);
-
-    add_fd(epoll_fd, listen_fd, false);
-    /**
-     * 设置静态变量，内核 epoll 内核事件表描述符
-     */
-    http_conn::m_epoll_fd = epoll_fd;
-
-    /**
-     * 创建管道
-     */
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipe_line_fd);
-    assert(ret != -1);
-    /**
-     * 设置管道表现
-     * todo 判断哪个是读端，哪个是写端
-     */
-    set_nonblocking(pipe_line_fd[1]);
-    add_fd(epoll_fd, pipe_line_fd[0], false);
+    for (int i = 0; i < reactor_number; ++i) {
+        event_loops[i] = EventLoop::create(backend, i, port, thread_pool, clients);
+        if (!event_loops[i]) {
+            printf("reactor %d init failure!\n", i);
+            LOG_ERROR("reactor %d init failure!", i);
+            return 1;
+        }
+        event_loop_number++;
+    }
 
     /**
-     * 添加定时器信号
-     */
-    add_sig(SIGALRM, sig_handler, false);
-    /**
-     * 添加终止信号
+     * 添加终止信号，定时器由每个事件循环自己的 timerfd 驱动，不再使用 SIGALRM
+     * SIGUSR1/SIGUSR2 在运行中调整日志等级
      */
     add_sig(SIGTERM, sig_handler, false);
-    bool stop_server = false;
+    add_sig(SIGUSR1, sig_handler);
+    add_sig(SIGUSR2, sig_handler);
 
     /**
-     * 客户端对应的定时器
+     * 第 0 个事件循环在主线程中运行，其余的各自一个线程，并尽量绑定到不同的 CPU 核心上
      */
-    auto *clients_timer = new ClientData[MAX_FD];
-    bool timeout = false;
-    /**
-     * 以配置的描述，调度定时器，默认超时时间为 5s
-     */
-    alarm(TIMESLOT);
-
-    LOG_INFO("%s", "Server running...");
-    Log::get_instance()->flush();
-    while (!stop_server) {
-        /**
-         * 获取 epoll 事件触发数目
-         * timeout 为 -1，表示一直等待，直到有事件发生
-         */
-        int number = epoll_wait(epoll_fd, events, MAX_EVENT_NUMBER, -1);
-        /**
-         * todo EINTR 错误信息是什么，代表什么
-         */
-        if (number < 0 && errno != EINTR) {
-            printf("%s", "epoll runtime failure!");
-            LOG_ERROR("%s","epoll runtime failure!");
-            break;
+    pthread_t *loop_threads = new pthread_t[event_loop_number];
+    for (int i = 1; i < event_loop_number; ++i) {
+        if (pthread_create(loop_threads + i, nullptr, EventLoop::worker, event_loops[i]) != 0) {
+            LOG_ERROR("reactor %d thread create failure!", i);
+            throw std::exception();
         }
-
-        /**
-         * 循环处理所有的事件
-         */
-        for (int i = 0; i < number; ++i) {
-            int socket_fd = events[i].data.fd;
-            /**
-             * 即服务端的监听文件描述符，监听到了事件活动
-             */
-            if (socket_fd == listen_fd) {
-                sockaddr_in client_address{};
-                socklen_t client_addr_len = sizeof client_address;
-
-#ifdef listen_fdLT
-                /**
-                 * 水平触发处理方式
-                 */
-                int conn_fd = accept(listen_fd,(struct sockaddr*)&client_address,&client_addr_len);
-                if (conn_fd < 0){
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    continue;
-                }
-                /**
-                 * 服务器忙处理
-                 */
-                if (http_conn::m_user_count >= MAX_FD){
-                    show_error(conn_fd, "Internal server busy");
-                    LOG_ERROR("%s", "Internal server busy");
-                    continue;
-                }
-                /**
-                 * 初始化客户端连接
-                 */
-                clients[conn_fd].init(conn_fd,client_address);
-
-                clients_timer[conn_fd].address = client_address;
-                clients_timer[conn_fd].socket_fd = conn_fd;
-                UtilTimer *timer = new UtilTimer;
-                timer->client_data = &clients_timer[conn_fd];
-                timer->cb_func = cb_func;
-
-                time_t cur = time(nullptr);
-                timer->expire = cur + 3 * TIMESLOT;
-                clients_timer[conn_fd].timer = timer;
-                timer_list.add_timer(timer);
-#endif
-
-#ifdef listen_fdET
-                /**
-                 * 边缘触发模式，一直接收连接并处理
-                 */
-                while (true) {
-                    int conn_fd = accept(listen_fd, (struct sockaddr *) &client_address, &client_addr_len);
-                    if (conn_fd < 0) {
-                        LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                        break;
-                    }
-                    if (http_conn::m_user_count >= MAX_FD) {
-                        show_error(conn_fd, "Internal server busy");
-                        LOG_ERROR("%s", "Internal server busy");
-                        break;
-                    }
-                    clients[conn_fd].init(conn_fd, client_address);
-
-                    clients_timer[conn_fd].address = client_address;
-                    clients_timer[conn_fd].socket_fd = conn_fd;
-
-                    auto *timer = new UtilTimer;
-                    timer->client_data = &clients_timer[conn_fd];
-                    timer->cb_func = cb_func;
-
-                    time_t cur = time(nullptr);
-                    timer->expire = cur + 3 * TIMESLOT;
-                    clients_timer[conn_fd].timer = timer;
-                    timer_list.add_timer(timer);
-                }
-                continue;
-#endif
-            }
-                /**
-                 * 服务器端关闭连接情况处理
-                 */
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                UtilTimer *timer = clients_timer[socket_fd].timer;
-                timer->cb_func(&clients_timer[socket_fd]);
-
-                if (timer) {
-                    timer_list.del_timer(timer);
-                }
-            }
-                /**
-                 * 管道信号
-                 */
-            else if ((socket_fd == pipe_line_fd[0]) && (events[i].events & EPOLLIN)) {
-                long sig;
-                char signals[1024];
-                ret = recv(pipe_line_fd[0], signals, sizeof signals, 0);
-                if (ret == -1) {
-                    continue;
-                } else if (ret == 0) {
-                    continue;
-                } else {
-                    for (int j = 0; j < ret; ++j) {
-                        switch (signals[i]) {
-                            case SIGALRM: {
-                                timeout = true;
-                                break;
-                            }
-                            case SIGTERM: {
-                                stop_server = true;
-                            }
-                        }
-                    }
-                }
-            }
-                /**
-                 * 读事件
-                 * 处理客户连接上接收到的数据
-                 */
-            else if (events->events & EPOLLIN) {
-                UtilTimer *timer = clients_timer[socket_fd].timer;
-                if (clients[socket_fd].read_once()) {
-                    LOG_INFO("deal with the client(%s)", inet_ntoa(clients[socket_fd].get_address()->sin_addr));
-                    thread_pool->append(clients + socket_fd);
-
-                    if (timer) {
-                        time_t cur = time(nullptr);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_list.adjust_timer(timer);
-                    }
-                } else {
-                    timer->cb_func(&clients_timer[socket_fd]);
-                    if (timer) {
-                        timer_list.del_timer(timer);
-                    }
-                }
-            }
-                /**
-                 * 写事件
-                 */
-            else if (events[i].events & EPOLLOUT) {
-                UtilTimer *timer = clients_timer[socket_fd].timer;
-                if (clients[socket_fd].write()) {
-                    LOG_INFO("send data to the client(%s)", inet_ntoa(clients[socket_fd].get_address()->sin_addr));
-                    /**
-                     * 若有数据传输，则将定时器往后延迟3个单位
-                     * 并对新的定时器在链表上的位置进行调整
-                     * 以符合链表的要求
-                     */
-                    if (timer) {
-                        time_t cur = time(nullptr);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_list.adjust_timer(timer);
-                    }
-                } else {
-                    timer->cb_func(&clients_timer[socket_fd]);
-                    if (timer) {
-                        timer_list.del_timer(timer);
-                    }
-                }
-            }
-            if (timeout) {
-                timer_handler();
-                timeout = false;
-            }
+        if (cpu_number > 1) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(i % cpu_number, &cpu_set);
+            pthread_setaffinity_np(loop_threads[i], sizeof cpu_set, &cpu_set);
         }
     }
+
+    LOG_INFO("%s", "Server running...");
+    event_loops[0]->loop();
+
     /**
-     * 关闭连接
+     * 等待其它事件循环退出，并关闭连接
      */
-    close(epoll_fd);
-    close(listen_fd);
-    close(pipe_line_fd[0]);
-    close(pipe_line_fd[1]);
+    for (int i = 1; i < event_loop_number; ++i) {
+        pthread_join(loop_threads[i], nullptr);
+    }
+    for (int i = 0; i < event_loop_number; ++i) {
+        delete event_loops[i];
+    }
+    LOG_INFO("response cache hits:%lu misses:%lu", ResponseCache::get_instance()->hits(),
+             ResponseCache::get_instance()->misses());
+    LOG_INFO("cold reads offloaded:%lu", IoPool::get_instance()->reads());
+    delete[] loop_threads;
     delete[] clients;
-    delete[] clients_timer;
     delete thread_pool;
     return 0;
 }
@@ -365,10 +207,12 @@ void sig_handler(int sig) {
     int save_errno = errno;
     int msg = sig;
     /**
-     * 将信号写入管道，以通知主循环
+     * 将信号写入每个事件循环的管道，以通知所有的事件循环
      * todo 向管道的写端写入信号量（这个地方只发送了一个字节够用吗？
      */
-    send(pipe_line_fd[1], (char *) &msg, 1, 0);
+    for (int i = 0; i < event_loop_number; ++i) {
+        send(event_loops[i]->signal_fd(), (char *) &msg, 1, 0);
+    }
     errno = save_errno;
 }
 
@@ -400,42 +244,9 @@ void add_sig(int sig, void(handler)(int), bool restart) {
      */
     sigfillset(&sa.sa_mask);
     /**
-     * 设置信号量动作
-     */
-    assert(sigaction(sig, &sa, nullptr) != -1);
-}
-
-/**
- * 定时处理任务，重新定时以不断触发SIGALRM信号
- */
-void timer_handler() {
-    timer_list.tick();
-    /**
-     * 因为一次alarm调用只会引起一次SIGALRM信号，所以我们要重新定时，以不断触发SIGALRM信号
+     * 设置信号量动作，不能直接写在 assert 里，否则定义了 NDEBUG 的构建不会执行
      */
-    alarm(TIMESLOT);
-}
-
-/**
- * 定时器回调函数
- * 删除非活动连接在socket上的注册事件，并关闭
- * @param client_data
- */
-void cb_func(ClientData *client_data) {
-    assert(client_data);
-    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_data->socket_fd, nullptr);
-    close(client_data->socket_fd);
-    http_conn::m_user_count--;
-    LOG_INFO("close fd %d", client_data->socket_fd);
-    Log::get_instance()->flush();
+    int ret = sigaction(sig, &sa, nullptr);
+    assert(ret != -1);
+    (void) ret;
 }
-
-/**
- * 显示错误信息
- * @param conn_fd 要发送的socket
- * @param info 要发送的信息
- */
-void show_error(int conn_fd, const char *info) {
-    send(conn_fd, info, strlen(info), 0);
-    close(conn_fd);
-}
\ No newline at end of file
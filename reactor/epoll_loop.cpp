@@ -0,0 +1,242 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/12 10:05
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include "epoll_loop.h"
+#include "../timer/coarse_clock.h"
+#include "../log/log.h"
+
+//这几个函数在http_conn.cpp中定义，改变链接属性
+extern void add_fd(int epoll_fd, int fd, bool one_shot);
+
+extern void remove_fd(int epoll_fd, int fd);
+
+extern void mod_fd(int epoll_fd, int fd, int ev);
+
+// 错误显示函数
+static void show_error(int conn_fd, const char *info) {
+    send(conn_fd, info, strlen(info), 0);
+    close(conn_fd);
+}
+
+EpollLoop::EpollLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users)
+        : EventLoop(id, port, thread_pool, users), m_epoll_fd(-1) {
+}
+
+EpollLoop::~EpollLoop() {
+    if (m_epoll_fd != -1)
+        close(m_epoll_fd);
+}
+
+/**
+ * 创建 epoll 内核事件表，并注册监听 socket、信号管道、定时器与唤醒用的 eventfd
+ * @return 是否成功
+ */
+bool EpollLoop::init() {
+    if (!EventLoop::init())
+        return false;
+    /**
+     * 创建内核事件表
+     */
+    m_epoll_fd = epoll_create(5);
+    if (m_epoll_fd == -1)
+        return false;
+
+    add_fd(m_epoll_fd, m_listen_fd, false);
+    add_fd(m_epoll_fd, m_pipe_fd[0], false);
+    add_fd(m_epoll_fd, m_timer_fd, false);
+    add_fd(m_epoll_fd, m_wake_fd, false);
+    return true;
+}
+
+void EpollLoop::mod_fd(int fd, int ev) {
+    ::mod_fd(m_epoll_fd, fd, ev);
+}
+
+void EpollLoop::remove_fd(int fd) {
+    ::remove_fd(m_epoll_fd, fd);
+}
+
+void EpollLoop::loop() {
+    LOG_INFO("reactor %d (%s) running...", m_id, name());
+    while (!m_stop) {
+        /**
+         * 获取 epoll 事件触发数目
+         * timeout 为 -1，表示一直等待，直到有事件发生
+         */
+        int number = epoll_wait(m_epoll_fd, m_events, MAX_EVENT_NUMBER, -1);
+        /**
+         * EINTR 表示系统调用被信号中断，直接重新等待即可
+         */
+        if (number < 0 && errno != EINTR) {
+            printf("%s", "epoll runtime failure!");
+            LOG_ERROR("%s", "epoll runtime failure!");
+            break;
+        }
+        // 每轮只读一次时钟，本轮的定时器与日志都使用缓存的时间
+        CoarseClock::get_instance()->update();
+
+        /**
+         * 循环处理所有的事件
+         */
+        for (int i = 0; i < number; ++i) {
+            int socket_fd = m_events[i].data.fd;
+            /**
+             * 即服务端的监听文件描述符，监听到了事件活动
+             */
+            if (socket_fd == m_listen_fd) {
+                deal_accept();
+            }
+                /**
+                 * 服务器端关闭连接情况处理
+                 */
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                deal_close(socket_fd);
+            }
+                /**
+                 * 管道信号
+                 */
+            else if ((socket_fd == m_pipe_fd[0]) && (m_events[i].events & EPOLLIN)) {
+                char signals[1024];
+                long ret = recv(m_pipe_fd[0], signals, sizeof signals, 0);
+                if (ret > 0)
+                    deal_signal(signals, ret);
+            }
+                /**
+                 * 定时器到期，读出到期次数以清除可读状态
+                 */
+            else if ((socket_fd == m_timer_fd) && (m_events[i].events & EPOLLIN)) {
+                uint64_t expirations;
+                if (read(m_timer_fd, &expirations, sizeof expirations) > 0)
+                    deal_timer();
+            }
+                /**
+                 * I/O 线程交回了读完文件内容的连接，读出计数以清除可读状态
+                 */
+            else if ((socket_fd == m_wake_fd) && (m_events[i].events & EPOLLIN)) {
+                uint64_t value;
+                if (read(m_wake_fd, &value, sizeof value) > 0)
+                    deal_resume();
+            }
+                /**
+                 * 读事件
+                 * 处理客户连接上接收到的数据
+                 */
+            else if (m_events[i].events & EPOLLIN) {
+                deal_read(socket_fd);
+            }
+                /**
+                 * 写事件
+                 */
+            else if (m_events[i].events & EPOLLOUT) {
+                deal_write(socket_fd);
+            }
+        }
+        if (m_timeout) {
+            timer_handler();
+            m_timeout = false;
+        }
+    }
+}
+
+/**
+ * 处理监听 socket 上的新连接
+ */
+void EpollLoop::deal_accept() {
+    sockaddr_in client_address{};
+    socklen_t client_addr_len = sizeof client_address;
+
+#ifdef listen_fdLT
+    /**
+     * 水平触发处理方式
+     */
+    int conn_fd = accept(m_listen_fd, (struct sockaddr *) &client_address, &client_addr_len);
+    if (conn_fd < 0) {
+        LOG_ERROR("%s:errno is:%d", "accept error", errno);
+        return;
+    }
+    /**
+     * 服务器忙处理
+     */
+    if (http_conn::m_user_count >= MAX_FD) {
+        show_error(conn_fd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+    /**
+     * 初始化客户端连接，并注册到内核事件表中
+     */
+    add_client(conn_fd, client_address);
+    add_fd(m_epoll_fd, conn_fd, true);
+#endif
+
+#ifdef listen_fdET
+    /**
+     * 边缘触发模式，一直接收连接并处理
+     */
+    while (true) {
+        int conn_fd = accept(m_listen_fd, (struct sockaddr *) &client_address, &client_addr_len);
+        if (conn_fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+            break;
+        }
+        if (http_conn::m_user_count >= MAX_FD) {
+            show_error(conn_fd, "Internal server busy");
+            LOG_ERROR("%s", "Internal server busy");
+            break;
+        }
+        add_client(conn_fd, client_address);
+        add_fd(m_epoll_fd, conn_fd, true);
+    }
+#endif
+}
+
+/**
+ * 读事件，读取客户连接上接收到的数据后交给线程池处理
+ * @param socket_fd
+ */
+void EpollLoop::deal_read(int socket_fd) {
+    UtilTimer *timer = &m_users[socket_fd].get_client_data()->timer;
+    if (m_users[socket_fd].read_once()) {
+        LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[socket_fd].get_address()->sin_addr));
+        m_thread_pool->append(m_users + socket_fd);
+        if (timer->active()) {
+            adjust_timer(timer);
+        }
+    } else {
+        deal_close(socket_fd);
+    }
+}
+
+/**
+ * 写事件
+ * @param socket_fd
+ */
+void EpollLoop::deal_write(int socket_fd) {
+    http_conn *conn = m_users + socket_fd;
+    UtilTimer *timer = &conn->get_client_data()->timer;
+    if (conn->write()) {
+        LOG_INFO("send data to the client(%s)", inet_ntoa(conn->get_address()->sin_addr));
+        // 响应发送完毕，读缓存区中还有流水线请求，继续交给线程池处理
+        if (conn->get_bytes_to_send() == 0 && conn->has_buffered_input())
+            m_thread_pool->append(conn);
+        if (timer->active()) {
+            adjust_timer(timer);
+        }
+    } else {
+        deal_close(socket_fd);
+    }
+}
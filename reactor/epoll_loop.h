@@ -0,0 +1,49 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/12 10:05
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_EPOLL_LOOP_H
+#define MYTINYWEBSERVER_EPOLL_LOOP_H
+
+#include <sys/epoll.h>
+#include "event_loop.h"
+
+/**
+ * 基于 epoll 的事件循环，就绪通知模型：
+ * epoll_wait -> read_once 读到 EAGAIN -> 工作线程处理 -> mod_fd -> write
+ */
+class EpollLoop : public EventLoop {
+public:
+    EpollLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users);
+
+    ~EpollLoop() override;
+
+    bool init() override;
+
+    void loop() override;
+
+    void mod_fd(int fd, int ev) override;
+
+    void remove_fd(int fd) override;
+
+    const char *name() const override { return "epoll"; }
+
+private:
+    int m_epoll_fd;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+
+private:
+    void deal_accept();
+
+    void deal_read(int socket_fd);
+
+    void deal_write(int socket_fd);
+};
+
+#endif //MYTINYWEBSERVER_EPOLL_LOOP_H
@@ -0,0 +1,279 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/10 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cassert>
+#include <csignal>
+#include "event_loop.h"
+#include "epoll_loop.h"
+#include "uring_loop.h"
+#include "../timer/coarse_clock.h"
+#include "../log/log.h"
+
+extern int set_nonblocking(int fd);
+
+EventLoop::EventLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users)
+        : m_id(id), m_port(port), m_listen_fd(-1), m_pipe_fd{-1, -1}, m_timer_fd(-1), m_wake_fd(-1),
+          m_stop(false), m_timeout(false), m_thread_pool(thread_pool), m_users(users) {
+}
+
+/**
+ * 关闭事件循环持有的描述符
+ */
+EventLoop::~EventLoop() {
+    if (m_listen_fd != -1)
+        close(m_listen_fd);
+    if (m_pipe_fd[0] != -1)
+        close(m_pipe_fd[0]);
+    if (m_pipe_fd[1] != -1)
+        close(m_pipe_fd[1]);
+    if (m_timer_fd != -1)
+        close(m_timer_fd);
+    if (m_wake_fd != -1)
+        close(m_wake_fd);
+}
+
+EventLoop *EventLoop::create(const char *backend, int id, long port, ThreadPool<http_conn> *thread_pool,
+                             http_conn *users) {
+    EventLoop *event_loop = nullptr;
+    if (strcmp(backend, "uring") == 0) {
+        event_loop = new UringLoop(id, port, thread_pool, users);
+        if (event_loop->init())
+            return event_loop;
+        /**
+         * 内核不支持 io_uring 或者被禁用时，回退到 epoll
+         */
+        LOG_WARN("reactor %d: io_uring unavailable, fall back to epoll", id);
+        delete event_loop;
+    } else if (strcmp(backend, "epoll") != 0) {
+        LOG_ERROR("unknown event backend: %s", backend);
+        return nullptr;
+    }
+    event_loop = new EpollLoop(id, port, thread_pool, users);
+    if (event_loop->init())
+        return event_loop;
+    delete event_loop;
+    return nullptr;
+}
+
+/**
+ * 创建监听 socket、信号管道与定时器
+ * @return 是否成功
+ */
+bool EventLoop::init() {
+    /**
+     * 创建 socket 文件描述符，流类型
+     */
+    m_listen_fd = socket(PF_INET, SOCK_STREAM, 0);
+    if (m_listen_fd < 0)
+        return false;
+
+    sockaddr_in address{};
+    bzero(&address, sizeof address);
+    address.sin_family = AF_INET;
+    // todo 命令读取了地址，但是没有使用，可以进行改进
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(m_port);
+
+    int flag = 1;
+    setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof flag);
+    /**
+     * 每个事件循环都绑定同一个端口，由内核在各个监听 socket 之间分发新连接
+     */
+    if (setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof flag) < 0) {
+        LOG_ERROR("reactor %d: SO_REUSEPORT failed, errno is:%d", m_id, errno);
+        return false;
+    }
+    if (bind(m_listen_fd, (struct sockaddr *) &address, sizeof address) < 0) {
+        LOG_ERROR("reactor %d: bind failed, errno is:%d", m_id, errno);
+        return false;
+    }
+    /**
+     * todo 开始监听，第二个应该是缓存队列还是什么的需要进一步确认
+     */
+    if (listen(m_listen_fd, 5) < 0)
+        return false;
+
+    /**
+     * 创建管道，信号处理函数写 m_pipe_fd[1]，事件循环读 m_pipe_fd[0]
+     */
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipe_fd) == -1)
+        return false;
+    set_nonblocking(m_pipe_fd[1]);
+
+    /**
+     * 定时器由 timerfd 驱动，和其它描述符一起在事件后端中等待，不再依赖 SIGALRM
+     */
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (m_timer_fd == -1)
+        return false;
+    itimerspec interval{};
+    interval.it_interval.tv_sec = TIMER_TICK_MS / 1000;
+    interval.it_interval.tv_nsec = (TIMER_TICK_MS % 1000) * 1000000L;
+    interval.it_value = interval.it_interval;
+    if (timerfd_settime(m_timer_fd, 0, &interval, nullptr) == -1)
+        return false;
+
+    /**
+     * 唤醒用的 eventfd，io_uring 用普通的读请求等待它，所以不设置 EFD_NONBLOCK；
+     * epoll 只在可读之后读取，也不会阻塞
+     */
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (m_wake_fd == -1)
+        return false;
+    return true;
+}
+
+/**
+ * 线程入口函数
+ * @param arg 事件循环的指针
+ * @return
+ */
+void *EventLoop::worker(void *arg) {
+    auto *event_loop = (EventLoop *) arg;
+    event_loop->loop();
+    return event_loop;
+}
+
+/**
+ * 初始化新连接以及对应的定时器
+ * @param conn_fd 新连接
+ * @param client_address 客户端地址
+ */
+void EventLoop::add_client(int conn_fd, const sockaddr_in &client_address) {
+    m_users[conn_fd].init(this, conn_fd, client_address);
+
+    /**
+     * 定时器节点内嵌在连接对象中，建立连接时不需要分配内存
+     */
+    ClientData *client_data = m_users[conn_fd].get_client_data();
+    client_data->address = client_address;
+    client_data->socket_fd = conn_fd;
+    client_data->loop = this;
+
+    UtilTimer *timer = &client_data->timer;
+    timer->client_data = client_data;
+    timer->cb_func = cb_func;
+    timer->expire = CoarseClock::get_instance()->now_ms() + CONN_TIMEOUT_MS;
+    m_time_wheel.add_timer(timer);
+}
+
+/**
+ * 处理管道中的信号
+ * @param signals 读到的信号
+ * @param number 信号个数
+ */
+void EventLoop::deal_signal(const char *signals, long number) {
+    for (int j = 0; j < number; ++j) {
+        switch (signals[j]) {
+            case SIGTERM: {
+                m_stop = true;
+                break;
+            }
+            case SIGUSR1:
+            case SIGUSR2: {
+                // 每个事件循环都会收到，只由第 0 个调整；SIGUSR1 多记录一级，SIGUSR2 少记录一级
+                if (m_id == 0) {
+                    Log::set_level(Log::level() + (signals[j] == SIGUSR1 ? -1 : 1));
+                    // 不经过等级过滤，调到 ERROR 时也能看到
+                    Log::get_instance()->write_log(LOG_LEVEL_WARN, "log level: %s", log_level_name(Log::level()));
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * timerfd 到期，超时连接在本轮事件都处理完之后再检查，
+ * 避免同一批事件中还有已经被关闭的连接
+ */
+void EventLoop::deal_timer() {
+    m_timeout = true;
+}
+
+/**
+ * 服务器端关闭连接
+ * @param socket_fd
+ */
+void EventLoop::deal_close(int socket_fd) {
+    ClientData *client_data = m_users[socket_fd].get_client_data();
+    m_time_wheel.del_timer(&client_data->timer);
+    cb_func(client_data);
+}
+
+/**
+ * 若有数据传输，则将定时器往后延迟一个超时时间
+ * 并对新的定时器在链表上的位置进行调整
+ * 以符合链表的要求
+ */
+void EventLoop::adjust_timer(UtilTimer *timer) {
+    timer->expire = CoarseClock::get_instance()->now_ms() + CONN_TIMEOUT_MS;
+    LOG_INFO("%s", "adjust timer once");
+    m_time_wheel.adjust_timer(timer);
+}
+
+/**
+ * 定时处理任务，检查本循环中的超时连接
+ */
+void EventLoop::timer_handler() {
+    CoarseClock::get_instance()->update();
+    m_time_wheel.tick();
+}
+
+void EventLoop::wake() const {
+    uint64_t one = 1;
+    ::write(m_wake_fd, &one, sizeof one);
+}
+
+/**
+ * I/O 线程调用，放入队列后唤醒事件循环
+ */
+void EventLoop::resume_send(int fd, unsigned generation) {
+    m_resume_locker.lock();
+    bool was_empty = m_resumes.empty();
+    m_resumes.push_back({fd, generation});
+    m_resume_locker.unlock();
+    // 队列原本不为空时，事件循环一定还会再处理一次队列，不需要重复唤醒
+    if (was_empty)
+        wake();
+}
+
+/**
+ * 事件循环线程调用，连接在读取期间关闭或者被复用时 http_conn::resume_send 会忽略
+ */
+void EventLoop::deal_resume() {
+    m_resume_locker.lock();
+    m_resume_swap.swap(m_resumes);
+    m_resume_locker.unlock();
+    for (const Resume &resume : m_resume_swap)
+        m_users[resume.fd].resume_send(resume.generation);
+    m_resume_swap.clear();
+}
+
+/**
+ * 定时器回调函数
+ * 删除非活动连接在socket上的注册事件，并关闭
+ * @param client_data
+ */
+void cb_func(ClientData *client_data) {
+    assert(client_data);
+    // 连接关闭，读写缓冲区还给缓冲区池
+    client_data->loop->user(client_data->socket_fd)->release();
+    client_data->loop->remove_fd(client_data->socket_fd);
+    http_conn::m_user_count--;
+    LOG_INFO("close fd %d", client_data->socket_fd);
+}
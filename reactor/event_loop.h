@@ -0,0 +1,141 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/10 15:20
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_EVENT_LOOP_H
+#define MYTINYWEBSERVER_EVENT_LOOP_H
+
+#include <pthread.h>
+#include <vector>
+#include "../config/config.h"
+#include "../timer/timer.h"
+#include "../threadpool/ThreadPool.h"
+#include "../http/http_conn.h"
+
+/**
+ * 事件循环（reactor）基类
+ * 每个事件循环拥有自己的监听 socket（SO_REUSEPORT）、事件后端与定时器（timerfd 驱动的时间轮），
+ * 由它 accept 的连接的所有 I/O 与超时都只在这个循环内处理，多个循环之间互不共享状态。
+ * 连接对象数组按文件描述符下标进行全局共享，文件描述符在进程内唯一，所以不会冲突。
+ *
+ * 具体的事件后端（epoll、io_uring）由子类实现，http_conn 只通过 mod_fd 与 remove_fd 与后端交互。
+ */
+class EventLoop {
+public:
+    /**
+     * @param id 事件循环编号
+     * @param port 监听端口
+     * @param thread_pool 共享的工作线程池
+     * @param users 客户端 http 连接池，定时器数据内嵌在连接对象中
+     */
+    EventLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users);
+
+    virtual ~EventLoop();
+
+    /**
+     * 按名字创建并初始化事件循环，io_uring 不可用时回退到 epoll
+     * @param backend 事件后端名字，"epoll" 或 "uring"
+     * @return 初始化完成的事件循环，失败返回 nullptr
+     */
+    static EventLoop *create(const char *backend, int id, long port, ThreadPool<http_conn> *thread_pool,
+                             http_conn *users);
+
+    // 创建监听 socket、信号管道以及定时器，子类在此基础上创建自己的事件后端
+    virtual bool init();
+
+    // 事件循环主体，直到收到 SIGTERM
+    virtual void loop() = 0;
+
+    /**
+     * 重新注册连接关心的事件，EPOLLIN 表示等待下一个请求，EPOLLOUT 表示响应已经准备好
+     * 工作线程与事件循环线程都会调用
+     */
+    virtual void mod_fd(int fd, int ev) = 0;
+
+    // 注销并关闭连接
+    virtual void remove_fd(int fd) = 0;
+
+    /**
+     * I/O 线程读完文件内容之后调用，把连接交回事件循环线程继续发送
+     * 代数在事件循环线程中检查，与超时、对端关闭时的 release 不会交错，连接关闭之后文件描述符被复用也不会误发
+     * @param fd 连接的文件描述符
+     * @param generation 提交读取时连接的代数
+     */
+    void resume_send(int fd, unsigned generation);
+
+    // 事件后端名字
+    virtual const char *name() const = 0;
+
+    // 信号处理函数向这个描述符写入信号值，以通知事件循环
+    int signal_fd() const { return m_pipe_fd[1]; }
+
+    int id() const { return m_id; }
+
+    // 文件描述符对应的连接对象
+    http_conn *user(int fd) const { return m_users + fd; }
+
+    /**
+     * 线程入口函数，arg 为事件循环的指针
+     */
+    static void *worker(void *arg);
+
+protected:
+    int m_id;
+    long m_port;
+    int m_listen_fd;
+    int m_pipe_fd[2];
+    int m_timer_fd;     // 周期性的 timerfd，每 TIMER_TICK_MS 毫秒可读一次
+    int m_wake_fd;      // eventfd，其它线程交给事件循环的任务放入队列后写入它来唤醒事件循环
+    bool m_stop;
+    bool m_timeout;
+
+    TimeWheel m_time_wheel;
+
+    ThreadPool<http_conn> *m_thread_pool;
+    http_conn *m_users;
+
+protected:
+    // 初始化新连接以及对应的定时器
+    void add_client(int conn_fd, const sockaddr_in &client_address);
+
+    // 处理从管道中读到的信号
+    void deal_signal(const char *signals, long number);
+
+    // timerfd 到期，标记在本轮事件处理完之后检查超时连接
+    void deal_timer();
+
+    void deal_close(int socket_fd);
+
+    void adjust_timer(UtilTimer *timer);
+
+    // 定时处理任务
+    void timer_handler();
+
+    // 唤醒事件循环
+    void wake() const;
+
+    // 在事件循环线程中处理 I/O 线程交回的连接
+    void deal_resume();
+
+private:
+    // I/O 线程交回的连接
+    struct Resume {
+        int fd;
+        unsigned generation;
+    };
+
+    Locker m_resume_locker;
+    std::vector<Resume> m_resumes;
+    std::vector<Resume> m_resume_swap;
+};
+
+// 定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+void cb_func(ClientData *client_data);
+
+#endif //MYTINYWEBSERVER_EVENT_LOOP_H
@@ -0,0 +1,217 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/12 10:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_IO_URING_H
+#define MYTINYWEBSERVER_IO_URING_H
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+/**
+ * io_uring 的最小封装，直接使用系统调用，不依赖 liburing
+ * 只在创建它的事件循环线程中使用，不是线程安全的
+ */
+class IoUring {
+public:
+    IoUring() = default;
+
+    ~IoUring() {
+        if (m_sqes)
+            munmap(m_sqes, m_sqes_size);
+        if (m_cq_ptr && m_cq_ptr != m_sq_ptr)
+            munmap(m_cq_ptr, m_cq_size);
+        if (m_sq_ptr)
+            munmap(m_sq_ptr, m_sq_size);
+        if (m_ring_fd != -1)
+            close(m_ring_fd);
+    }
+
+    /**
+     * 创建 io_uring 实例并映射提交队列与完成队列
+     * @param entries 提交队列长度
+     * @param flags IORING_SETUP_* 选项
+     * @return 成功返回 0，否则返回负的 errno
+     */
+    int init(unsigned entries, unsigned flags) {
+        io_uring_params params{};
+        params.flags = flags;
+        m_ring_fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+        if (m_ring_fd < 0)
+            return -errno;
+        m_features = params.features;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+            return -ENOSYS;
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (m_cq_size > m_sq_size)
+            m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+        m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd,
+                        IORING_OFF_SQ_RING);
+        if (m_sq_ptr == MAP_FAILED) {
+            m_sq_ptr = nullptr;
+            return -errno;
+        }
+        m_cq_ptr = m_sq_ptr;
+
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = (io_uring_sqe *) mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       m_ring_fd, IORING_OFF_SQES);
+        if (m_sqes == MAP_FAILED) {
+            m_sqes = nullptr;
+            return -errno;
+        }
+
+        char *sq = (char *) m_sq_ptr;
+        m_sq_head = (unsigned *) (sq + params.sq_off.head);
+        m_sq_tail = (unsigned *) (sq + params.sq_off.tail);
+        m_sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+        m_sq_entries = *(unsigned *) (sq + params.sq_off.ring_entries);
+        m_sq_array = (unsigned *) (sq + params.sq_off.array);
+        m_sqe_tail = *m_sq_tail;
+
+        char *cq = (char *) m_cq_ptr;
+        m_cq_head = (unsigned *) (cq + params.cq_off.head);
+        m_cq_tail = (unsigned *) (cq + params.cq_off.tail);
+        m_cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+        m_cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+        return 0;
+    }
+
+    unsigned features() const { return m_features; }
+
+    /**
+     * 获取一个空闲的提交队列项，队列满时先把已经准备好的提交给内核
+     * 完成队列溢出时内核拒绝提交（EBUSY），带上 GETEVENTS 再试一次，让内核把溢出的完成事件搬进完成队列
+     * @return 清零后的提交队列项，仍然取不到时返回 nullptr，由调用者处理
+     */
+    io_uring_sqe *get_sqe() {
+        unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= m_sq_entries) {
+            int ret = enter(0, 0);
+            if (ret == -EBUSY || ret == -EAGAIN)
+                ret = enter(0, IORING_ENTER_GETEVENTS);
+            if (ret < 0)
+                return nullptr;
+            head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+            if (m_sqe_tail - head >= m_sq_entries)
+                return nullptr;
+        }
+        unsigned index = m_sqe_tail & m_sq_mask;
+        io_uring_sqe *sqe = m_sqes + index;
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        m_sq_array[index] = index;
+        m_sqe_tail++;
+        return sqe;
+    }
+
+    /**
+     * 提交所有已准备好的请求，并等待至少 wait_number 个完成事件，只需要一次系统调用
+     * @return 成功返回提交的个数，否则返回负的 errno
+     */
+    int submit_and_wait(unsigned wait_number) {
+        return enter(wait_number, wait_number ? IORING_ENTER_GETEVENTS : 0);
+    }
+
+    /**
+     * 遍历当前所有的完成事件
+     * @param handler 形如 void(io_uring_cqe *) 的处理函数
+     * @return 处理的完成事件个数
+     */
+    template<typename Handler>
+    unsigned for_each_cqe(Handler handler) {
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        while (head != tail) {
+            handler(m_cqes + (head & m_cq_mask));
+            ++head;
+            ++count;
+            // 处理函数可能继续提交请求，尽早归还完成队列空间
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+        return count;
+    }
+
+    /**
+     * 注册提供给内核的缓冲区环
+     * @return 成功返回 0，否则返回负的 errno
+     */
+    int register_buf_ring(io_uring_buf_ring *buf_ring, unsigned entries, unsigned short group_id) {
+        io_uring_buf_reg reg{};
+        reg.ring_addr = (unsigned long) buf_ring;
+        reg.ring_entries = entries;
+        reg.bgid = group_id;
+        if (syscall(__NR_io_uring_register, m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            return -errno;
+        return 0;
+    }
+
+private:
+    int m_ring_fd{-1};
+    unsigned m_features{};
+
+    void *m_sq_ptr{};
+    size_t m_sq_size{};
+    void *m_cq_ptr{};
+    size_t m_cq_size{};
+    io_uring_sqe *m_sqes{};
+    size_t m_sqes_size{};
+
+    unsigned *m_sq_head{};
+    unsigned *m_sq_tail{};
+    unsigned *m_sq_array{};
+    unsigned m_sq_mask{};
+    unsigned m_sq_entries{};
+    unsigned m_sqe_tail{};      // 本地已准备但未发布的提交队列尾
+
+    unsigned *m_cq_head{};
+    unsigned *m_cq_tail{};
+    unsigned m_cq_mask{};
+    io_uring_cqe *m_cqes{};
+
+private:
+    /**
+     * 发布本地准备好的提交队列项并调用 io_uring_enter
+     */
+    int enter(unsigned wait_number, unsigned flags) {
+        __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+        // 包括之前因为出错没有被内核取走的项
+        unsigned to_submit = m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (!to_submit && !wait_number)
+            return 0;
+        int ret = (int) syscall(__NR_io_uring_enter, m_ring_fd, to_submit, wait_number, flags, nullptr, 0);
+        return ret < 0 ? -errno : ret;
+    }
+};
+
+/**
+ * 在缓冲区环中加入一个缓冲区，调用 buf_ring_advance 之后内核才可见
+ * 注意 C++ 中 __DECLARE_FLEX_ARRAY 展开后的空结构体会占用空间，bufs 的偏移与内核不一致，
+ * 所以这里直接把缓冲区环当作 io_uring_buf 数组来寻址
+ */
+static inline void buf_ring_add(io_uring_buf_ring *buf_ring, unsigned mask, unsigned offset, void *addr,
+                                unsigned len, unsigned short bid) {
+    io_uring_buf *buf = (io_uring_buf *) buf_ring + ((buf_ring->tail + offset) & mask);
+    buf->addr = (unsigned long) addr;
+    buf->len = len;
+    buf->bid = bid;
+}
+
+static inline void buf_ring_advance(io_uring_buf_ring *buf_ring, unsigned count) {
+    __atomic_store_n(&buf_ring->tail, (unsigned short) (buf_ring->tail + count), __ATOMIC_RELEASE);
+}
+
+#endif //MYTINYWEBSERVER_IO_URING_H
@@ -0,0 +1,541 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/12 10:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <sys/epoll.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include "uring_loop.h"
+#include "../timer/coarse_clock.h"
+#include "../log/log.h"
+
+// 错误显示函数
+static void show_error(int conn_fd, const char *info) {
+    send(conn_fd, info, strlen(info), 0);
+    close(conn_fd);
+}
+
+UringLoop::UringLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users)
+        : EventLoop(id, port, thread_pool, users), m_buf_ring(nullptr), m_buffers(nullptr), m_conns(nullptr),
+          m_event_value(0), m_timer_value(0), m_signals{}, m_rearm(0), m_thread(), m_running(false) {
+}
+
+UringLoop::~UringLoop() {
+    if (m_buf_ring)
+        munmap(m_buf_ring, URING_BUFFER_NUMBER * sizeof(io_uring_buf));
+    delete[] m_buffers;
+    delete[] m_conns;
+}
+
+/**
+ * 创建 io_uring 实例与接收缓冲区环，唤醒用的 eventfd 由基类创建
+ * 任意一步失败都返回 false，由 EventLoop::create 回退到 epoll
+ * @return 是否成功
+ */
+bool UringLoop::init() {
+    if (!EventLoop::init())
+        return false;
+
+    int ret = m_ring.init(URING_QUEUE_DEPTH, IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN);
+    if (ret == -EINVAL)
+        ret = m_ring.init(URING_QUEUE_DEPTH, 0);
+    if (ret < 0) {
+        LOG_WARN("reactor %d: io_uring_setup failed: %s", m_id, strerror(-ret));
+        return false;
+    }
+    // 需要内核保证完成队列不丢事件，并支持在 socket 上的内部轮询
+    if (!(m_ring.features() & IORING_FEAT_NODROP) || !(m_ring.features() & IORING_FEAT_FAST_POLL)) {
+        LOG_WARN("reactor %d: io_uring features 0x%x not enough", m_id, m_ring.features());
+        return false;
+    }
+
+    /**
+     * 接收缓冲区环，内核从这里挑选缓冲区存放收到的数据
+     */
+    void *ring = mmap(nullptr, URING_BUFFER_NUMBER * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    m_buf_ring = (io_uring_buf_ring *) ring;
+    m_buf_ring->tail = 0;
+    ret = m_ring.register_buf_ring(m_buf_ring, URING_BUFFER_NUMBER, 0);
+    if (ret < 0) {
+        LOG_WARN("reactor %d: register buffer ring failed: %s", m_id, strerror(-ret));
+        return false;
+    }
+    m_buffers = new char[URING_BUFFER_NUMBER * URING_BUFFER_SIZE];
+    for (int i = 0; i < URING_BUFFER_NUMBER; ++i) {
+        buf_ring_add(m_buf_ring, URING_BUFFER_NUMBER - 1, i, m_buffers + i * URING_BUFFER_SIZE,
+                     URING_BUFFER_SIZE, i);
+    }
+    buf_ring_advance(m_buf_ring, URING_BUFFER_NUMBER);
+
+    // multishot accept 与缓冲区环都需要 5.19 以后的内核，在这里确认，而不是运行时才失败
+    if (!probe_multishot_accept()) {
+        LOG_WARN("reactor %d: io_uring multishot accept not supported", m_id);
+        return false;
+    }
+
+    m_conns = new ConnState[MAX_FD]();
+    return true;
+}
+
+/**
+ * 在一个临时的监听 socket 上提交 multishot accept 并马上取消
+ * 不支持的内核对 accept 直接返回 EINVAL，支持时 accept 被取消，返回 ECANCELED
+ * @return 是否支持
+ */
+bool UringLoop::probe_multishot_accept() {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        return false;
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *) &address, sizeof address) == -1 || listen(fd, 1) == -1) {
+        close(fd);
+        return false;
+    }
+
+    const unsigned long accept_data = 1, cancel_data = 2;
+    io_uring_sqe *sqe = m_ring.get_sqe();
+    if (!sqe) {
+        close(fd);
+        return false;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = accept_data;
+    sqe = m_ring.get_sqe();
+    if (!sqe) {
+        close(fd);
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = accept_data;
+    sqe->user_data = cancel_data;
+
+    int accept_result = 0;
+    int count = 0;
+    while (count < 2) {
+        int ret = m_ring.submit_and_wait(1);
+        if (ret < 0 && ret != -EINTR) {
+            accept_result = ret;
+            break;
+        }
+        m_ring.for_each_cqe([&](io_uring_cqe *cqe) {
+            if (cqe->user_data == accept_data) {
+                // 没有人连接这个 socket，万一取得了连接直接关闭
+                if (cqe->res >= 0)
+                    close(cqe->res);
+                // multishot 还在继续，等待取消之后的最后一个完成事件
+                if (cqe->flags & IORING_CQE_F_MORE)
+                    return;
+                if (cqe->res < 0)
+                    accept_result = cqe->res;
+            }
+            ++count;
+        });
+    }
+    close(fd);
+    return count == 2 && accept_result != -EINVAL && accept_result != -EOPNOTSUPP;
+}
+
+bool UringLoop::in_loop_thread() const {
+    return m_running && pthread_equal(pthread_self(), m_thread);
+}
+
+unsigned long UringLoop::make_user_data(OPERATION op, int fd) const {
+    unsigned long generation = 0;
+    if (fd >= 0 && fd < MAX_FD)
+        generation = m_conns[fd].generation.load(std::memory_order_relaxed) & 0xffffff;
+    return ((unsigned long) op << 56) | (generation << 32) | (unsigned) fd;
+}
+
+void UringLoop::loop() {
+    m_thread = pthread_self();
+    m_running = true;
+    LOG_INFO("reactor %d (%s) running...", m_id, name());
+
+    arm_accept();
+    arm_read(m_pipe_fd[0], m_signals, sizeof m_signals, OP_SIGNAL);
+    arm_read(m_wake_fd, &m_event_value, sizeof m_event_value, OP_WAKE);
+    arm_read(m_timer_fd, &m_timer_value, sizeof m_timer_value, OP_TIMER);
+
+    while (!m_stop) {
+        if (m_rearm)
+            rearm();
+        /**
+         * 一次系统调用完成上一轮产生的所有提交，并等待至少一个完成事件
+         */
+        int ret = m_ring.submit_and_wait(1);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+            printf("%s", "io_uring runtime failure!");
+            LOG_ERROR("io_uring runtime failure: %s", strerror(-ret));
+            break;
+        }
+        // 每轮只读一次时钟，本轮的定时器与日志都使用缓存的时间
+        CoarseClock::get_instance()->update();
+        m_ring.for_each_cqe([this](io_uring_cqe *cqe) { deal_cqe(cqe); });
+        if (m_timeout) {
+            timer_handler();
+            m_timeout = false;
+        }
+    }
+    m_running = false;
+}
+
+void UringLoop::deal_cqe(io_uring_cqe *cqe) {
+    auto op = (OPERATION) (cqe->user_data >> 56);
+    int fd = (int) (cqe->user_data & 0xffffffff);
+    unsigned generation = (cqe->user_data >> 32) & 0xffffff;
+
+    switch (op) {
+        case OP_ACCEPT:
+            deal_accept(cqe);
+            return;
+        case OP_SIGNAL:
+            if (cqe->res > 0)
+                deal_signal(m_signals, cqe->res);
+            arm_read(m_pipe_fd[0], m_signals, sizeof m_signals, OP_SIGNAL);
+            return;
+        case OP_TIMER:
+            if (cqe->res > 0)
+                deal_timer();
+            arm_read(m_timer_fd, &m_timer_value, sizeof m_timer_value, OP_TIMER);
+            return;
+        case OP_WAKE:
+            deal_wake();
+            arm_read(m_wake_fd, &m_event_value, sizeof m_event_value, OP_WAKE);
+            return;
+        default:
+            break;
+    }
+    /**
+     * 连接已经被关闭过，丢弃迟到的完成事件，但要归还占用的接收缓冲区
+     */
+    if (generation != (m_conns[fd].generation.load(std::memory_order_relaxed) & 0xffffff)) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        return;
+    }
+    if (op == OP_RECV)
+        deal_recv(fd, cqe);
+    else if (op == OP_SEND)
+        deal_send(fd, cqe);
+    else if (op == OP_POLL)
+        send_file(fd);
+}
+
+/**
+ * 处理 multishot accept 产生的新连接
+ */
+void UringLoop::deal_accept(io_uring_cqe *cqe) {
+    // 没有 IORING_CQE_F_MORE 表示 multishot 请求已经结束，需要重新提交
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        arm_accept();
+    if (cqe->res < 0) {
+        LOG_ERROR("%s:errno is:%d", "accept error", -cqe->res);
+        return;
+    }
+    int conn_fd = cqe->res;
+    if (http_conn::m_user_count >= MAX_FD || conn_fd >= MAX_FD) {
+        show_error(conn_fd, "Internal server busy");
+        LOG_ERROR("%s", "Internal server busy");
+        return;
+    }
+    sockaddr_in client_address{};
+    socklen_t client_addr_len = sizeof client_address;
+    getpeername(conn_fd, (struct sockaddr *) &client_address, &client_addr_len);
+
+    m_conns[conn_fd].generation.fetch_add(1, std::memory_order_relaxed);
+    add_client(conn_fd, client_address);
+    arm_recv(conn_fd);
+}
+
+/**
+ * 处理接收完成事件，把内核缓冲区中的数据拷贝进连接后立即归还缓冲区
+ */
+void UringLoop::deal_recv(int fd, io_uring_cqe *cqe) {
+    if (cqe->res == -ENOBUFS) {
+        // 接收缓冲区暂时用完，重新等待
+        arm_recv(fd);
+        return;
+    }
+    if (cqe->res <= 0) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            recycle_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        deal_close(fd);
+        return;
+    }
+    auto bid = (unsigned short) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    bool ok = m_users[fd].append_read(m_buffers + bid * URING_BUFFER_SIZE, cqe->res);
+    recycle_buffer(bid);
+
+    UtilTimer *timer = &m_users[fd].get_client_data()->timer;
+    if (ok) {
+        LOG_INFO("deal with the client(%s)", inet_ntoa(m_users[fd].get_address()->sin_addr));
+        m_thread_pool->append(m_users + fd);
+        if (timer->active()) {
+            adjust_timer(timer);
+        }
+    } else {
+        deal_close(fd);
+    }
+}
+
+/**
+ * 处理发送完成事件，MSG_WAITALL 保证除非出错，否则一次完成全部发送
+ */
+void UringLoop::deal_send(int fd, io_uring_cqe *cqe) {
+    if (cqe->res < 0 || cqe->res != m_conns[fd].sending) {
+        deal_close(fd);
+        return;
+    }
+    m_conns[fd].sending = 0;
+    finish_send(fd, m_users[fd].is_keepalive());
+}
+
+/**
+ * 用 sendfile 发送响应，sendfile 没有对应的 io_uring 操作，直接在事件循环线程中非阻塞调用，
+ * socket 发送缓冲区满时提交 POLLOUT，可写之后从记录的位置继续发送
+ */
+void UringLoop::send_file(int fd) {
+    http_conn &conn = m_users[fd];
+    if (!conn.send_pending()) {
+        deal_close(fd);
+        return;
+    }
+    if (conn.get_bytes_to_send() > 0) {
+        // 大文件发送时间可能很长，有进展就延长定时器
+        UtilTimer *timer = &conn.get_client_data()->timer;
+        if (timer->active()) {
+            adjust_timer(timer);
+        }
+        // 文件内容正在由 I/O 线程读入，读完之后通过 mod_fd 回到这里
+        if (!conn.is_waiting_io())
+            arm_poll_out(fd);
+        return;
+    }
+    finish_send(fd, false);
+}
+
+/**
+ * 响应全部发送完毕
+ * @param recv_armed 下一次接收是否已经与发送链接提交
+ */
+void UringLoop::finish_send(int fd, bool recv_armed) {
+    UtilTimer *timer = &m_users[fd].get_client_data()->timer;
+    if (m_users[fd].finish_write()) {
+        LOG_INFO("send data to the client(%s)", inet_ntoa(m_users[fd].get_address()->sin_addr));
+        // 读缓存区中还有流水线请求，继续交给线程池处理
+        if (m_users[fd].has_buffered_input())
+            m_thread_pool->append(m_users + fd);
+        else if (!recv_armed)
+            arm_recv(fd);
+        if (timer->active()) {
+            adjust_timer(timer);
+        }
+    } else {
+        deal_close(fd);
+    }
+}
+
+/**
+ * 处理工作线程交过来的请求，以及 I/O 线程交回的连接
+ */
+void UringLoop::deal_wake() {
+    m_pending_locker.lock();
+    m_pending_swap.swap(m_pending);
+    m_pending_locker.unlock();
+    for (const Pending &pending : m_pending_swap) {
+        if (pending.generation != m_conns[pending.fd].generation.load(std::memory_order_relaxed))
+            continue;
+        if (pending.ev == 0)
+            close_fd(pending.fd);
+        else
+            mod_fd(pending.fd, pending.ev);
+    }
+    m_pending_swap.clear();
+    deal_resume();
+}
+
+void UringLoop::queue_pending(int fd, int ev) {
+    Pending pending{fd, m_conns[fd].generation.load(std::memory_order_relaxed), ev};
+    m_pending_locker.lock();
+    bool was_empty = m_pending.empty();
+    m_pending.push_back(pending);
+    m_pending_locker.unlock();
+    // 队列原本不为空时，事件循环一定还会再处理一次队列，不需要重复唤醒
+    if (was_empty)
+        wake();
+}
+
+/**
+ * EPOLLIN 提交下一次接收，EPOLLOUT 发送已经准备好的响应
+ */
+void UringLoop::mod_fd(int fd, int ev) {
+    if (fd < 0 || fd >= MAX_FD)
+        return;
+    if (!in_loop_thread()) {
+        queue_pending(fd, ev);
+        return;
+    }
+    if (ev & EPOLLOUT)
+        submit_send(fd);
+    else if (ev & EPOLLIN)
+        arm_recv(fd);
+}
+
+void UringLoop::remove_fd(int fd) {
+    if (fd < 0 || fd >= MAX_FD)
+        return;
+    if (!in_loop_thread()) {
+        queue_pending(fd, 0);
+        return;
+    }
+    close_fd(fd);
+}
+
+/**
+ * 关闭连接，shutdown 让仍在内核中的请求尽快完成，之后它们的完成事件会因为代数不同被丢弃
+ */
+void UringLoop::close_fd(int fd) {
+    m_conns[fd].generation.fetch_add(1, std::memory_order_relaxed);
+    m_conns[fd].sending = 0;
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+}
+
+void UringLoop::recycle_buffer(unsigned short bid) {
+    buf_ring_add(m_buf_ring, URING_BUFFER_NUMBER - 1, 0, m_buffers + bid * URING_BUFFER_SIZE,
+                 URING_BUFFER_SIZE, bid);
+    buf_ring_advance(m_buf_ring, 1);
+}
+
+/**
+ * 取一个提交队列项，取不到时记录错误
+ * 监听、信号、定时器与唤醒这些常驻请求在下一轮循环重新提交；连接上的请求丢失之后连接会一直挂起，直接关闭
+ */
+io_uring_sqe *UringLoop::get_sqe(OPERATION op, int fd) {
+    io_uring_sqe *sqe = m_ring.get_sqe();
+    if (sqe)
+        return sqe;
+    if (op == OP_ACCEPT || op == OP_SIGNAL || op == OP_TIMER || op == OP_WAKE) {
+        LOG_ERROR("reactor %d: submission queue full, operation %d deferred", m_id, op);
+        m_rearm |= 1u << op;
+    } else {
+        LOG_ERROR("reactor %d: submission queue full, close fd %d", m_id, fd);
+        deal_close(fd);
+    }
+    return nullptr;
+}
+
+/**
+ * 重新提交上一轮没能提交的常驻请求
+ */
+void UringLoop::rearm() {
+    unsigned rearm = m_rearm;
+    m_rearm = 0;
+    if (rearm & (1u << OP_ACCEPT))
+        arm_accept();
+    if (rearm & (1u << OP_SIGNAL))
+        arm_read(m_pipe_fd[0], m_signals, sizeof m_signals, OP_SIGNAL);
+    if (rearm & (1u << OP_WAKE))
+        arm_read(m_wake_fd, &m_event_value, sizeof m_event_value, OP_WAKE);
+    if (rearm & (1u << OP_TIMER))
+        arm_read(m_timer_fd, &m_timer_value, sizeof m_timer_value, OP_TIMER);
+}
+
+void UringLoop::arm_accept() {
+    io_uring_sqe *sqe = get_sqe(OP_ACCEPT, m_listen_fd);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = make_user_data(OP_ACCEPT, m_listen_fd);
+}
+
+void UringLoop::arm_recv(int fd) {
+    io_uring_sqe *sqe = get_sqe(OP_RECV, fd);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = make_user_data(OP_RECV, fd);
+}
+
+void UringLoop::arm_read(int fd, void *buf, unsigned len, OPERATION op) {
+    io_uring_sqe *sqe = get_sqe(op, fd);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = (unsigned long) -1;
+    sqe->user_data = make_user_data(op, -1);
+}
+
+void UringLoop::arm_poll_out(int fd) {
+    io_uring_sqe *sqe = get_sqe(OP_POLL, fd);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = make_user_data(OP_POLL, fd);
+}
+
+/**
+ * 发送连接准备好的响应，长连接把下一次接收链接在发送之后，省去一次提交
+ */
+void UringLoop::submit_send(int fd) {
+    http_conn &conn = m_users[fd];
+    long bytes_to_send = conn.get_bytes_to_send();
+    if (bytes_to_send <= 0) {
+        // 与 epoll 一致：没有数据需要发送时重新等待读事件
+        conn.write();
+        return;
+    }
+    if (conn.has_sendfile()) {
+        send_file(fd);
+        return;
+    }
+    ConnState &state = m_conns[fd];
+    memset(&state.msg, 0, sizeof state.msg);
+    int iov_count = 0;
+    state.msg.msg_iov = conn.get_iovec(iov_count);
+    state.msg.msg_iovlen = iov_count;
+    state.sending = bytes_to_send;
+
+    io_uring_sqe *sqe = get_sqe(OP_SEND, fd);
+    if (!sqe)
+        return;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) &state.msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    sqe->user_data = make_user_data(OP_SEND, fd);
+    // 读缓存区中还有未处理的请求时先不接收，发送完成后交给线程池继续处理
+    if (conn.is_keepalive() && !conn.has_buffered_input()) {
+        sqe->flags |= IOSQE_IO_LINK;
+        arm_recv(fd);
+    }
+}
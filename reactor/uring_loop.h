@@ -0,0 +1,132 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/12 10:40
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_URING_LOOP_H
+#define MYTINYWEBSERVER_URING_LOOP_H
+
+#include <atomic>
+#include <vector>
+#include <sys/socket.h>
+#include "event_loop.h"
+#include "io_uring.h"
+#include "../lock/Locker.h"
+
+/**
+ * 基于 io_uring 的事件循环，完成通知模型：
+ * - 监听 socket 上挂一个 multishot accept，一次提交持续产生新连接
+ * - 接收使用内核提供的缓冲区环（provided buffer），没有数据的连接不占用接收缓冲区
+ * - 响应使用 sendmsg(MSG_WAITALL) 一次发送完所有的 iovec，长连接的下一次 recv 与之链接提交
+ * - 大文件在事件循环线程中用 sendfile 非阻塞发送，发送缓冲区满时提交 POLLOUT 等待可写
+ * - 每轮循环只调用一次 io_uring_enter，同时完成提交与等待
+ *
+ * 工作线程不能直接提交请求，mod_fd 与 remove_fd 会把请求放入队列并通过基类的 eventfd 唤醒事件循环。
+ */
+class UringLoop : public EventLoop {
+public:
+    UringLoop(int id, long port, ThreadPool<http_conn> *thread_pool, http_conn *users);
+
+    ~UringLoop() override;
+
+    bool init() override;
+
+    void loop() override;
+
+    void mod_fd(int fd, int ev) override;
+
+    void remove_fd(int fd) override;
+
+    const char *name() const override { return "uring"; }
+
+private:
+    // 完成事件对应的操作，编码在 user_data 的最高字节
+    enum OPERATION {
+        OP_ACCEPT = 1,
+        OP_RECV,
+        OP_SEND,
+        OP_SIGNAL,
+        OP_TIMER,
+        OP_WAKE,
+        OP_POLL
+    };
+
+    // 每个连接在本循环中的状态，按文件描述符下标
+    struct ConnState {
+        std::atomic<unsigned> generation;   // 连接关闭一次加一，用来丢弃已经关闭的连接迟到的完成事件
+        msghdr msg;                         // 发送中的 sendmsg 参数，需要保持到完成
+        long sending;                       // 发送中的字节数
+    };
+
+    // 工作线程交给事件循环的请求，ev 为 0 表示关闭连接
+    struct Pending {
+        int fd;
+        unsigned generation;
+        int ev;
+    };
+
+    IoUring m_ring;
+    io_uring_buf_ring *m_buf_ring;
+    char *m_buffers;
+    ConnState *m_conns;
+
+    unsigned long m_event_value;
+    unsigned long m_timer_value;
+    char m_signals[1024];
+
+    unsigned m_rearm;   // 因为取不到提交队列项而没有提交的常驻请求，按 1 << OPERATION，下一轮循环重新提交
+
+    pthread_t m_thread;
+    std::atomic<bool> m_running;
+    Locker m_pending_locker;
+    std::vector<Pending> m_pending;
+    std::vector<Pending> m_pending_swap;
+
+private:
+    bool in_loop_thread() const;
+
+    void queue_pending(int fd, int ev);
+
+    void deal_cqe(io_uring_cqe *cqe);
+
+    void deal_accept(io_uring_cqe *cqe);
+
+    void deal_recv(int fd, io_uring_cqe *cqe);
+
+    void deal_send(int fd, io_uring_cqe *cqe);
+
+    void send_file(int fd);
+
+    void finish_send(int fd, bool recv_armed);
+
+    void deal_wake();
+
+    bool probe_multishot_accept();
+
+    void rearm();
+
+    io_uring_sqe *get_sqe(OPERATION op, int fd);
+
+    void arm_accept();
+
+    void arm_recv(int fd);
+
+    void arm_read(int fd, void *buf, unsigned len, OPERATION op);
+
+    void arm_poll_out(int fd);
+
+    void submit_send(int fd);
+
+    void close_fd(int fd);
+
+    void recycle_buffer(unsigned short bid);
+
+    unsigned long make_user_data(OPERATION op, int fd) const;
+};
+
+#endif //MYTINYWEBSERVER_URING_LOOP_H
@@ -0,0 +1,141 @@
+//
+// Created by Cuyu Tang on 2023/4/15.
+//
+
+#ifndef MYTINYWEBSERVER_RINGQUEUE_H
+#define MYTINYWEBSERVER_RINGQUEUE_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <exception>
+
+// 缓存行大小，用来隔开会被不同线程频繁修改的变量，避免伪共享
+#define CACHE_LINE_SIZE 64
+
+/**
+ * 有界无锁多生产者多消费者环形队列（Vyukov 算法）
+ * 每个槽位带一个序号，生产者与消费者各自通过 CAS 抢占位置，不需要互斥锁，也不会为每个元素分配内存。
+ * 槽位与读写游标都按缓存行填充，生产者与消费者不会互相干扰对方的缓存行。
+ * @tparam T 元素类型，需要可以平凡拷贝（线程池中为请求指针）
+ */
+template<typename T>
+class RingQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+        char pad[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>) - sizeof(T)];
+    };
+
+    char m_pad0[CACHE_LINE_SIZE];
+    Cell *m_cells;
+    size_t m_mask;
+    char m_pad1[CACHE_LINE_SIZE];
+    std::atomic<size_t> m_enqueue_pos;  // 生产者游标
+    char m_pad2[CACHE_LINE_SIZE];
+    std::atomic<size_t> m_dequeue_pos;  // 消费者游标
+    char m_pad3[CACHE_LINE_SIZE];
+
+public:
+    /**
+     * @param capacity 最少能容纳的元素个数，向上取整到 2 的幂
+     */
+    explicit RingQueue(size_t capacity) : m_pad0(), m_cells(nullptr), m_mask(0), m_pad1(), m_enqueue_pos(0),
+                                          m_pad2(), m_dequeue_pos(0), m_pad3() {
+        if (capacity == 0)
+            throw std::exception();
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        void *memory = nullptr;
+        // 槽位数组按缓存行对齐，每个槽位独占一个缓存行
+        if (posix_memalign(&memory, CACHE_LINE_SIZE, size * sizeof(Cell)) != 0)
+            throw std::exception();
+        m_cells = (Cell *) memory;
+        for (size_t i = 0; i < size; ++i) {
+            new(&m_cells[i].sequence) std::atomic<size_t>(i);
+        }
+        m_mask = size - 1;
+    }
+
+    ~RingQueue() {
+        free(m_cells);
+    }
+
+    RingQueue(const RingQueue &) = delete;
+
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    // 队列实际容量
+    size_t capacity() const { return m_mask + 1; }
+
+    /**
+     * 入队，队列满时立即返回 false
+     * @param data 要入队的元素
+     * @return 是否成功
+     */
+    bool push(const T &data) {
+        Cell *cell;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = (long) sequence - (long) pos;
+            // 槽位空闲，尝试占用
+            if (diff == 0) {
+                if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位中的元素还没有被取走，队列已满
+                return false;
+            } else {
+                // 其它生产者抢先了，重新读取游标
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = data;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 出队，队列为空时立即返回 false
+     * @param data 存储出队的元素
+     * @return 是否成功
+     */
+    bool pop(T &data) {
+        Cell *cell;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &m_cells[pos & m_mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = (long) sequence - (long) (pos + 1);
+            // 槽位中有数据，尝试取走
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位还没有被写入，队列为空
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = cell->data;
+        // 把槽位留给下一轮的生产者
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * 近似的元素个数，只用于统计与负载估计
+     */
+    size_t size_approx() const {
+        size_t enqueue = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t dequeue = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+};
+
+#endif //MYTINYWEBSERVER_RINGQUEUE_H
@@ -6,9 +6,20 @@
 #define MYTINYWEBSERVER_THREADPOOL_H
 
 #include <pthread.h>
-#include <list>
+#include "RingQueue.h"
+#include "WorkStealingDeque.h"
 #include "../lock/Locker.h"
 
+/**
+ * 线程池的调度方式
+ * SCHEDULE_FIFO：所有线程共享一个请求队列
+ * SCHEDULE_STEAL：每个线程有自己的收件箱与工作窃取双端队列，空闲线程从其它线程窃取任务
+ */
+enum SCHEDULE_MODE {
+    SCHEDULE_FIFO = 0,
+    SCHEDULE_STEAL
+};
+
 /**
  * 线程池类
  * @tparam T
@@ -16,12 +27,27 @@
 template<typename T>
 class ThreadPool {
 private:
+    // 工作窃取模式下每个线程私有的队列
+    struct Worker {
+        RingQueue<T *> inbox;           // 事件循环投递进来的任务，其它线程也可以从这里取
+        WorkStealingDeque<T *> deque;   // 从收件箱批量转入，拥有者从底部取，其它线程从顶部窃取
+        std::atomic<int> active;        // 是否正在处理任务，用于负载估计
+
+        Worker(size_t capacity, long deque_size) : inbox(capacity), deque(deque_size), active(0) {}
+    };
+
+    static const int DEQUE_SIZE = 256;  // 每个线程双端队列的容量
+    static const int STEAL_BATCH = 32;  // 每次从收件箱转入双端队列的最大任务数
+
     int m_thread_number{};          // 线程池中现在的线程数
     int m_max_request{};            // 请求队列中允许的最大请求数
     pthread_t *m_threads{};         // 描述线程池的数组，其大小为 m_thread_number
-    std::list<T *> m_work_queue;    // 请求队列
-    Locker m_queue_locker;          // 保护请求队列的互斥锁
-    Sem m_queue_stat;               // 描述是否有任务需要处理的信号量
+    SCHEDULE_MODE m_schedule;       // 调度方式
+    RingQueue<T *> m_work_queue;    // 请求队列，预先分配的无锁环形队列
+    Worker **m_workers{};           // 工作窃取模式下每个线程的队列
+    std::atomic<unsigned> m_next_worker{0};     // 轮询分发的起点
+    std::atomic<int> m_worker_index{0};         // 给工作线程分配编号
+    EventCount m_queue_event;       // 空闲线程在这里休眠，等待新任务
     bool m_stop{};                  // 是否结束线程的标志
 
 private:
@@ -34,13 +60,22 @@ private:
 
     void run();
 
+    void run_steal(int index);
+
+    bool take(int index, T *&request);
+
+    bool append_steal(T *request);
+
+    size_t worker_load(int index) const;
+
 public:
     /**
      *
      * @param thread_number 默认线程池构造函数中的线程个数
      * @param max_request 等待处理的请求最大的数量
+     * @param schedule 调度方式
      */
-    ThreadPool(int thread_number = 8, int max_request = 10000);
+    ThreadPool(int thread_number = 8, int max_request = 10000, SCHEDULE_MODE schedule = SCHEDULE_FIFO);
 
     ~ThreadPool();
 
@@ -53,14 +88,24 @@ public:
  * @tparam T
  * @param thread_number
  * @param max_request
+ * @param schedule
  */
 template<typename T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_request) : m_thread_number(thread_number),
-                                                                m_max_request(max_request), m_stop(false),
-                                                                m_threads(nullptr) {
+ThreadPool<T>::ThreadPool(int thread_number, int max_request, SCHEDULE_MODE schedule)
+        : m_thread_number(thread_number), m_max_request(max_request), m_threads(nullptr), m_schedule(schedule),
+          m_work_queue(schedule == SCHEDULE_FIFO && max_request > 0 ? max_request : 1), m_stop(false) {
     // 判断参数是否有误
     if (thread_number <= 0 || max_request <= 0)
         throw std::exception();
+    /**
+     * 工作窃取模式下，总的排队上限按线程平均分给每个线程的收件箱
+     */
+    if (m_schedule == SCHEDULE_STEAL) {
+        m_workers = new Worker *[m_thread_number];
+        for (int i = 0; i < m_thread_number; ++i) {
+            m_workers[i] = new Worker(max_request / thread_number + 1, DEQUE_SIZE);
+        }
+    }
     // 新建线程池的数组，其大小为 m_thread_number
     m_threads = new pthread_t[m_thread_number];
     if (!m_threads)
@@ -93,6 +138,12 @@ template<typename T>
 ThreadPool<T>::~ThreadPool() {
     delete[] m_threads;
     m_stop = true;
+    if (m_workers) {
+        for (int i = 0; i < m_thread_number; ++i) {
+            delete m_workers[i];
+        }
+        delete[] m_workers;
+    }
 }
 
 /**
@@ -118,23 +169,23 @@ void *ThreadPool<T>::worker(void *arg) {
  */
 template<typename T>
 void ThreadPool<T>::run() {
+    if (m_schedule == SCHEDULE_STEAL) {
+        run_steal(m_worker_index.fetch_add(1));
+        return;
+    }
     // 在线程未停止的情况下不断在队列中取出数据进行执行
     while (!m_stop) {
-        // 等待任务需要处理的信号量
-        m_queue_stat.wait();
-        // 有任务需要进行处理，被唤醒后对队列进行加锁
-        m_queue_locker.lock();
-        // 如果请求队列为空，解锁，跳过后续操作
-        if (m_work_queue.empty()) {
-            m_queue_locker.unlock();
-            continue;
+        T *request = nullptr;
+        // 队列为空时先宣告等待，再检查一次，避免错过在两者之间入队的任务
+        if (!m_work_queue.pop(request)) {
+            unsigned key = m_queue_event.prepare_wait();
+            if (m_work_queue.pop(request)) {
+                m_queue_event.cancel_wait();
+            } else {
+                m_queue_event.wait(key);
+                continue;
+            }
         }
-        // 获取请求队列中的第一个请求
-        T *request = m_work_queue.front();
-        // 将这个请求从请求队列中去除
-        m_work_queue.pop_front();
-        // 去除对请求队列的加锁，给其它线程进行处理的机会
-        m_queue_locker.unlock();
         // 请求为空，不进行处理
         if (!request)
             continue;
@@ -143,25 +194,131 @@ void ThreadPool<T>::run() {
     }
 }
 
+/**
+ * 将请求放入队列，队列容量为 max_request 向上取整到 2 的幂
+ * @tparam T
+ * @param request 请求
+ * @return 队列已满时返回 false
+ */
 template<typename T>
 bool ThreadPool<T>::append(T *request) {
-    // 对请求队列进行加锁
-    m_queue_locker.lock();
-    // 判断此时队列是否已经满，队列已满，添加失败
-    if (m_work_queue.size() >= m_max_request) {
-        m_queue_locker.unlock();
+    if (m_schedule == SCHEDULE_STEAL)
+        return append_steal(request);
+    // 无锁入队，队列已满，添加失败
+    if (!m_work_queue.push(request))
         return false;
-    }
-    // 将新请求添加到队列中
-    m_work_queue.push_back(request);
-    // 对请求队列进行解锁
-    m_queue_locker.unlock();
-    // 以原子操作方式将队列信号量加一
-    m_queue_stat.post();
-    // 全部完成
+    // 有空闲线程在休眠时才需要唤醒
+    m_queue_event.notify_one();
     return true;
 }
 
 
+/**
+ * 工作窃取模式的工作线程
+ * 先取自己双端队列底部的任务，其次从收件箱批量转入，最后从其它线程窃取，都没有时休眠
+ * @tparam T
+ * @param index 工作线程编号
+ */
+template<typename T>
+void ThreadPool<T>::run_steal(int index) {
+    Worker *self = m_workers[index];
+    while (!m_stop) {
+        T *request = nullptr;
+        if (!take(index, request)) {
+            unsigned key = m_queue_event.prepare_wait();
+            if (take(index, request)) {
+                m_queue_event.cancel_wait();
+            } else {
+                m_queue_event.wait(key);
+                continue;
+            }
+        }
+        if (!request)
+            continue;
+        self->active.store(1, std::memory_order_relaxed);
+        request->process();
+        self->active.store(0, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * 为工作线程寻找下一个任务
+ * @tparam T
+ * @param index 工作线程编号
+ * @param request 取到的任务
+ * @return 是否取到
+ */
+template<typename T>
+bool ThreadPool<T>::take(int index, T *&request) {
+    Worker *self = m_workers[index];
+    if (self->deque.pop(request))
+        return true;
+    /**
+     * 把收件箱中的任务批量转入自己的双端队列，第一个直接处理，其余的可以被空闲线程窃取
+     */
+    long space = self->deque.free_space();
+    if (space > STEAL_BATCH)
+        space = STEAL_BATCH;
+    bool found = false;
+    T *item;
+    for (long i = 0; i < space && self->inbox.pop(item); ++i) {
+        if (!found) {
+            request = item;
+            found = true;
+        } else {
+            self->deque.push(item);
+        }
+    }
+    if (found)
+        return true;
+    /**
+     * 从其它线程窃取：先窃取双端队列顶部，再从它的收件箱中取
+     */
+    for (int i = 1; i < m_thread_number; ++i) {
+        Worker *victim = m_workers[(index + i) % m_thread_number];
+        if (victim->deque.steal(request) || victim->inbox.pop(request))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * 估计工作线程的负载：排队的任务数加上正在处理的任务
+ */
+template<typename T>
+size_t ThreadPool<T>::worker_load(int index) const {
+    Worker *worker = m_workers[index];
+    return worker->inbox.size_approx() + worker->deque.size_approx() +
+           worker->active.load(std::memory_order_relaxed);
+}
+
+/**
+ * 工作窃取模式的任务分发：从轮询位置开始，选择负载最小的工作线程
+ * @tparam T
+ * @param request 请求
+ * @return 所有收件箱都已满时返回 false
+ */
+template<typename T>
+bool ThreadPool<T>::append_steal(T *request) {
+    int start = (int) (m_next_worker.fetch_add(1, std::memory_order_relaxed) % m_thread_number);
+    int target = start;
+    size_t best = worker_load(start);
+    for (int i = 1; i < m_thread_number && best > 0; ++i) {
+        int index = (start + i) % m_thread_number;
+        size_t load = worker_load(index);
+        if (load < best) {
+            best = load;
+            target = index;
+        }
+    }
+    bool pushed = false;
+    for (int i = 0; i < m_thread_number && !pushed; ++i) {
+        pushed = m_workers[(target + i) % m_thread_number]->inbox.push(request);
+    }
+    if (!pushed)
+        return false;
+    m_queue_event.notify_one();
+    return true;
+}
 
 #endif //MYTINYWEBSERVER_THREADPOOL_H
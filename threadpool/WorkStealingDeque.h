@@ -0,0 +1,120 @@
+//
+// Created by Cuyu Tang on 2023/4/16.
+//
+
+#ifndef MYTINYWEBSERVER_WORKSTEALINGDEQUE_H
+#define MYTINYWEBSERVER_WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <exception>
+#include "RingQueue.h"
+
+/**
+ * 有界 Chase-Lev 工作窃取双端队列
+ * 只有拥有者线程可以 push/pop（在底部，后进先出），其它线程只能 steal（在顶部，先进先出）
+ * 内存序参照 Lê 等人在弱内存模型上的实现，容量固定，不做扩容
+ * @tparam T 元素类型，需要可以放进 std::atomic（线程池中为请求指针）
+ */
+template<typename T>
+class WorkStealingDeque {
+private:
+    char m_pad0[CACHE_LINE_SIZE];
+    std::atomic<long> m_top;        // 窃取者竞争的一端
+    char m_pad1[CACHE_LINE_SIZE];
+    std::atomic<long> m_bottom;     // 拥有者独占的一端
+    char m_pad2[CACHE_LINE_SIZE];
+    std::atomic<T> *m_buffer;
+    long m_mask;
+
+public:
+    /**
+     * @param capacity 最少能容纳的元素个数，向上取整到 2 的幂
+     */
+    explicit WorkStealingDeque(long capacity) : m_pad0(), m_top(0), m_pad1(), m_bottom(0), m_pad2(),
+                                                m_buffer(nullptr), m_mask(0) {
+        if (capacity <= 0)
+            throw std::exception();
+        long size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_buffer = new std::atomic<T>[size];
+        m_mask = size - 1;
+    }
+
+    ~WorkStealingDeque() {
+        delete[] m_buffer;
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    /**
+     * 拥有者在底部压入元素
+     * @return 队列已满时返回 false
+     */
+    bool push(T item) {
+        long bottom = m_bottom.load(std::memory_order_relaxed);
+        long top = m_top.load(std::memory_order_acquire);
+        if (bottom - top > m_mask)
+            return false;
+        m_buffer[bottom & m_mask].store(item, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * 拥有者从底部取出元素，只剩最后一个时与窃取者竞争
+     * @return 队列为空或者竞争失败时返回 false
+     */
+    bool pop(T &item) {
+        long bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long top = m_top.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            // 队列为空，恢复底部
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = m_buffer[bottom & m_mask].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // 最后一个元素，通过 CAS 与窃取者竞争
+            bool won = m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /**
+     * 其它线程从顶部窃取元素
+     * @return 队列为空或者竞争失败时返回 false
+     */
+    bool steal(T &item) {
+        long top = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long bottom = m_bottom.load(std::memory_order_acquire);
+        if (top >= bottom)
+            return false;
+        item = m_buffer[top & m_mask].load(std::memory_order_relaxed);
+        return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+    /**
+     * 近似的元素个数，只用于负载估计
+     */
+    long size_approx() const {
+        long size = m_bottom.load(std::memory_order_relaxed) - m_top.load(std::memory_order_relaxed);
+        return size > 0 ? size : 0;
+    }
+
+    // 还能压入的元素个数，只对拥有者准确
+    long free_space() const {
+        return m_mask + 1 - size_approx();
+    }
+};
+
+#endif //MYTINYWEBSERVER_WORKSTEALINGDEQUE_H
@@ -0,0 +1,221 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/29 10:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <pthread.h>
+#include <sched.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <vector>
+#include "RingQueue.h"
+#include "../lock/Locker.h"
+
+/**
+ * 线程池任务队列的性能测试
+ * 比较原来的链表 + 互斥锁 + 信号量队列与现在的无锁环形队列 + EventCount，
+ * 生产者与消费者的协议与 ThreadPool 相同：入队之后唤醒，队列为空时休眠
+ * 用法：bench_queue [生产者个数 消费者个数 [元素个数]]，不带参数时先测单线程的开销，再跑 1x1、2x2、4x4 三组
+ */
+
+static const int QUEUE_SIZE = 10000;
+
+/**
+ * 原来 ThreadPool 的请求队列
+ */
+class ListQueue {
+private:
+    std::list<int *> m_queue;
+    Locker m_locker;
+    Sem m_stat;
+
+public:
+    static const char *name() { return "list+mutex+sem"; }
+
+    bool push(int *item) {
+        m_locker.lock();
+        if (m_queue.size() >= QUEUE_SIZE) {
+            m_locker.unlock();
+            return false;
+        }
+        m_queue.push_back(item);
+        m_locker.unlock();
+        m_stat.post();
+        return true;
+    }
+
+    int *pop() {
+        while (true) {
+            m_stat.wait();
+            m_locker.lock();
+            if (m_queue.empty()) {
+                m_locker.unlock();
+                continue;
+            }
+            int *item = m_queue.front();
+            m_queue.pop_front();
+            m_locker.unlock();
+            return item;
+        }
+    }
+};
+
+/**
+ * 现在 ThreadPool 的请求队列
+ */
+class RingEventQueue {
+private:
+    RingQueue<int *> m_queue{QUEUE_SIZE};
+    EventCount m_event;
+
+public:
+    static const char *name() { return "ring+eventcount"; }
+
+    bool push(int *item) {
+        if (!m_queue.push(item))
+            return false;
+        m_event.notify_one();
+        return true;
+    }
+
+    int *pop() {
+        int *item = nullptr;
+        while (!m_queue.pop(item)) {
+            unsigned key = m_event.prepare_wait();
+            if (m_queue.pop(item)) {
+                m_event.cancel_wait();
+                break;
+            }
+            m_event.wait(key);
+        }
+        return item;
+    }
+};
+
+template<typename Queue>
+struct Context {
+    Queue queue;
+    long items;             // 每个生产者入队的元素个数
+    int item;               // 入队的非空指针，消费者收到 nullptr 时退出
+    long consumed[64];      // 每个消费者取出的元素个数
+};
+
+template<typename Queue>
+struct Argument {
+    Context<Queue> *context;
+    int index;
+};
+
+template<typename Queue>
+static void *producer(void *arg) {
+    Context<Queue> *context = ((Argument<Queue> *) arg)->context;
+    for (long i = 0; i < context->items; ++i) {
+        // 与事件循环一样，队列满时让出处理器之后重试
+        while (!context->queue.push(&context->item))
+            sched_yield();
+    }
+    return nullptr;
+}
+
+template<typename Queue>
+static void *consumer(void *arg) {
+    auto *argument = (Argument<Queue> *) arg;
+    long count = 0;
+    while (argument->context->queue.pop())
+        ++count;
+    argument->context->consumed[argument->index] = count;
+    return nullptr;
+}
+
+/**
+ * 所有生产者入队完成之后给每个消费者一个 nullptr，等全部取完计时结束
+ * @return 每秒入队并出队的元素个数
+ */
+template<typename Queue>
+static double run(int producers, int consumers, long items) {
+    auto *context = new Context<Queue>();
+    context->items = items / producers;
+    std::vector<pthread_t> threads(producers + consumers);
+    std::vector<Argument<Queue>> arguments(producers + consumers);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < consumers; ++i) {
+        arguments[i] = {context, i};
+        pthread_create(&threads[i], nullptr, consumer<Queue>, &arguments[i]);
+    }
+    for (int i = 0; i < producers; ++i) {
+        arguments[consumers + i] = {context, consumers + i};
+        pthread_create(&threads[consumers + i], nullptr, producer<Queue>, &arguments[consumers + i]);
+    }
+    for (int i = 0; i < producers; ++i)
+        pthread_join(threads[consumers + i], nullptr);
+    for (int i = 0; i < consumers; ++i) {
+        while (!context->queue.push(nullptr))
+            sched_yield();
+    }
+    long total = 0;
+    for (int i = 0; i < consumers; ++i) {
+        pthread_join(threads[i], nullptr);
+        total += context->consumed[i];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    bool ok = total == context->items * producers;
+    delete context;
+    if (!ok) {
+        fprintf(stderr, "%s: lost elements\n", Queue::name());
+        exit(1);
+    }
+    return (double) total / seconds;
+}
+
+/**
+ * 单个线程交替入队与出队，不会休眠，只有队列本身的开销
+ * @return 每次入队加出队的纳秒数
+ */
+template<typename Queue>
+static double single(long items) {
+    auto *context = new Context<Queue>();
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < items; ++i) {
+        context->queue.push(&context->item);
+        context->queue.pop();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    delete context;
+    return seconds * 1e9 / (double) items;
+}
+
+static void compare(int producers, int consumers, long items) {
+    double list = run<ListQueue>(producers, consumers, items);
+    double ring = run<RingEventQueue>(producers, consumers, items);
+    printf("%dP x %dC  %s %8.2f Mops/s  %s %8.2f Mops/s  x%.2f\n", producers, consumers, ListQueue::name(),
+           list / 1e6, RingEventQueue::name(), ring / 1e6, ring / list);
+}
+
+int main(int argc, char *argv[]) {
+    long items = 2000000;
+    if (argc >= 3) {
+        int producers = atoi(argv[1]);
+        int consumers = atoi(argv[2]);
+        if (argc >= 4)
+            items = atol(argv[3]);
+        if (producers <= 0 || consumers <= 0 || consumers > 64 || items < producers) {
+            fprintf(stderr, "usage: %s [producers consumers [items]]\n", argv[0]);
+            return 1;
+        }
+        compare(producers, consumers, items);
+        return 0;
+    }
+    printf("1 thread  %s %8.1f ns/op   %s %8.1f ns/op\n", ListQueue::name(), single<ListQueue>(items),
+           RingEventQueue::name(), single<RingEventQueue>(items));
+    compare(1, 1, items);
+    compare(2, 2, items);
+    compare(4, 4, items);
+    return 0;
+}
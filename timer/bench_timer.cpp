@@ -0,0 +1,224 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/29 14:10
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "timer.h"
+#include "coarse_clock.h"
+
+/**
+ * 定时器的性能测试
+ * 比较原来的升序链表与现在的时间轮在 1k、10k、60k 个活动定时器下每种操作的开销。
+ * 操作模拟服务器的用法：新连接 add、收到数据 adjust（到期时间推后一个超时时间）、关闭 del、定时 tick。
+ * 每种操作测量 OPERATIONS 次，期间活动定时器的个数保持不变
+ * 用法：bench_timer [活动定时器个数...]
+ */
+
+static const int OPERATIONS = 2000;
+
+/**
+ * 原来的升序双向链表，插入从表头开始查找位置，调整时从下一个节点开始向后查找
+ * 与原来的实现相同，只是不释放节点（节点属于连接）
+ */
+class SortTimerList {
+public:
+    static const char *name() { return "sorted list"; }
+
+    bool add_timer(UtilTimer *timer) {
+        timer->prev = timer->next = nullptr;
+        if (!head) {
+            head = tail = timer;
+            return true;
+        }
+        if (timer->expire < head->expire) {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+            return true;
+        }
+        add_timer(timer, head);
+        return true;
+    }
+
+    bool adjust_timer(UtilTimer *timer) {
+        UtilTimer *temp = timer->next;
+        if (!temp || (timer->expire < temp->expire))
+            return false;
+        if (timer == head) {
+            head = head->next;
+            head->prev = nullptr;
+            timer->next = nullptr;
+            add_timer(timer, head);
+        } else {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+            add_timer(timer, timer->next);
+        }
+        return true;
+    }
+
+    bool del_timer(UtilTimer *timer) {
+        if (timer == head && timer == tail) {
+            head = tail = nullptr;
+        } else if (timer == head) {
+            head = head->next;
+            head->prev = nullptr;
+        } else if (timer == tail) {
+            tail = tail->prev;
+            tail->next = nullptr;
+        } else {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = nullptr;
+        return true;
+    }
+
+    void tick() {
+        long long cur = CoarseClock::get_instance()->now_ms();
+        while (head && head->expire <= cur) {
+            UtilTimer *tmp = head;
+            head = tmp->next;
+            if (head)
+                head->prev = nullptr;
+            else
+                tail = nullptr;
+            tmp->cb_func(tmp->client_data);
+        }
+    }
+
+private:
+    UtilTimer *head = nullptr;
+    UtilTimer *tail = nullptr;
+
+    void add_timer(UtilTimer *timer, UtilTimer *list_head) {
+        UtilTimer *prev = list_head;
+        UtilTimer *temp = prev->next;
+        while (temp) {
+            if (timer->expire < temp->expire) {
+                prev->next = timer;
+                timer->prev = prev;
+                timer->next = temp;
+                temp->prev = timer;
+                return;
+            }
+            prev = temp;
+            temp = temp->next;
+        }
+        prev->next = timer;
+        timer->prev = prev;
+        timer->next = nullptr;
+        tail = timer;
+    }
+};
+
+class Wheel : public TimeWheel {
+public:
+    static const char *name() { return "time wheel"; }
+};
+
+static void expired(ClientData *) {
+}
+
+struct Result {
+    double add;
+    double adjust;
+    double del;
+    double tick;
+};
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * 先放入 live 个定时器，到期时间按连接先后递增，再分别测量每种操作
+ * 到期时间都在一个超时时间之后，测量期间不会有定时器到期，tick 只有扫描的开销
+ */
+template<typename Timers>
+static Result run(int live) {
+    std::vector<ClientData> clients(live + OPERATIONS);
+    long long now = CoarseClock::get_instance()->now_ms();
+    long long expire = now + CONN_TIMEOUT_MS;
+    for (ClientData &client : clients) {
+        client.timer.cb_func = expired;
+        client.timer.client_data = &client;
+    }
+    Timers timers;
+    for (int i = 0; i < live; ++i) {
+        clients[i].timer.expire = expire++;
+        timers.add_timer(&clients[i].timer);
+    }
+
+    Result result{};
+    // 新连接，到期时间晚于所有已有的定时器
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < OPERATIONS; ++i) {
+        clients[live + i].timer.expire = expire++;
+        timers.add_timer(&clients[live + i].timer);
+    }
+    result.add = elapsed_ns(start) / OPERATIONS;
+
+    // 收到数据的连接随机分布，到期时间推到最后
+    srand(1);
+    std::vector<int> picks(OPERATIONS);
+    for (int &pick : picks)
+        pick = rand() % (live + OPERATIONS);
+    start = std::chrono::steady_clock::now();
+    for (int pick : picks) {
+        clients[pick].timer.expire = expire++;
+        timers.adjust_timer(&clients[pick].timer);
+    }
+    result.adjust = elapsed_ns(start) / OPERATIONS;
+
+    // 关闭刚才新加入的连接，活动定时器回到 live 个
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < OPERATIONS; ++i)
+        timers.del_timer(&clients[live + i].timer);
+    result.del = elapsed_ns(start) / OPERATIONS;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < OPERATIONS; ++i)
+        timers.tick();
+    result.tick = elapsed_ns(start) / OPERATIONS;
+
+    for (int i = 0; i < live; ++i)
+        timers.del_timer(&clients[i].timer);
+    return result;
+}
+
+template<typename Timers>
+static void report(int live) {
+    Result result = run<Timers>(live);
+    printf("%6d  %-12s add %10.1f  adjust %10.1f  del %8.1f  tick %8.1f  ns/op\n", live, Timers::name(),
+           result.add, result.adjust, result.del, result.tick);
+}
+
+int main(int argc, char *argv[]) {
+    CoarseClock::get_instance()->update();
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        int live = atoi(argv[i]);
+        if (live <= 0) {
+            fprintf(stderr, "usage: %s [live_timers...]\n", argv[0]);
+            return 1;
+        }
+        sizes.push_back(live);
+    }
+    if (sizes.empty())
+        sizes = {1000, 10000, 60000};
+    for (int live : sizes) {
+        report<SortTimerList>(live);
+        report<Wheel>(live);
+    }
+    return 0;
+}
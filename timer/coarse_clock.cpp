@@ -0,0 +1,114 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/18 14:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#include <cstdio>
+#include <cstring>
+#include "coarse_clock.h"
+
+CoarseClock::CoarseClock() : m_mono_ms(0), m_wall_ms(0), m_date_sec(-1), m_seq(0), m_date() {
+    update();
+}
+
+/**
+ * 单调时钟与墙上时间都使用 vDSO 中的 coarse 时钟，不进入内核
+ * 秒数变化时才重新格式化日期字符串
+ */
+void CoarseClock::update() {
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    m_mono_ms.store((long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    m_wall_ms.store((long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+
+    if (ts.tv_sec == m_date_sec.load(std::memory_order_relaxed))
+        return;
+    /**
+     * 偶数表示没有写者，抢到后变为奇数；抢不到说明其它事件循环正在更新，直接返回
+     */
+    unsigned seq = m_seq.load(std::memory_order_relaxed);
+    if ((seq & 1) || !m_seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire))
+        return;
+    // 日期字符串的写入不能被重排到版本号变为奇数之前
+    std::atomic_thread_fence(std::memory_order_release);
+    if (ts.tv_sec != m_date_sec.load(std::memory_order_relaxed)) {
+        format(ts.tv_sec);
+        m_date_sec.store(ts.tv_sec, std::memory_order_relaxed);
+    }
+    m_seq.store(seq + 2, std::memory_order_release);
+}
+
+/**
+ * 格式化日期，调用者持有顺序锁
+ * @param sec 墙上时间
+ */
+void CoarseClock::format(time_t sec) {
+    tm local_tm{};
+    localtime_r(&sec, &local_tm);
+
+    m_date.sec = sec;
+    m_date.year = local_tm.tm_year + 1900;
+    m_date.mon = local_tm.tm_mon + 1;
+    m_date.mday = local_tm.tm_mday;
+    // 按 int 的最大宽度准备缓冲区；年份不是四位数时长度不对，换成同样宽度的占位，日志按固定宽度读取
+    char text[80];
+    int n = snprintf(text, sizeof text, "%d-%02d-%02d %02d:%02d:%02d",
+                     m_date.year, m_date.mon, m_date.mday, local_tm.tm_hour, local_tm.tm_min, local_tm.tm_sec);
+    memcpy(m_date.log_date, n == LOG_DATE_LENGTH - 1 ? text : "0000-00-00 00:00:00", LOG_DATE_LENGTH);
+    format_http_date(sec, m_date.http_date);
+}
+
+static const char *WEEK[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char *MONTH[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                              "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+void CoarseClock::format_http_date(time_t sec, char *buf) {
+    tm gmt_tm{};
+    gmtime_r(&sec, &gmt_tm);
+    // IMF-fixdate 只能表示四位数的年份，其它情况换成同样宽度的纪元时间，响应头按固定宽度追加
+    char text[80];
+    int n = snprintf(text, sizeof text, "%s, %02d %s %d %02d:%02d:%02d GMT",
+                     WEEK[gmt_tm.tm_wday], gmt_tm.tm_mday, MONTH[gmt_tm.tm_mon], gmt_tm.tm_year + 1900,
+                     gmt_tm.tm_hour, gmt_tm.tm_min, gmt_tm.tm_sec);
+    memcpy(buf, n == HTTP_DATE_LENGTH - 1 ? text : "Thu, 01 Jan 1970 00:00:00 GMT", HTTP_DATE_LENGTH);
+}
+
+bool CoarseClock::parse_http_date(const char *text, time_t &sec) {
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    if (strlen(text) != HTTP_DATE_LENGTH - 1 || text[3] != ',' || strcmp(text + 25, " GMT") != 0)
+        return false;
+    tm gmt_tm{};
+    int month = -1;
+    for (int i = 0; i < 12; ++i) {
+        if (strncmp(text + 8, MONTH[i], 3) == 0)
+            month = i;
+    }
+    if (month < 0 || sscanf(text + 5, "%2d", &gmt_tm.tm_mday) != 1 ||
+        sscanf(text + 12, "%4d %2d:%2d:%2d", &gmt_tm.tm_year, &gmt_tm.tm_hour, &gmt_tm.tm_min, &gmt_tm.tm_sec) != 4)
+        return false;
+    gmt_tm.tm_mon = month;
+    gmt_tm.tm_year -= 1900;
+    sec = timegm(&gmt_tm);
+    return sec != -1;
+}
+
+/**
+ * 顺序锁的读端：写者正在写或者读的过程中版本号变化都重新读
+ * @param date 日期快照
+ */
+void CoarseClock::read(DateCache &date) const {
+    unsigned seq;
+    do {
+        seq = m_seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+        memcpy(&date, &m_date, sizeof date);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+}
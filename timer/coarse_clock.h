@@ -0,0 +1,77 @@
+/********************************************************************************
+* @author: Cuyu Tang
+* @email: me@expoli.tech
+* @website: www.expoli.tech
+* @date: 2023/4/18 14:30
+* @version: 1.0
+* @description: 
+********************************************************************************/
+
+
+#ifndef MYTINYWEBSERVER_COARSE_CLOCK_H
+#define MYTINYWEBSERVER_COARSE_CLOCK_H
+
+#include <atomic>
+#include <ctime>
+
+/**
+ * 进程内共享的粗粒度时钟
+ * 事件循环每轮以及每次定时器 tick 时调用 update 更新一次，其它地方只读取缓存的值，
+ * 不再在每个事件、每条日志上调用 time、gettimeofday 与 localtime（localtime 内部有 glibc 的锁）。
+ *
+ * 毫秒时间是原子变量；格式化好的日期字符串每秒最多更新一次，由顺序锁（seqlock）保护，
+ * 读者不加锁，读到一半被更新时重试。多个事件循环同时 update 时只有一个会真正写入。
+ */
+class CoarseClock {
+public:
+    static const int LOG_DATE_LENGTH = 20;      // "2023-04-18 14:30:00"
+    static const int HTTP_DATE_LENGTH = 30;     // "Tue, 18 Apr 2023 06:30:00 GMT"
+
+    // 某一秒的日期快照
+    struct DateCache {
+        time_t sec;         // 墙上时间，秒
+        int year;           // 本地时间的年月日，日志按天分文件时使用
+        int mon;
+        int mday;
+        char log_date[LOG_DATE_LENGTH];     // 本地时间，日志行前缀
+        char http_date[HTTP_DATE_LENGTH];   // GMT 时间，HTTP Date 响应头
+    };
+
+public:
+    static CoarseClock *get_instance() {
+        static CoarseClock instance;
+        return &instance;
+    }
+
+    // 读取系统时钟并刷新缓存，由事件循环调用
+    void update();
+
+    // 缓存的单调时钟，毫秒，用于定时器
+    long long now_ms() const { return m_mono_ms.load(std::memory_order_relaxed); }
+
+    // 缓存的墙上时间，毫秒
+    long long wall_ms() const { return m_wall_ms.load(std::memory_order_relaxed); }
+
+    // 拷贝一份当前的日期快照
+    void read(DateCache &date) const;
+
+    // 格式化 HTTP 日期（IMF-fixdate），buf 至少 HTTP_DATE_LENGTH 字节
+    static void format_http_date(time_t sec, char *buf);
+
+    // 解析 IMF-fixdate 格式的 HTTP 日期，不接受已经废弃的其它格式
+    static bool parse_http_date(const char *text, time_t &sec);
+
+private:
+    CoarseClock();
+
+    void format(time_t sec);
+
+private:
+    std::atomic<long long> m_mono_ms;
+    std::atomic<long long> m_wall_ms;
+    std::atomic<time_t> m_date_sec;     // m_date 对应的秒数
+    std::atomic<unsigned> m_seq;        // 顺序锁，奇数表示正在写
+    DateCache m_date;
+};
+
+#endif //MYTINYWEBSERVER_COARSE_CLOCK_H
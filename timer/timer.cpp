@@ -9,163 +9,142 @@
 
 
 #include "timer.h"
+#include "coarse_clock.h"
 #include "../log/log.h"
 
+/**
+ * @param interval 槽位间隔
+ * @param slot_number 槽位个数
+ */
+TimeWheel::TimeWheel(int interval, int slot_number) : m_interval(interval > 0 ? interval : 1),
+                                                      m_slot_number(slot_number > 0 ? slot_number : 1) {
+    m_slots = new UtilTimer *[m_slot_number]();
+    m_current = tick_of(CoarseClock::get_instance()->now_ms());
+}
+
+/**
+ * 定时器节点属于连接对象，这里只摘下剩余的节点
+ */
+TimeWheel::~TimeWheel() {
+    for (int i = 0; i < m_slot_number; ++i) {
+        while (m_slots[i])
+            unlink(m_slots[i]);
+    }
+    delete[] m_slots;
+}
+
+/**
+ * 到期时间对应的槽位序号，向上取整，保证槽位被处理时其中的定时器都已经到期
+ * @param expire 到期时间
+ * @return 绝对槽位序号
+ */
+long TimeWheel::tick_of(long long expire) const {
+    return (long) ((expire + m_interval - 1) / m_interval);
+}
+
+/**
+ * 把定时器挂到对应槽位的链表头部，已经过期的定时器放到下一个要处理的槽位
+ * @param timer
+ */
+void TimeWheel::link(UtilTimer *timer) {
+    long tick = tick_of(timer->expire);
+    if (tick < m_current)
+        tick = m_current;
+    int slot = (int) (tick % m_slot_number);
+    timer->slot = slot;
+    timer->prev = nullptr;
+    timer->next = m_slots[slot];
+    if (m_slots[slot])
+        m_slots[slot]->prev = timer;
+    m_slots[slot] = timer;
+}
+
+/**
+ * 从所在槽位的链表中摘下定时器
+ * @param timer
+ */
+void TimeWheel::unlink(UtilTimer *timer) {
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        m_slots[timer->slot] = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    timer->slot = -1;
+}
+
 /**
  * 添加定时器
- * todo 添加定时器这个部分应该是有 bug，不确定，再看看
  * @param timer 要添加的定时器
  * @return
  */
-bool SortTimerList::add_timer(UtilTimer *timer) {
-    if (!timer) {
+bool TimeWheel::add_timer(UtilTimer *timer) {
+    if (!timer || timer->active()) {
         return false;
     }
-    if (!head) {
-        head = tail = timer;
-        return true;
-    }
-    /**
-     * 如果插入的定时器的时间最小，就把它放在队头
-     */
-    if (timer->expire < head->expire) {
-        timer->next = head;
-        head->prev = timer;
-        head = timer;
-        return true;
-    }
-    /**
-     * 调用私有方法，两个参数的重载版本
-     */
-    add_timer(timer, head);
+    link(timer);
     return true;
 }
 
-// 给我写出这一块的代码是什么意思
-bool SortTimerList::adjust_timer(UtilTimer *timer) {
-    if (!timer) {
-        return false;
-    }
-    /**
-     * 判断一个定时器下一个结点是否是空
-     * 或者顺序错误
-     */
-    UtilTimer *temp = timer->next;
-    if (!temp || (timer->expire < temp->expire)) {
+/**
+ * 定时器的到期时间改变后，重新放到对应的槽位
+ * @param timer 要调整的定时器
+ * @return
+ */
+bool TimeWheel::adjust_timer(UtilTimer *timer) {
+    if (!timer || !timer->active()) {
         return false;
     }
-    /**
-     * 当定时器与头结点一样的时候，把头结点摘掉
-     * 重新进行插入
-     */
-    if (timer == head) {
-        head = head->next;
-        head->prev = nullptr;
-        timer->next = nullptr;
-        add_timer(timer, head);
-        return true;
-    } else {
-        /**
-         * 将该结点拿出来，然后重新进行插入操作
-         */
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        add_timer(timer, timer->next);
+    // 仍然落在同一个槽位，不需要移动
+    long tick = tick_of(timer->expire);
+    if (tick >= m_current && tick % m_slot_number == timer->slot)
         return true;
-    }
+    unlink(timer);
+    link(timer);
+    return true;
 }
 
 /**
- * 删除定时器
+ * 从时间轮上摘下定时器
  * @param timer 要删除的定时器
  * @return
  */
-bool SortTimerList::del_timer(UtilTimer *timer) {
-    if (!timer)
+bool TimeWheel::del_timer(UtilTimer *timer) {
+    if (!timer || !timer->active())
         return false;
-    /**
-     * 当前队列中只有一个结点。
-     */
-    if ((timer == head) && (timer == tail)) {
-        delete timer;
-        head = nullptr;
-        tail = nullptr;
-        return true;
-    }
-    if (timer == head) {
-        head = head->next;
-        head->prev = nullptr;
-        delete timer;
-        return true;
-    }
-    if (timer == tail) {
-        tail = tail->prev;
-        tail->next = nullptr;
-        delete timer;
-        return true;
-    }
-    timer->prev->next = timer->next;
-    timer->next->prev = timer->prev;
-    delete timer;
+    unlink(timer);
     return true;
 }
 
 /**
- * 定时触发函数，同时检查是否有定时器超时
- * 如果有那就调用对应的回调函数，并删除对应的定时器
+ * 定时触发函数，处理从上次 tick 到现在经过的所有槽位
+ * 到期的定时器先摘下，再调用回调函数
  */
-void SortTimerList::tick() {
-    if (!head)
-        return;
+void TimeWheel::tick() {
     /**
-     * 输出日志，并直接刷新缓冲区
+     * 输出日志
      */
     LOG_INFO("%s", "timer tick");
-    Log::get_instance()->flush();
 
-    time_t cur = time(nullptr);
-    UtilTimer *tmp = head;
-    while (tmp) {
-        // 还未到定时器的超时时间
-        if (cur < tmp->expire) {
-            break;
+    long long cur = CoarseClock::get_instance()->now_ms();
+    long now = (long) (cur / m_interval);
+    // 最多处理一整圈，更久没有 tick 时每个槽位也只需要扫描一次
+    if (now - m_current >= m_slot_number)
+        m_current = now - m_slot_number + 1;
+    for (; m_current <= now; ++m_current) {
+        int slot = (int) (m_current % m_slot_number);
+        UtilTimer *tmp = m_slots[slot];
+        while (tmp) {
+            UtilTimer *next = tmp->next;
+            // 属于之后几圈的定时器，留在原地
+            if (tmp->expire <= cur) {
+                unlink(tmp);
+                // 达到了超时时间，调用回调函数
+                tmp->cb_func(tmp->client_data);
+            }
+            tmp = next;
         }
-        // 达到了超时时间，调用回调函数
-        tmp->cb_func(tmp->client_data);
-        // 更新定时器队列数据
-        head = tmp->next;
-        if (head) {
-            head->prev = nullptr;
-        }
-        delete tmp;
-        tmp = head;
     }
 }
-
-/**
- * 向有序队列中添加定时器
- * @param timer 要添加的定时器
- * @param list_head 队列头
- */
-void SortTimerList::add_timer(UtilTimer *timer, UtilTimer *list_head) {
-    UtilTimer *prev = list_head;
-    UtilTimer *temp = prev->next;
-
-    while (temp) {
-        // 找到了插入位置
-        if (timer->expire < temp->expire) {
-            prev->next = timer;
-            timer->prev = prev;
-            timer->next = temp;
-            temp->prev = timer;
-            return;
-        }
-        prev = temp;
-        temp = temp->next;
-    }
-    // 插入位置在末尾
-    prev->next = timer;
-    timer->prev = prev;
-    timer->next = nullptr;
-    tail = timer;
-}
\ No newline at end of file
@@ -12,47 +12,60 @@
 #define MYTINYWEBSERVER_TIMER_H
 
 #include <netinet/in.h>
+#include <ctime>
+#include "../config/config.h"
 
-class UtilTimer;
+struct ClientData;
 
-/**
- * 客户端数据信息结构体
- */
-struct ClientData {
-    sockaddr_in address;
-    int socket_fd;
-    UtilTimer *timer;
-};
+class EventLoop;
 
 /**
  * 时间工具类
+ * 定时器节点嵌入在每个连接的 ClientData 中，随连接对象一起预先分配，时间轮只负责链接，不负责释放
  */
 class UtilTimer {
 public:
-    UtilTimer() : prev(nullptr), next(nullptr) {}
+    UtilTimer() : prev(nullptr), next(nullptr), slot(-1) {}
+
+    // 是否挂在时间轮上
+    bool active() const { return slot >= 0; }
 
 public:
-    time_t expire{};
+    long long expire{};    // 到期时间，CoarseClock 的单调时钟毫秒
 
     void (*cb_func)(ClientData *){};
 
     ClientData *client_data{};
     UtilTimer *prev;
     UtilTimer *next;
+    int slot;   // 所在时间轮槽位，-1 表示不在时间轮中
+};
+
+/**
+ * 客户端数据信息结构体
+ */
+struct ClientData {
+    sockaddr_in address;
+    int socket_fd;
+    EventLoop *loop;    // 连接所属的事件循环，定时器只由这个循环的线程操作
+    UtilTimer timer;
 };
 
-class SortTimerList {
+/**
+ * 哈希时间轮
+ * 定时器按到期时间落在 ceil(expire / interval) 对应的槽位中，每个槽位是一个双向链表，
+ * 添加、调整、删除都是 O(1)；tick 依次处理从上次 tick 到现在经过的所有槽位，
+ * 只触发已经到期的定时器，属于之后几圈的定时器留在原槽位。
+ */
+class TimeWheel {
 public:
-    SortTimerList() : head(nullptr), tail(nullptr) {}
+    /**
+     * @param interval 槽位间隔（毫秒），也是 tick 的最小粒度
+     * @param slot_number 槽位个数，interval * slot_number 以内的定时器只需扫描一次
+     */
+    explicit TimeWheel(int interval = TIMER_TICK_MS, int slot_number = 64);
 
-    ~SortTimerList() {
-        UtilTimer *temp = head;
-        while (temp) {
-            head = temp->next;
-            delete temp;
-            temp = head;
-        }
-    }
+    ~TimeWheel();
 
     bool add_timer(UtilTimer *timer);
 
@@ -63,11 +76,17 @@ public:
     void tick();
 
 private:
-    UtilTimer *head;
-    UtilTimer *tail;
+    int m_interval;
+    int m_slot_number;
+    UtilTimer **m_slots;
+    long m_current;     // 下一个要处理的槽位序号（绝对序号，对槽位数取模后才是下标）
 
 private:
-    void add_timer(UtilTimer *timer, UtilTimer *list_head);
+    long tick_of(long long expire) const;
+
+    void link(UtilTimer *timer);
+
+    void unlink(UtilTimer *timer);
 };
 
 #endif //MYTINYWEBSERVER_TIMER_H